@@ -0,0 +1,108 @@
+#ifndef CANCELLATIONTOKEN_HPP
+#define CANCELLATIONTOKEN_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+#include <atomic>
+#include <cinttypes>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace tinc {
+
+/**
+ * @brief Shared flag used to cancel computations cooperatively
+ *
+ * Copies of a token share their state, so cancelling any copy cancels them
+ * all. Long running computations should check cancelled() regularly and
+ * return early. Work that can't poll, like a child process, can be stopped
+ * from a cancel callback.
+ * @code
+CancellationToken token;
+Executor::global().submit([token]() {
+  while (!token.cancelled()) {
+    // compute a step
+  }
+});
+token.cancel();
+ * @endcode
+ */
+class CancellationToken {
+public:
+  CancellationToken() : mState(std::make_shared<State>()) {}
+
+  /**
+   * @brief Cancel all copies of this token and call cancel callbacks
+   *
+   * Only the first call has an effect.
+   */
+  void cancel();
+
+  /**
+   * @brief true if cancel() has been called on any copy of this token
+   */
+  bool cancelled() const { return mState->cancelled; }
+
+  /**
+   * @brief Register function to be called when the token is cancelled
+   * @return handle to remove the callback with removeCancelCallback()
+   *
+   * If the token has already been cancelled, the function is called
+   * immediately. The function is called from the thread calling cancel() and
+   * must not register or remove callbacks.
+   */
+  uint64_t registerCancelCallback(std::function<void()> func);
+
+  /**
+   * @brief Remove callback registered with registerCancelCallback()
+   *
+   * If the callback is running, waits for it to finish, so anything it uses
+   * can be destroyed after this returns.
+   */
+  void removeCancelCallback(uint64_t handle);
+
+private:
+  struct State {
+    std::atomic<bool> cancelled{false};
+    std::mutex callbackLock;
+    std::map<uint64_t, std::function<void()>> callbacks;
+    uint64_t nextHandle{1};
+  };
+
+  std::shared_ptr<State> mState;
+};
+
+} // namespace tinc
+
+#endif // CANCELLATIONTOKEN_HPP
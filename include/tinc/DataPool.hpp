@@ -33,8 +33,17 @@
  * authors: Andres Cabrera
 */
 
+#include "tinc/FieldReader.hpp"
 #include "tinc/ParameterSpace.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 namespace tinc {
 /**
  * @brief The DataPool class gathers data files across directories that span a
@@ -52,6 +61,8 @@ public:
 
   DataPool(ParameterSpace &ps, std::string sliceCacheDir = std::string());
 
+  ~DataPool();
+
   /**
    * @brief registerDataFile
    * @param filename
@@ -88,12 +99,63 @@ public:
    * @return filename of the extracted slice
    *
    * The output is a multidimensional slice of the data for the "field" values.
-   * The number of dimensions of the result is the size of sliceDimensions
+   * Slice dimensions can be any mix of dimensions that affect the filesystem
+   * path and the dimensions contained in the data files. All other dimensions
+   * are fixed at their current values. The NetCDF variable "data" has one
+   * dimension for each entry in sliceDimensions, in the same order, with a
+   * coordinate variable holding the dimension's values. If the field has more
+   * than one value per sample, an additional last dimension "components" is
+   * added.
+   *
+   * The "data" variable has the native type of the field (e.g. int32 or
+   * double). If the field's type differs across data files, or an integer
+   * field has missing samples (stored as NaN), double is used.
+   *
+   * The slice file stores its provenance (field, slice dimensions, fixed
+   * indeces and a fingerprint of the source files) as the global attribute
+   * "tinc_provenance". If a slice file with matching provenance already exists
+   * in the cache directory, it is returned without reading the data files.
    */
-  // FIXME implement multidimensional slicing
   std::string createDataSlice(std::string field,
                               std::vector<std::string> sliceDimensions);
 
+  /**
+   * @brief Extract a slice of data into memory
+   * @param field name of the field to extract
+   * @param sliceDimensions dimensions that can change across the slice
+   * @param[out] slice values of the slice
+   * @param writeFile if true, also write the slice file to the cache
+   * directory in the background
+   * @return true if the slice could be extracted
+   *
+   * The slice has the same shape and data type as the "data" variable written
+   * by createDataSlice(), but no file is read or written unless writeFile is
+   * true. Use BinaryArray::convertTo() to get the values in a different
+   * type. Use waitForSliceWrites() to wait until files have been written.
+   */
+  bool sliceToMemory(std::string field,
+                     std::vector<std::string> sliceDimensions,
+                     BinaryArray &slice, bool writeFile = false);
+
+  bool sliceToMemory(std::string field, std::string sliceDimension,
+                     BinaryArray &slice, bool writeFile = false);
+
+  /**
+   * @brief Wait for slice files being written by sliceToMemory()
+   * @return false if any of the files could not be written
+   */
+  bool waitForSliceWrites();
+
+  /**
+   * @brief Get data type and shape of a slice file
+   * @param sliceFile file name returned by createDataSlice()
+   * @param[out] type data type of the "data" variable
+   * @param[out] shape shape of the "data" variable
+   * @return false if the file can't be read
+   */
+  bool getSliceInfo(std::string sliceFile, BinaryArray::Datatype &type,
+                    std::vector<uint64_t> &shape);
+
   /**
    * @brief get list of full path to current files in datapool
    * @return list of files
@@ -109,6 +171,9 @@ public:
    * @param data
    * @param maxLen
    * @return number of elements written to data pointer
+   *
+   * Values are converted to float. Use sliceToMemory() to get the slice in
+   * the field's native type.
    */
   size_t readDataSlice(std::string field, std::string sliceDimension,
                        void *data, size_t maxLen);
@@ -121,6 +186,52 @@ public:
 
   void setCacheDirectory(std::string cacheDirectory);
 
+  /**
+   * @brief Set maximum number of directories read concurrently when slicing
+   * @param count number of reading threads. Set to 1 to read serially.
+   *
+   * Reading data files is usually dominated by filesystem latency, so values
+   * larger than the number of cores can be useful on network filesystems.
+   * Default is the number of hardware threads.
+   */
+  void setReadConcurrency(size_t count) { mReadConcurrency = count; }
+
+  size_t getReadConcurrency() { return mReadConcurrency; }
+
+  /**
+   * @brief Register reader for a type of data file
+   * @param fileType name of the file type
+   * @param reader reader to use for the file type
+   * @param extensions file extensions including the dot, e.g. ".csv"
+   * @param signatures bytes that files of this type start with
+   *
+   * Readers for JSON (".json"), CSV (".csv"), TINC binary arrays (".tincarr")
+   * and NetCDF (".nc") files are registered by default. Registering a reader
+   * for an existing file type replaces it.
+   */
+  void registerFieldReader(std::string fileType,
+                           std::shared_ptr<FieldReader> reader,
+                           std::vector<std::string> extensions = {},
+                           std::vector<std::string> signatures = {});
+
+  /**
+   * @brief Set memory budget for fields extracted from data files
+   * @param bytes maximum size of the cache. 0 disables caching.
+   *
+   * Fields read from data files are kept in memory keyed by file path,
+   * modification time and field name, so repeated slices and requests for
+   * different fields of the same files don't need to read and parse the files
+   * again. Least recently used fields are evicted when the budget is exceeded.
+   */
+  void setFieldCacheSize(size_t bytes);
+
+  size_t getFieldCacheSize() { return mFieldCacheBudget; }
+
+  /**
+   * @brief Remove all fields from the in memory field cache
+   */
+  void clearFieldCache();
+
   /**
    *  Replace this function when the parameter space runningPaths() function is
    * not adequate.
@@ -135,12 +246,94 @@ protected:
   bool getFieldFromFile(std::string field, std::string file, void *data,
                         size_t length);
 
+  /**
+   * @brief Determine file type from its extension or its first bytes
+   * @return file type as registered in registerFieldReader() or empty string
+   * if unknown
+   */
   std::string getFileType(std::string file);
 
+  /**
+   * @brief get reader for file according to its file type
+   * @return reader or nullptr if no reader is registered for the file type
+   *
+   * Files of unknown type are read with the "json" reader.
+   */
+  std::shared_ptr<FieldReader> getFieldReader(const std::string &file);
+
+  /**
+   * @brief get field from data file, reading it if not in the field cache
+   * @return field data or nullptr if file or field could not be read
+   */
+  std::shared_ptr<const BinaryArray> getFieldData(const std::string &field,
+                                                  const std::string &file);
+
+  /**
+   * @brief read field values for samples found in a directory
+   * @param field name of the field to read
+   * @param directory directory containing the data files
+   * @param samples indeces into sampleIndeces and sampleValues to read
+   * @param sampleIndeces parameter space indeces for each sample
+   * @param sampleValues output values for each sample
+   * @return true if values were read for all samples
+   */
+  bool readSliceSamples(
+      const std::string &field, const std::string &directory,
+      const std::vector<size_t> &samples,
+      const std::vector<std::map<std::string, size_t>> &sampleIndeces,
+      std::vector<std::shared_ptr<const BinaryArray>> &sampleValues);
+
 private:
+  struct SliceRequest {
+    std::string field;
+    std::vector<std::string> dimensionNames;
+    std::vector<std::vector<float>> coordinates;
+    // Parameter space indeces for each sample in the slice
+    std::vector<std::map<std::string, size_t>> sampleIndeces;
+    std::map<std::string, std::vector<size_t>> samplesPerDirectory;
+    std::string fileName;
+    std::string provenance;
+  };
+
+  bool prepareSlice(std::string field, std::vector<std::string> sliceDimensions,
+                    SliceRequest &request, bool computeProvenance);
+  bool readSlice(SliceRequest &request, BinaryArray &slice);
+  bool writeSliceFile(const SliceRequest &request, const BinaryArray &slice);
+
   ParameterSpace *mParameterSpace;
   std::string mSliceCacheDirectory;
   std::map<std::string, std::string> mDataFilenames;
+  std::atomic<size_t> mReadConcurrency{
+      std::max(1u, std::thread::hardware_concurrency())};
+
+  struct FieldCacheEntry {
+    std::shared_ptr<const BinaryArray> data;
+    int64_t modified;
+    int64_t fileSize;
+    size_t bytes;
+    std::list<std::string>::iterator lruPosition;
+  };
+
+  void insertInFieldCache(const std::string &key,
+                          std::shared_ptr<const BinaryArray> data,
+                          int64_t modified, int64_t fileSize);
+  void evictFromFieldCache(size_t budget);
+
+  std::mutex mFieldCacheLock;
+  std::unordered_map<std::string, FieldCacheEntry> mFieldCache;
+  std::list<std::string> mFieldCacheLru; // Most recently used first
+  size_t mFieldCacheBudget{128 * 1024 * 1024};
+  size_t mFieldCacheBytes{0};
+
+  void registerDefaultFieldReaders();
+
+  std::mutex mFieldReadersLock;
+  std::map<std::string, std::shared_ptr<FieldReader>> mFieldReaders;
+  std::map<std::string, std::string> mFileTypeExtensions;
+  std::vector<std::pair<std::string, std::string>> mFileTypeSignatures;
+
+  std::mutex mSliceWritesLock;
+  std::list<std::future<bool>> mSliceWrites;
 };
 }
 
@@ -33,29 +33,101 @@
  * authors: Andres Cabrera
 */
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 #include "tinc/BufferManager.hpp"
+#include "tinc/Executor.hpp"
 // -----------------------------------------
 
 namespace tinc {
 
+/**
+ * @brief Computes data into a BufferManager in the background
+ *
+ * Requests from processAsync() are queued and computed by workers running on
+ * Executor::global(). Each worker writes to its own free buffer, so the
+ * number of buffers should be larger than the number of workers. When the
+ * queue is full, the oldest queued request is dropped, as it has been
+ * superseded by newer requests. A result only becomes the current buffer if
+ * no newer request has already finished.
+ */
 template <class DataType>
 class DeferredComputation : public BufferManager<DataType> {
 public:
-  DeferredComputation(uint16_t size = 2) : BufferManager<DataType>(size) {}
+  DeferredComputation(uint16_t size = 2)
+      : BufferManager<DataType>(size), mSlotReserved(size, false) {}
 
   ~DeferredComputation() {
-    if (mProcessingThread) {
-      mProcessingThread->join();
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mRequests.clear();
+    lk.unlock();
+    for (auto &worker : mWorkers) {
+      Executor::global().wait(worker);
     }
   }
 
+  /**
+   * @brief Set number of requests computed at the same time
+   */
+  void setMaxWorkers(int workers) {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mMaxWorkers = std::max(workers, 1);
+    startWorkers();
+  }
+
+  int getMaxWorkers() { return mMaxWorkers; }
+
+  /**
+   * @brief Set number of requests waiting to be computed
+   *
+   * When a new request arrives and the queue is full, the oldest queued
+   * request is dropped.
+   */
+  void setMaxQueuedRequests(size_t size) {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mMaxQueuedRequests = std::max(size, size_t(1));
+    while (mRequests.size() > mMaxQueuedRequests) {
+      mRequests.pop_front();
+      mDroppedRequests++;
+    }
+  }
+
+  size_t getMaxQueuedRequests() { return mMaxQueuedRequests; }
+
+  /**
+   * @brief Number of requests dropped because newer requests replaced them
+   */
+  uint64_t droppedRequests() { return mDroppedRequests; }
+
+  /**
+   * @brief Register function called when a computation finishes
+   *
+   * The function is called with the result of the computation from the
+   * thread that computed it.
+   */
+  void registerDoneCallback(std::function<void(bool)> func) {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mDoneCallbacks.push_back(func);
+  }
+
+  /**
+   * @brief Wait until all queued requests have been computed
+   */
+  void waitForCompletion() {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    mIdle.wait(lk,
+               [this]() { return mRequests.empty() && mActiveWorkers == 0; });
+  }
+
   //  template<typename ...ProcessParams>
   //  bool process(bool(*func)(std::shared_ptr<DataType>, ProcessParams... ),
   //               ProcessParams... params) {
@@ -83,57 +155,41 @@ public:
   //    return false;
   //  }
 
+  /**
+   * @brief Compute in the calling thread
+   * @param func function called with the buffer to write to and params
+   * @return false if no buffer was free or func returned false
+   */
   template <typename Function, typename... ProcessParams>
   bool process(Function func, ProcessParams... params) {
-    // TODO do a try lock and fail gracefully to avoid accumulating process
-    // calls?
-
-    std::cout << "Starting process" << std::endl;
-    std::unique_lock<std::mutex> lk(mProcessLock);
-    uint16_t freeBuffer = (BufferManager<DataType>::mReadBuffer + 1) %
-                          BufferManager<DataType>::mSize;
-    if (BufferManager<DataType>::mData[freeBuffer].use_count() ==
-        1) { // TODO wait a bit or block for the release of buffer?
-      if (func(BufferManager<DataType>::mData[freeBuffer], params...)) {
-        BufferManager<DataType>::mNewData = true;
-        BufferManager<DataType>::mReadBuffer =
-            (BufferManager<DataType>::mReadBuffer + 1) %
-            BufferManager<DataType>::mSize;
-        std::cout << "Ending process - ok" << std::endl;
-        return true;
-      } else {
-        std::cerr << "ERROR: Function returned false" << std::endl;
-      }
-    } else {
-      std::cerr << "ERROR: Ignoring process request as target buffer busy"
-                << std::endl;
-    }
-    std::cout << "Ending process - failed" << std::endl;
-    return false;
+    return computeRequest(
+        [&](std::shared_ptr<DataType> buffer) {
+          return func(buffer, params...);
+        },
+        ++mSequence);
   }
 
+  /**
+   * @brief Queue computation and return immediately
+   *
+   * The function and parameters are copied.
+   */
   template <typename Function, typename... ProcessParams>
   void processAsync(Function &&func, ProcessParams &&... params) {
-    std::unique_lock<std::mutex> lk(mThreadLock);
-    if (mProcessingThread) {
-      mProcessingThread->join();
+    Request request;
+    request.function =
+        std::bind(std::forward<Function>(func), std::placeholders::_1,
+                  std::forward<ProcessParams>(params)...);
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    request.sequence = ++mSequence;
+    if (mRequests.size() >= mMaxQueuedRequests) {
+      mRequests.pop_front();
+      mDroppedRequests++;
     }
-
-    std::unique_lock<std::mutex> lck(mAsyncMutex);
-    mProcessingThread = std::make_unique<std::thread>([&]() {
-      std::unique_lock<std::mutex> lck(mAsyncMutex);
-      mProcessing = true;
-      mAsyncSignal.notify_all();
-      process(std::forward<Function>(func),
-              std::forward<ProcessParams>(params)...);
-      mProcessing = false;
-    });
-    mAsyncSignal.wait(lck); // Wait for thread to start
+    mRequests.push_back(std::move(request));
+    startWorkers();
   }
 
-  std::mutex mAsyncMutex;
-  std::condition_variable mAsyncSignal;
-
   //  template<typename ...ProcessParams>
   //  void processAsync(bool(*func)(std::shared_ptr<DataType>, ProcessParams...
   //  ),
@@ -149,14 +205,102 @@ public:
   //    });
   //  }
 
-  bool processing() { return mProcessing; }
+  /**
+   * @brief true if requests are queued or being computed
+   */
+  bool processing() {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    return mRequests.size() > 0 || mActiveWorkers > 0;
+  }
 
 private:
-  std::mutex mThreadLock;
-  // TODO allow multiple threads
-  std::shared_ptr<std::thread> mProcessingThread;
-  std::atomic<bool> mProcessing;
-  std::mutex mProcessLock;
+  struct Request {
+    std::function<bool(std::shared_ptr<DataType>)> function;
+    uint64_t sequence;
+  };
+
+  // Requires mQueueLock
+  void startWorkers() {
+    mWorkers.remove_if([](std::future<void> &worker) {
+      return worker.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    });
+    while (mActiveWorkers < mMaxWorkers &&
+           (size_t)mActiveWorkers < mRequests.size()) {
+      mActiveWorkers++;
+      mWorkers.push_back(
+          Executor::global().submit([this]() { workerFunction(); }));
+    }
+  }
+
+  void workerFunction() {
+    std::unique_lock<std::mutex> lk(mQueueLock);
+    while (mRequests.size() > 0) {
+      auto request = std::move(mRequests.front());
+      mRequests.pop_front();
+      lk.unlock();
+      computeRequest(request.function, request.sequence);
+      lk.lock();
+    }
+    mActiveWorkers--;
+    mIdle.notify_all();
+  }
+
+  bool computeRequest(
+      const std::function<bool(std::shared_ptr<DataType>)> &function,
+      uint64_t sequence) {
+    int slot = -1;
+    {
+      std::unique_lock<std::mutex> lk(BufferManager<DataType>::mDataLock);
+      for (int i = 0; i < BufferManager<DataType>::mSize; i++) {
+        if (i != BufferManager<DataType>::mReadBuffer && !mSlotReserved[i] &&
+            BufferManager<DataType>::mData[i].use_count() == 1) {
+          mSlotReserved[i] = true;
+          slot = i;
+          break;
+        }
+      }
+    }
+    bool ok = false;
+    if (slot >= 0) {
+      ok = function(BufferManager<DataType>::mData[slot]);
+      std::unique_lock<std::mutex> lk(BufferManager<DataType>::mDataLock);
+      mSlotReserved[slot] = false;
+      // Results of older requests don't replace newer ones
+      if (ok && sequence > mPublishedSequence) {
+        mPublishedSequence = sequence;
+        BufferManager<DataType>::mReadBuffer = slot;
+        BufferManager<DataType>::mNewData = true;
+      }
+    } else {
+      std::cerr << "ERROR: Ignoring process request as no buffer is free"
+                << std::endl;
+    }
+    std::vector<std::function<void(bool)>> callbacks;
+    {
+      std::unique_lock<std::mutex> lk(mQueueLock);
+      callbacks = mDoneCallbacks;
+    }
+    for (auto &callback : callbacks) {
+      callback(ok);
+    }
+    return ok;
+  }
+
+  std::mutex mQueueLock; // Protects requests, workers and callbacks
+  std::condition_variable mIdle;
+  std::deque<Request> mRequests;
+  std::list<std::future<void>> mWorkers;
+  std::vector<std::function<void(bool)>> mDoneCallbacks;
+  int mMaxWorkers{1};
+  int mActiveWorkers{0};
+  size_t mMaxQueuedRequests{1};
+  std::atomic<uint64_t> mDroppedRequests{0};
+  std::atomic<uint64_t> mSequence{0};
+
+  // Protected by mDataLock
+  std::vector<bool> mSlotReserved;
+  uint64_t mPublishedSequence{0};
 };
 
 } // namespace tinc
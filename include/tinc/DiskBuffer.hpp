@@ -34,6 +34,8 @@
 */
 
 #include <fstream>
+#include <functional>
+#include <future>
 #include <string>
 #include <cstring>
 #include <errno.h>
@@ -44,6 +46,7 @@
 
 #include "tinc/BufferManager.hpp"
 #include "tinc/DiskBufferAbstract.hpp"
+#include "tinc/Executor.hpp"
 
 namespace tinc {
 
@@ -52,6 +55,11 @@ class DiskBuffer : public BufferManager<DataType>, public DiskBufferAbstract {
 public:
   DiskBuffer(std::string id = "", std::string fileName = "",
              std::string path = "", uint16_t size = 2);
+
+  /**
+   * @brief Waits for pending writes
+   */
+  virtual ~DiskBuffer() { waitForPendingWrites(); }
   /**
    * @brief updateData
    * @param filename
@@ -66,12 +74,50 @@ public:
     mUpdateCallbacks.push_back(cb);
   }
 
+  /**
+   * @brief Block until data written asynchronously has been stored on disk
+   * @return false if the last write failed
+   */
+  bool waitForPendingWrites() {
+    std::unique_lock<std::mutex> lk(mPendingWriteLock);
+    if (mPendingWrite.valid()) {
+      return Executor::global().wait(mPendingWrite);
+    }
+    return true;
+  }
+
 protected:
   virtual bool parseFile(std::ifstream &file,
                          std::shared_ptr<DataType> newData) = 0;
 
+  /**
+   * @brief Make newData the current data without reading it from disk
+   *
+   * Update callbacks are called.
+   * @return the buffer that now holds the data
+   */
+  std::shared_ptr<DataType> publishData(DataType &&newData);
+
+  /**
+   * @brief Run writeFunction on Executor::global()
+   *
+   * Only one write is in flight at a time. If a previous write has not
+   * completed, this function blocks until it does, so writes reach the disk in
+   * the order they were requested.
+   */
+  void persistAsync(std::function<bool()> writeFunction) {
+    std::unique_lock<std::mutex> lk(mPendingWriteLock);
+    if (mPendingWrite.valid()) {
+      Executor::global().wait(mPendingWrite);
+    }
+    mPendingWrite = Executor::global().submit(writeFunction);
+  }
+
   std::vector<std::function<void(bool)>> mUpdateCallbacks;
 
+  std::future<bool> mPendingWrite;
+  std::mutex mPendingWriteLock;
+
   // Make this function private as users should not have a way to make the
   // buffer writable. Data writing should be done by writing to the file.
   using BufferManager<DataType>::getWritable;
@@ -112,6 +158,18 @@ bool DiskBuffer<DataType>::updateData(std::string filename) {
   return ret;
 }
 
+template <class DataType>
+std::shared_ptr<DataType>
+DiskBuffer<DataType>::publishData(DataType &&newData) {
+  auto buffer = getWritable();
+  *buffer = std::move(newData);
+  BufferManager<DataType>::doneWriting(buffer);
+  for (auto cb : mUpdateCallbacks) {
+    cb(true);
+  }
+  return buffer;
+}
+
 } // namespace tinc
 
 #endif // DISKBUFFER_HPP
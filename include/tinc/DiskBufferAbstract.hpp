@@ -36,6 +36,8 @@
 #include "tinc/IdObject.hpp"
 #include "al/ui/al_Parameter.hpp"
 
+#include <cinttypes>
+#include <mutex>
 #include <string>
 
 namespace tinc {
@@ -56,10 +58,54 @@ public:
   void setPath(std::string path) { m_path = path; }
   std::string getPath() { return m_path; }
 
+  /**
+   * @brief true if fileName is unchanged since this buffer last wrote it
+   *
+   * Used by DiskBufferWatcher to ignore the buffer's own writes, as the
+   * buffer already holds the written data.
+   */
+  bool isOwnWrite(std::string fileName);
+
 protected:
+  /**
+   * @brief Generate a unique temporary file name in the same directory
+   *
+   * The extension of fileName is preserved, so file writers that determine the
+   * format from the extension can be used.
+   */
+  static std::string temporaryFileName(std::string fileName);
+
+  /**
+   * @brief Replace fileName with the temporary file tempFileName
+   *
+   * On POSIX systems the replacement is atomic so readers never see a
+   * partially written file. The file is recorded as written by this buffer,
+   * see isOwnWrite().
+   */
+  bool publishTemporaryFile(std::string tempFileName, std::string fileName);
+
+  /**
+   * @brief Write contents to fileName through a temporary file and rename
+   */
+  bool writeFileAtomically(std::string fileName, const std::string &contents);
+
   std::string m_fileName;
   std::string m_path;
   std::shared_ptr<al::ParameterString> m_trigger;
+
+private:
+  // Identifies the contents of a file without reading it
+  struct FileStamp {
+    uint64_t inode{0};
+    uint64_t size{0};
+    int64_t modified{0};
+    bool valid{false};
+  };
+  static FileStamp fileStamp(const std::string &fileName);
+
+  std::mutex mOwnWriteLock; // Protects members below
+  std::string mOwnWriteName;
+  FileStamp mOwnWriteStamp;
 };
 
 } // namespace tinc
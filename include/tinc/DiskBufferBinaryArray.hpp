@@ -0,0 +1,344 @@
+#ifndef DISKBUFFERBINARYARRAY_HPP
+#define DISKBUFFERBINARYARRAY_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include "tinc/DiskBuffer.hpp"
+
+#include <cinttypes>
+#include <cstring>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief N-dimensional numeric array stored in the TINC binary array format
+ *
+ * The file consists of a small header followed by the raw array data. All
+ * values are little-endian:
+ *
+ * | offset     | size | content                                      |
+ * |------------|------|----------------------------------------------|
+ * | 0          | 8    | magic "TINCARR\0"                            |
+ * | 8          | 1    | format version (1)                           |
+ * | 9          | 1    | data type (BinaryArray::Datatype)            |
+ * | 10         | 1    | compression (BinaryArray::Compression)       |
+ * | 11         | 1    | number of dimensions N                       |
+ * | 12         | 4    | offset of data from start of file (uint32)   |
+ * | 16         | 8*N  | shape (uint64)                               |
+ * | 16 + 8*N   | 8*N  | strides in bytes (int64)                     |
+ *
+ * The data offset is padded to a multiple of 64 bytes. The whole file can be
+ * read with a single read or memory mapped. For example, to write a float
+ * array from python with numpy:
+ * @code
+a = np.ascontiguousarray(a, dtype='<f4')
+n = a.ndim
+offset = ((16 + 16 * n + 63) // 64) * 64
+header = b'TINCARR\0' + struct.pack('<BBBBI', 1, 8, 0, n, offset)
+header += struct.pack('<%dQ' % n, *a.shape) + struct.pack('<%dq' % n, *a.strides)
+f.write(header.ljust(offset, b'\0') + a.tobytes())
+ * @endcode
+ */
+class BinaryArray {
+public:
+  typedef enum : uint8_t {
+    INT8 = 0,
+    UINT8 = 1,
+    INT16 = 2,
+    UINT16 = 3,
+    INT32 = 4,
+    UINT32 = 5,
+    INT64 = 6,
+    UINT64 = 7,
+    FLOAT32 = 8,
+    FLOAT64 = 9
+  } Datatype;
+
+  typedef enum : uint8_t { COMPRESSION_NONE = 0 } Compression;
+
+  static const uint8_t FORMAT_VERSION = 1;
+
+  /**
+   * @brief Allocate contiguous row-major array
+   */
+  void allocate(Datatype type, std::vector<uint64_t> shape);
+
+  Datatype getDataType() const { return mDataType; }
+  std::vector<uint64_t> getShape() const { return mShape; }
+  /**
+   * @brief Distance in bytes between elements along each dimension
+   */
+  std::vector<int64_t> getStrides() const { return mStrides; }
+
+  size_t elementCount() const;
+
+  /**
+   * @brief Number of bytes spanned by the array data
+   */
+  size_t byteSize() const;
+
+  void *data() { return mBytes.data() + mDataOffset; }
+  const void *data() const { return mBytes.data() + mDataOffset; }
+
+  /**
+   * @brief Typed access to the data
+   * @return pointer to data or nullptr if T does not match the data type
+   */
+  template <class T> T *dataAs();
+  template <class T> const T *dataAs() const;
+
+  /**
+   * @brief Append all values converted to T in row-major order
+   */
+  template <class T> void appendValues(std::vector<T> &values) const;
+
+  /**
+   * @brief Write all values converted to T to contiguous memory
+   * @param destination memory for elementCount() values
+   */
+  template <class T> void copyValues(T *destination) const;
+
+  /**
+   * @brief Write all values converted to type to contiguous memory
+   * @param type data type to convert to
+   * @param destination memory for elementCount() values of type
+   */
+  void convertTo(Datatype type, void *destination) const;
+
+  static bool isFloatingPoint(Datatype type) {
+    return type == FLOAT32 || type == FLOAT64;
+  }
+
+  /**
+   * @brief Copy elements along the first dimension into a contiguous array
+   * @param begin first element to copy
+   * @param count number of elements
+   * @param destination array of shape {count, shape[1], ...}
+   * @return false if the range is out of bounds
+   */
+  bool copyElements(size_t begin, size_t count, BinaryArray &destination) const;
+
+  static size_t elementSize(Datatype type);
+
+  /**
+   * @brief Decode the contents of a binary array file
+   * @param fileBytes file contents. The data is used in place.
+   * @return false if the contents are not a valid binary array
+   */
+  bool decode(std::vector<uint8_t> &&fileBytes);
+
+  /**
+   * @brief Decode a range of elements along the first dimension
+   * @param fileBytes contents of a binary array file, e.g. memory mapped
+   * @param fileSize size of fileBytes
+   * @param begin first element to decode
+   * @param count number of elements
+   * @return false if the contents are invalid or the range is out of bounds
+   *
+   * Only the requested elements are copied into the array.
+   */
+  bool decodeElements(const uint8_t *fileBytes, size_t fileSize, size_t begin,
+                      size_t count);
+
+  /**
+   * @brief Encode array as the contents of a binary array file
+   */
+  std::string encode() const;
+
+private:
+  static bool decodeHeader(const uint8_t *fileBytes, size_t fileSize,
+                           Datatype &type, std::vector<uint64_t> &shape,
+                           std::vector<int64_t> &strides, size_t &dataOffset);
+  template <class T> static T loadValue(const uint8_t *value);
+  template <class T> static T convertValue(Datatype type, const uint8_t *value);
+
+  Datatype mDataType{FLOAT32};
+  std::vector<uint64_t> mShape;
+  std::vector<int64_t> mStrides;
+  // Either the complete file contents or only the data.
+  std::vector<uint8_t> mBytes;
+  size_t mDataOffset{0};
+};
+
+template <class T> struct BinaryArrayType;
+template <> struct BinaryArrayType<int8_t> {
+  static const BinaryArray::Datatype type = BinaryArray::INT8;
+};
+template <> struct BinaryArrayType<uint8_t> {
+  static const BinaryArray::Datatype type = BinaryArray::UINT8;
+};
+template <> struct BinaryArrayType<int16_t> {
+  static const BinaryArray::Datatype type = BinaryArray::INT16;
+};
+template <> struct BinaryArrayType<uint16_t> {
+  static const BinaryArray::Datatype type = BinaryArray::UINT16;
+};
+template <> struct BinaryArrayType<int32_t> {
+  static const BinaryArray::Datatype type = BinaryArray::INT32;
+};
+template <> struct BinaryArrayType<uint32_t> {
+  static const BinaryArray::Datatype type = BinaryArray::UINT32;
+};
+template <> struct BinaryArrayType<int64_t> {
+  static const BinaryArray::Datatype type = BinaryArray::INT64;
+};
+template <> struct BinaryArrayType<uint64_t> {
+  static const BinaryArray::Datatype type = BinaryArray::UINT64;
+};
+template <> struct BinaryArrayType<float> {
+  static const BinaryArray::Datatype type = BinaryArray::FLOAT32;
+};
+template <> struct BinaryArrayType<double> {
+  static const BinaryArray::Datatype type = BinaryArray::FLOAT64;
+};
+
+template <class T> T *BinaryArray::dataAs() {
+  if (BinaryArrayType<T>::type != mDataType) {
+    return nullptr;
+  }
+  return static_cast<T *>(data());
+}
+
+template <class T> const T *BinaryArray::dataAs() const {
+  if (BinaryArrayType<T>::type != mDataType) {
+    return nullptr;
+  }
+  return static_cast<const T *>(data());
+}
+
+// Elements might not be aligned in memory, so they are copied before use
+template <class T> T BinaryArray::loadValue(const uint8_t *value) {
+  T v;
+  memcpy(&v, value, sizeof(T));
+  return v;
+}
+
+template <class T>
+T BinaryArray::convertValue(Datatype type, const uint8_t *value) {
+  switch (type) {
+  case INT8:
+    return (T)loadValue<int8_t>(value);
+  case UINT8:
+    return (T)loadValue<uint8_t>(value);
+  case INT16:
+    return (T)loadValue<int16_t>(value);
+  case UINT16:
+    return (T)loadValue<uint16_t>(value);
+  case INT32:
+    return (T)loadValue<int32_t>(value);
+  case UINT32:
+    return (T)loadValue<uint32_t>(value);
+  case INT64:
+    return (T)loadValue<int64_t>(value);
+  case UINT64:
+    return (T)loadValue<uint64_t>(value);
+  case FLOAT32:
+    return (T)loadValue<float>(value);
+  case FLOAT64:
+    return (T)loadValue<double>(value);
+  }
+  return T();
+}
+
+template <class T> void BinaryArray::copyValues(T *destination) const {
+  size_t count = elementCount();
+  std::vector<uint64_t> index(mShape.size(), 0);
+  auto base = static_cast<const uint8_t *>(data());
+  for (size_t i = 0; i < count; i++) {
+    int64_t offset = 0;
+    for (size_t d = 0; d < mShape.size(); d++) {
+      offset += index[d] * mStrides[d];
+    }
+    destination[i] = convertValue<T>(mDataType, base + offset);
+    for (size_t d = mShape.size(); d > 0; d--) {
+      if (++index[d - 1] < mShape[d - 1]) {
+        break;
+      }
+      index[d - 1] = 0;
+    }
+  }
+}
+
+template <class T>
+void BinaryArray::appendValues(std::vector<T> &values) const {
+  size_t previousSize = values.size();
+  values.resize(previousSize + elementCount());
+  copyValues(values.data() + previousSize);
+}
+
+/**
+ * @brief DiskBuffer for files in the TINC binary array format
+ *
+ * See BinaryArray for a description of the format.
+ */
+class DiskBufferBinaryArray : public DiskBuffer<BinaryArray> {
+public:
+  DiskBufferBinaryArray(std::string id = "", std::string fileName = "",
+                        std::string path = "", uint16_t size = 2)
+      : DiskBuffer<BinaryArray>(id, fileName, path, size) {}
+
+  bool updateData(std::string filename = "") override;
+
+  /**
+   * @brief Make array the current data and write it to disk
+   * @param array the array to move into the buffer
+   * @param filename if not empty, sets the current file name
+   * @return false if the previous write to disk failed. The result of this
+   * write is returned by waitForPendingWrites()
+   *
+   * The file is written in the background through a temporary file. Use
+   * waitForPendingWrites() to wait for the file to be on disk.
+   */
+  bool writeArray(BinaryArray &&array, std::string filename = "");
+
+  /**
+   * @brief Copy contiguous row-major data into the buffer and write to disk
+   */
+  template <class T>
+  bool writeArray(const T *data, std::vector<uint64_t> shape,
+                  std::string filename = "") {
+    BinaryArray array;
+    array.allocate(BinaryArrayType<T>::type, shape);
+    memcpy(array.data(), data, array.byteSize());
+    return writeArray(std::move(array), filename);
+  }
+
+protected:
+  bool parseFile(std::ifstream &file,
+                 std::shared_ptr<BinaryArray> newData) override;
+};
+
+} // namespace tinc
+
+#endif // DISKBUFFERBINARYARRAY_HPP
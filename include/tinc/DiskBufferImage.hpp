@@ -37,6 +37,8 @@
 
 #include "al/graphics/al_Image.hpp"
 
+#include <cstdio>
+
 namespace tinc {
 
 class ImageDiskBuffer : public DiskBuffer<al::Image> {
@@ -63,16 +65,75 @@ public:
     return ret;
   }
 
+  /**
+   * @brief Make pixels the current image and write them to an image file
+   * @param newData pixel data
+   * @param width width in pixels
+   * @param height height in pixels
+   * @param filename if not empty, sets the current file name
+   * @param numComponents number of components per pixel in newData
+   * @return false if the image format is invalid or the previous write to
+   * disk failed. The result of this write is returned by waitForPendingWrites()
+   *
+   * The pixels are copied, so newData can be reused after this function
+   * returns. The new image is available through get() when this function
+   * returns and update callbacks have been called. As with images loaded
+   * from disk, the image in the buffer has 4 components (RGBA).
+   *
+   * The file is written in the background through a temporary file that then
+   * replaces the target file, so readers never see partially written files.
+   * Use waitForPendingWrites() to wait for the file to be on disk.
+   */
   bool writePixels(unsigned char *newData, int width, int height,
-                   std::string filename = "") {
-
-    if (filename.size() == 0) {
-      filename = getCurrentFileName();
+                   std::string filename = "", int numComponents = 3) {
+    if (numComponents < 1 || numComponents > 4 || width < 0 || height < 0) {
+      std::cerr << __FUNCTION__ << ": ERROR invalid image format" << std::endl;
+      return false;
     }
-    al::Image::saveImage(filename, newData, width, height);
-
-    return updateData(filename);
-  };
+    if (filename.size() > 0) {
+      m_fileName = filename;
+    }
+    std::string fullName = m_path + m_fileName;
+    size_t pixelCount = (size_t)width * height;
+    std::vector<unsigned char> pixels(newData,
+                                      newData + pixelCount * numComponents);
+    // Ensure previous write has released its buffer
+    bool previousWritten = waitForPendingWrites();
+    al::Image image;
+    image.mArray.resize(pixelCount * 4);
+    for (size_t i = 0; i < pixelCount; i++) {
+      const unsigned char *pixel = pixels.data() + i * numComponents;
+      unsigned char *rgba = image.mArray.data() + i * 4;
+      if (numComponents < 3) {
+        // Gray or gray and alpha
+        rgba[0] = rgba[1] = rgba[2] = pixel[0];
+      } else {
+        rgba[0] = pixel[0];
+        rgba[1] = pixel[1];
+        rgba[2] = pixel[2];
+      }
+      rgba[3] = (numComponents == 2 || numComponents == 4)
+                    ? pixel[numComponents - 1]
+                    : 255;
+    }
+    image.mWidth = width;
+    image.mHeight = height;
+    image.mLoaded = true;
+    publishData(std::move(image));
+    persistAsync([this, fullName, pixels, width, height,
+                  numComponents]() mutable {
+      auto tempFileName = temporaryFileName(fullName);
+      if (!al::Image::saveImage(tempFileName, pixels.data(), width, height,
+                                false, numComponents) ||
+          !publishTemporaryFile(tempFileName, fullName)) {
+        std::cerr << "Error writing image: " << fullName << std::endl;
+        std::remove(tempFileName.c_str());
+        return false;
+      }
+      return true;
+    });
+    return previousWritten;
+  }
 
 protected:
   bool parseFile(std::ifstream &file,
@@ -45,26 +45,43 @@ public:
                  std::string path = "", uint16_t size = 2)
       : DiskBuffer<nlohmann::json>(id, fileName, path, size) {}
 
-  bool writeJson(nlohmann::json &newData, std::string filename = "") {
-    // output to json file on disk
-    if (filename.size() == 0) {
-      filename = getCurrentFileName();
-    }
+  /**
+   * @brief Make newData the current data and write it to disk
+   * @param newData json data
+   * @param filename if not empty, sets the current file name
+   * @return false if the previous write to disk failed. The result of this
+   * write is returned by waitForPendingWrites()
+   *
+   * The data is available through get() immediately. The file is written in
+   * the background to a temporary file that then replaces the target file, so
+   * readers never see partially written files. Use waitForPendingWrites() to
+   * wait for the file to be on disk.
+   */
+  bool writeJson(const nlohmann::json &newData, std::string filename = "") {
+    return writeJson(nlohmann::json(newData), filename);
+  }
 
-    std::ofstream of(filename, std::ofstream::out);
-    if (of.good()) {
-      of << newData.dump(2);
-      of.close();
-      if (!of.good()) {
-        std::cout << "Error writing json file." << std::endl;
+  /**
+   * @brief Move newData into the buffer and write it to disk
+   *
+   * See writeJson(const nlohmann::json &, std::string)
+   */
+  bool writeJson(nlohmann::json &&newData, std::string filename = "") {
+    if (filename.size() > 0) {
+      m_fileName = filename;
+    }
+    // Ensure previous write has released its buffer
+    bool previousWritten = waitForPendingWrites();
+    auto data = publishData(std::move(newData));
+    std::string fullName = m_path + m_fileName;
+    persistAsync([this, data, fullName]() {
+      if (!writeFileAtomically(fullName, data->dump())) {
+        std::cerr << "Error writing json file: " << fullName << std::endl;
         return false;
       }
-    } else {
-      std::cout << "Error creating json file" << std::endl;
-      return false;
-    }
-
-    return updateData(filename);
+      return true;
+    });
+    return previousWritten;
   }
 
 protected:
@@ -61,77 +61,206 @@ struct NC_Dimension {
   */
 };
 
+#ifdef TINC_HAS_NETCDF
+/**
+ * @brief Read a hyperslab of a NetCDF variable into memory of type DataType
+ *
+ * Specializations map each C++ type to the matching nc_get_vars_* function so
+ * values are only converted if the type in the file differs from DataType.
+ */
+template <class DataType> struct NetCDFTypedReader;
+
+template <> struct NetCDFTypedReader<double> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride, double *data) {
+    return nc_get_vars_double(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<float> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride, float *data) {
+    return nc_get_vars_float(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<int8_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride, int8_t *data) {
+    return nc_get_vars_schar(ncid, varid, start, count, stride,
+                             reinterpret_cast<signed char *>(data));
+  }
+};
+
+template <> struct NetCDFTypedReader<uint8_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  uint8_t *data) {
+    return nc_get_vars_uchar(ncid, varid, start, count, stride,
+                             reinterpret_cast<unsigned char *>(data));
+  }
+};
+
+template <> struct NetCDFTypedReader<int16_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  int16_t *data) {
+    return nc_get_vars_short(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<uint16_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  uint16_t *data) {
+    return nc_get_vars_ushort(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<int32_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  int32_t *data) {
+    return nc_get_vars_int(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<uint32_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  uint32_t *data) {
+    return nc_get_vars_uint(ncid, varid, start, count, stride, data);
+  }
+};
+
+template <> struct NetCDFTypedReader<int64_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  int64_t *data) {
+    return nc_get_vars_longlong(ncid, varid, start, count, stride,
+                                reinterpret_cast<long long *>(data));
+  }
+};
+
+template <> struct NetCDFTypedReader<uint64_t> {
+  static int read(int ncid, int varid, const size_t *start,
+                  const size_t *count, const ptrdiff_t *stride,
+                  uint64_t *data) {
+    return nc_get_vars_ulonglong(ncid, varid, start, count, stride,
+                                 reinterpret_cast<unsigned long long *>(data));
+  }
+};
+#endif
+
 // TODO we should have the option to check if there is already a file on disk
 // and start with that data.
 
-class DiskBufferNetCDFDouble : public DiskBuffer<std::vector<double>> {
+/**
+ * @brief DiskBuffer for a single N-dimensional variable in a NetCDF file
+ *
+ * By default the complete variable called "data" is read. Use
+ * setVariableName() to read a different variable and setHyperslab() to read
+ * only a subvolume of the variable. Only the requested elements are read from
+ * disk. The data is stored flattened in row-major (C) order and the shape of
+ * the most recently read data can be queried through getShape().
+ *
+ * Values are read as DataType. If the variable in the file has the same type
+ * no conversion takes place.
+ */
+template <class DataType>
+class DiskBufferNetCDFData : public DiskBuffer<std::vector<DataType>> {
 public:
-  DiskBufferNetCDFDouble(std::string id, std::string fileName = "",
-                         std::string path = "", uint16_t size = 2)
-      : DiskBuffer<std::vector<double>>(id, fileName, path, size) {
+  DiskBufferNetCDFData(std::string id, std::string fileName = "",
+                       std::string path = "", uint16_t size = 2)
+      : DiskBuffer<std::vector<DataType>>(id, fileName, path, size) {
 #ifndef TINC_HAS_NETCDF
-    std::cerr << "ERROR: DiskBufferNetCDFDouble built wihtout NetCDF support"
+    std::cerr << "ERROR: DiskBufferNetCDFData built wihtout NetCDF support"
               << std::endl;
     assert(0 == 1);
 #endif
   }
 
-  bool updateData(std::string filename) {
-    if (filename.size() > 0) {
-      m_fileName = filename;
-    }
-    bool ret = false;
-    auto buffer = getWritable();
+  /**
+   * @brief Set the name of the NetCDF variable to read. Default is "data"
+   */
+  void setVariableName(std::string variableName) {
+    std::unique_lock<std::mutex> lk(mConfigLock);
+    mVariableName = variableName;
+  }
 
-    int ncid, retval;
+  std::string getVariableName() {
+    std::unique_lock<std::mutex> lk(mConfigLock);
+    return mVariableName;
+  }
 
-#ifdef TINC_HAS_NETCDF
-    int *nattsp = nullptr;
-    /* Open the file. NC_NOWRITE tells netCDF we want read-only access
-     * to the file.*/
-    if ((retval = nc_open(filename.c_str(), NC_NOWRITE, &ncid))) {
-      goto done;
-    }
-    int varid;
-    if ((retval = nc_inq_varid(ncid, "data", &varid))) {
-      goto done;
-    }
+  /**
+   * @brief Restrict reading to a hyperslab of the variable
+   * @param start index of the first element to read for each dimension
+   * @param count number of elements to read for each dimension
+   * @param stride sampling interval for each dimension
+   *
+   * Missing entries (or a count of 0) mean that the whole extent of that
+   * dimension is read from start. Missing stride entries default to 1. For
+   * example to read the 2-D slice at time index 5 and level index 2 of a
+   * variable with dimensions [time, level, lat, lon] use:
+   * @code
+   * buffer.setHyperslab({5, 2, 0, 0}, {1, 1, 0, 0});
+   * @endcode
+   * The new hyperslab takes effect on the next call to updateData()
+   */
+  void setHyperslab(std::vector<size_t> start, std::vector<size_t> count = {},
+                    std::vector<ptrdiff_t> stride = {}) {
+    std::unique_lock<std::mutex> lk(mConfigLock);
+    mStart = start;
+    mCount = count;
+    mStride = stride;
+  }
 
-    nc_type xtypep;
-    char name[32];
-    int ndimsp;
-    int dimidsp[32];
-    if ((retval = nc_inq_var(ncid, varid, name, &xtypep, &ndimsp, dimidsp,
-                             nattsp))) {
-      goto done;
-    }
+  /**
+   * @brief Read the complete variable on the next updateData()
+   */
+  void clearHyperslab() { setHyperslab({}, {}, {}); }
 
-    size_t lenp;
-    if ((retval = nc_inq_dimlen(ncid, dimidsp[0], &lenp))) {
-      goto done;
-    }
-    buffer->resize(lenp);
+  /**
+   * @brief Get shape of the data that was last read
+   *
+   * This is the count of elements in each dimension of the hyperslab. Be aware
+   * that the shape might not match the data returned by get() if updateData()
+   * is being called from a different thread.
+   */
+  std::vector<size_t> getShape() {
+    std::unique_lock<std::mutex> lk(mConfigLock);
+    return mShape;
+  }
 
-    /* Read the data. */
-    if ((retval = nc_get_var_double(ncid, varid, buffer->data()))) {
-      goto done;
+  bool updateData(std::string filename = "") override {
+    if (filename.size() > 0) {
+      this->m_fileName = filename;
     }
-
-    //    /* Check the data. */
-    //    for (x = 0; x < NX; x++)
-    //      for (y = 0; y < NY; y++)
-    //        if (data_in[x][y] != x * NY + y)
-    //          return ERRCODE;
-
-    /* Close the file, freeing all resources. */
-    if ((retval = nc_close(ncid))) {
-      goto done;
+    bool ret = false;
+#ifdef TINC_HAS_NETCDF
+    std::string fullName = this->m_path + this->m_fileName;
+    int ncid, retval;
+    if ((retval = nc_open(fullName.c_str(), NC_NOWRITE, &ncid))) {
+      std::cerr << "Error opening file: " << fullName << " "
+                << nc_strerror(retval) << std::endl;
+    } else {
+      auto buffer = this->getWritable();
+      std::vector<size_t> shape;
+      ret = readVariable(ncid, *buffer, shape);
+      if ((retval = nc_close(ncid))) {
+        std::cerr << nc_strerror(retval) << std::endl;
+      }
+      if (ret) {
+        {
+          std::unique_lock<std::mutex> lk(mConfigLock);
+          mShape = shape;
+        }
+        BufferManager<std::vector<DataType>>::doneWriting(buffer);
+      }
     }
-    ret = true;
-    BufferManager<std::vector<double>>::doneWriting(buffer);
 #endif
-  done:
-    for (auto cb : mUpdateCallbacks) {
+    for (auto cb : this->mUpdateCallbacks) {
       cb(ret);
     }
     return ret;
@@ -139,12 +268,106 @@ public:
 
 protected:
   virtual bool parseFile(std::ifstream &file,
-                         std::shared_ptr<std::vector<double>> newData) {
+                         std::shared_ptr<std::vector<DataType>> newData) {
+    return true;
+  }
 
+#ifdef TINC_HAS_NETCDF
+  bool readVariable(int ncid, std::vector<DataType> &data,
+                    std::vector<size_t> &shape) {
+    std::string variableName;
+    std::vector<size_t> requestedStart;
+    std::vector<size_t> requestedCount;
+    std::vector<ptrdiff_t> requestedStride;
+    {
+      std::unique_lock<std::mutex> lk(mConfigLock);
+      variableName = mVariableName;
+      requestedStart = mStart;
+      requestedCount = mCount;
+      requestedStride = mStride;
+    }
+    int retval, varid, ndims;
+    if ((retval = nc_inq_varid(ncid, variableName.c_str(), &varid))) {
+      std::cerr << "Error finding variable '" << variableName
+                << "': " << nc_strerror(retval) << std::endl;
+      return false;
+    }
+    if ((retval = nc_inq_varndims(ncid, varid, &ndims))) {
+      std::cerr << nc_strerror(retval) << std::endl;
+      return false;
+    }
+    std::vector<int> dimids(ndims);
+    if ((retval = nc_inq_vardimid(ncid, varid, dimids.data()))) {
+      std::cerr << nc_strerror(retval) << std::endl;
+      return false;
+    }
+    if (requestedStart.size() > (size_t)ndims ||
+        requestedCount.size() > (size_t)ndims ||
+        requestedStride.size() > (size_t)ndims) {
+      std::cerr << "ERROR: Hyperslab has more dimensions than variable '"
+                << variableName << "' (" << ndims << ")" << std::endl;
+      return false;
+    }
+
+    std::vector<size_t> start(ndims);
+    std::vector<size_t> count(ndims);
+    std::vector<ptrdiff_t> stride(ndims);
+    size_t totalCount = 1;
+    for (int i = 0; i < ndims; i++) {
+      size_t len;
+      if ((retval = nc_inq_dimlen(ncid, dimids[i], &len))) {
+        std::cerr << nc_strerror(retval) << std::endl;
+        return false;
+      }
+      start[i] = i < (int)requestedStart.size() ? requestedStart[i] : 0;
+      stride[i] = (i < (int)requestedStride.size() && requestedStride[i] > 0)
+                      ? requestedStride[i]
+                      : 1;
+      if (i < (int)requestedCount.size() && requestedCount[i] > 0) {
+        count[i] = requestedCount[i];
+      } else if (start[i] < len) {
+        count[i] = (len - start[i] + stride[i] - 1) / stride[i];
+      } else {
+        count[i] = 0;
+      }
+      if (count[i] > 0 && start[i] + (count[i] - 1) * stride[i] >= len) {
+        std::cerr << "ERROR: Hyperslab out of bounds for dimension " << i
+                  << " of variable '" << variableName << "' (length " << len
+                  << ")" << std::endl;
+        return false;
+      }
+      totalCount *= count[i];
+    }
+
+    data.resize(totalCount);
+    if (totalCount > 0) {
+      if ((retval = NetCDFTypedReader<DataType>::read(
+               ncid, varid, start.data(), count.data(), stride.data(),
+               data.data()))) {
+        std::cerr << "Error reading variable '" << variableName
+                  << "': " << nc_strerror(retval) << std::endl;
+        return false;
+      }
+    }
+    shape = count;
     return true;
   }
+#endif
+
+  std::mutex mConfigLock;
+  std::string mVariableName{"data"};
+  std::vector<size_t> mStart;
+  std::vector<size_t> mCount;
+  std::vector<ptrdiff_t> mStride;
+  std::vector<size_t> mShape;
 };
 
+typedef DiskBufferNetCDFData<double> DiskBufferNetCDFDouble;
+typedef DiskBufferNetCDFData<float> DiskBufferNetCDFFloat;
+typedef DiskBufferNetCDFData<int32_t> DiskBufferNetCDFInt32;
+typedef DiskBufferNetCDFData<int64_t> DiskBufferNetCDFInt64;
+typedef DiskBufferNetCDFData<uint8_t> DiskBufferNetCDFUInt8;
+
 } // namespace tinc
 
 #endif // DISKBUFFERNETCDF_HPP
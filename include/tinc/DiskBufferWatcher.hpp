@@ -0,0 +1,157 @@
+#ifndef DISKBUFFERWATCHER_HPP
+#define DISKBUFFERWATCHER_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include "tinc/DiskBufferAbstract.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Reload DiskBuffers automatically when their files change on disk
+ *
+ * The watcher runs a single thread that monitors the directories containing
+ * the current files of all registered DiskBuffers. When a file is closed after
+ * writing or moved into place, the DiskBuffer's updateData() is called after
+ * the debounce time has passed without further changes to that file. The
+ * buffer's update callbacks are called as usual by updateData().
+ *
+ * Watching is implemented through inotify and is only available on Linux. On
+ * other platforms start() returns false and buffers must be updated manually.
+ *
+ * @code
+DiskBufferJson jsonBuffer{"json", "file.json"};
+DiskBufferWatcher watcher;
+watcher << jsonBuffer;
+watcher.start();
+ * @endcode
+ */
+class DiskBufferWatcher {
+public:
+  DiskBufferWatcher(
+      std::chrono::milliseconds debounceTime = std::chrono::milliseconds(50));
+
+  ~DiskBufferWatcher();
+
+  /**
+   * @brief Add a DiskBuffer to be monitored
+   *
+   * The DiskBuffer must outlive the watcher or be unregistered.
+   */
+  void registerDiskBuffer(DiskBufferAbstract &db);
+
+  /**
+   * @brief Stop monitoring a DiskBuffer
+   *
+   * If the DiskBuffer is being reloaded, waits for the reload to finish, so
+   * the DiskBuffer can be destroyed after this returns. When called from an
+   * update callback, returns immediately.
+   */
+  void unregisterDiskBuffer(DiskBufferAbstract &db);
+
+  DiskBufferWatcher &operator<<(DiskBufferAbstract &db) {
+    registerDiskBuffer(db);
+    return *this;
+  }
+
+  /**
+   * @brief Start the monitoring thread
+   * @return false if already running or watching is not supported
+   */
+  bool start();
+
+  /**
+   * @brief Stop the monitoring thread and wait for it to finish
+   *
+   * A reload in progress is completed first. Must not be called from an
+   * update callback of a watched DiskBuffer.
+   */
+  void stop();
+
+  bool running() { return mRunning; }
+
+  /**
+   * @brief Rescan the current file names of registered DiskBuffers
+   *
+   * Call this after changing the current file of a DiskBuffer to have the
+   * new location watched immediately. Watched locations are also rescanned
+   * whenever a change is detected.
+   */
+  void refresh();
+
+  /**
+   * @brief Set time to wait after the last write before reloading
+   */
+  void setDebounceTime(std::chrono::milliseconds debounceTime) {
+    mDebounceTime = debounceTime;
+  }
+
+  std::chrono::milliseconds debounceTime() { return mDebounceTime; }
+
+protected:
+  void threadFunction();
+  // Update inotify watches to match the current files of registered buffers.
+  void updateWatches();
+
+private:
+  std::vector<DiskBufferAbstract *> mDiskBuffers;
+  std::mutex mDiskBuffersLock; // Protects mDiskBuffers and update state
+  // Buffer whose updateData() is running on the watcher thread
+  DiskBufferAbstract *mUpdatingBuffer{nullptr};
+  std::condition_variable mUpdateDone;
+  std::thread::id mWatcherThreadId;
+
+  std::atomic<std::chrono::milliseconds> mDebounceTime;
+  std::atomic<bool> mRunning{false};
+  std::unique_ptr<std::thread> mThread;
+
+  int mInotifyFd{-1};
+  std::mutex mWakeLock; // Protects mWakeFd from refresh() during stop()
+  int mWakeFd[2]{-1, -1};
+  // watch descriptor -> directory
+  std::map<int, std::string> mWatches;
+};
+
+} // namespace tinc
+
+#endif // DISKBUFFERWATCHER_HPP
@@ -0,0 +1,234 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Work-stealing thread pool shared by TINC classes
+ *
+ * Each worker thread has its own task queue. Tasks submitted from a worker are
+ * queued on that worker and run newest first, tasks submitted from other
+ * threads are queued on a shared queue. Idle workers take tasks from the
+ * shared queue and steal the oldest tasks from other workers.
+ *
+ * ProcessorAsyncWrapper, DeferredComputation::processAsync(),
+ * ParameterSpace::sweepAsync(), ProcessorGraph::PROCESS_GRAPH and DiskBuffer
+ * writes use global(), so the number of threads doing TINC work is limited by
+ * its concurrency. The parallel filesystem operations in ParameterSpace and
+ * DataPool use io() instead, as they mostly wait on the filesystem.
+ *
+ * Tasks that wait for other tasks should use wait(), which runs queued tasks
+ * while waiting, so that waiting tasks can't use up all workers.
+ *
+ * Tasks run with the Tracer sample index of the thread that queued them, so
+ * spans recorded by tasks started during a sweep sample are tagged with it.
+ */
+class Executor {
+public:
+  /**
+   * @param concurrency number of worker threads. If 0, the number of hardware
+   * threads is used.
+   */
+  Executor(size_t concurrency = 0);
+
+  /**
+   * @brief Runs all queued tasks and stops the worker threads
+   */
+  ~Executor();
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  /**
+   * @brief Executor used by TINC classes
+   *
+   * Uses the number of hardware threads, but at least 4 threads.
+   */
+  static Executor &global();
+
+  /**
+   * @brief Executor for blocking filesystem work
+   *
+   * Reading and creating files on network filesystems is limited by latency
+   * rather than by cores, so users of this executor raise its concurrency to
+   * what they need through ensureConcurrency().
+   */
+  static Executor &io();
+
+  /**
+   * @brief Set number of worker threads
+   * @param concurrency number of threads, 0 uses the number of hardware threads
+   *
+   * Can be changed while tasks are running. Lowering the concurrency lets
+   * running tasks finish.
+   */
+  void setConcurrency(size_t concurrency);
+
+  size_t getConcurrency() { return mConcurrency; }
+
+  /**
+   * @brief Raise the number of worker threads to at least concurrency
+   *
+   * Never lowers the concurrency, so it can be called by independent users
+   * of the executor.
+   */
+  void ensureConcurrency(size_t concurrency);
+
+  /**
+   * @brief Queue function to run on a worker thread
+   * @return future holding the function's result
+   */
+  template <class Function>
+  std::future<typename std::result_of<Function()>::type>
+  submit(Function &&function);
+
+  /**
+   * @brief Wait for a future, running queued tasks while waiting if called
+   * from a worker thread
+   *
+   * Worker threads sleep while there are no queued tasks until a task of
+   * this executor finishes, so future must be the result of a task of this
+   * executor, e.g. from submit().
+   */
+  template <class T> T wait(std::future<T> &future);
+
+  /**
+   * @brief Call function for every index in [0, count)
+   * @param count number of indeces
+   * @param function called with each index. Stops early if function returns
+   * false
+   * @param concurrency maximum number of threads, including the calling
+   * thread. If 0, getConcurrency() + 1 is used.
+   * @return false if function returned false
+   *
+   * The calling thread takes part in the work, so this can be used from within
+   * tasks. If concurrency is larger than getConcurrency() + 1, worker threads
+   * are added through ensureConcurrency() so the requested concurrency is
+   * reached, e.g. for latency bound work on io().
+   */
+  bool parallelFor(size_t count, const std::function<bool(size_t)> &function,
+                   size_t concurrency = 0);
+
+  /**
+   * @brief Run one queued task in the calling thread
+   * @return false if there were no queued tasks
+   */
+  bool runPendingTask();
+
+  /**
+   * @brief true if the calling thread is one of this executor's workers
+   */
+  bool isWorkerThread();
+
+  // Upper limit for setConcurrency()
+  static const size_t MAX_CONCURRENCY = 256;
+
+private:
+  struct Task {
+    std::function<void()> function;
+    int64_t traceSample; // Tracer sample of the thread that queued the task
+  };
+
+  struct TaskQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  void post(std::function<void()> task);
+  bool takeTask(size_t queueIndex, Task &task);
+  // Run task with its Tracer sample set for the calling thread
+  void runTask(Task &task);
+  void workerFunction(size_t index);
+  // Must be called with mSleepLock held
+  void startThreads(size_t concurrency);
+  // Block until done() returns true or tasks are queued
+  void waitForTaskEvent(const std::function<bool()> &done);
+  // Wake up threads in waitForTaskEvent()
+  void notifyTaskEvent();
+
+  // Queue 0 is the shared queue, queue i + 1 belongs to worker i
+  std::unique_ptr<TaskQueue[]> mQueues;
+  std::vector<std::thread> mThreads;
+  std::atomic<size_t> mThreadCount{0};
+  std::atomic<size_t> mConcurrency{0};
+  std::atomic<size_t> mQueuedTasks{0};
+  std::atomic<bool> mStop{false};
+  std::mutex mSleepLock; // Protects mThreads
+  std::condition_variable mWakeUp;
+  // Signalled when tasks are queued or finish while threads are in wait()
+  std::condition_variable mTaskEvent;
+  std::atomic<size_t> mTaskEventWaiters{0};
+};
+
+template <class Function>
+std::future<typename std::result_of<Function()>::type>
+Executor::submit(Function &&function) {
+  typedef typename std::result_of<Function()>::type Result;
+  auto task = std::make_shared<std::packaged_task<Result()>>(
+      std::forward<Function>(function));
+  auto future = task->get_future();
+  post([task]() { (*task)(); });
+  return future;
+}
+
+template <class T> T Executor::wait(std::future<T> &future) {
+  if (isWorkerThread()) {
+    auto ready = [&future]() {
+      return future.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    };
+    while (!ready()) {
+      if (!runPendingTask()) {
+        waitForTaskEvent(ready);
+      }
+    }
+  }
+  return future.get();
+}
+
+} // namespace tinc
+
+#endif // EXECUTOR_HPP
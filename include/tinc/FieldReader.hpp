@@ -0,0 +1,164 @@
+#ifndef FIELDREADER_HPP
+#define FIELDREADER_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include "tinc/DiskBufferBinaryArray.hpp"
+
+#include <map>
+#include <string>
+
+namespace tinc {
+
+/**
+ * @brief Reads numeric fields from data files into typed arrays
+ *
+ * DataPool uses field readers to extract fields from the data files in a
+ * parameter space. Readers are registered in the DataPool for a file type,
+ * which is determined from the file extension or the first bytes of the file.
+ * The first dimension of a field is the dimension in file registered with
+ * DataPool::registerDataFile().
+ */
+class FieldReader {
+public:
+  virtual ~FieldReader() {}
+
+  /**
+   * @brief Read complete field
+   * @param file full path to file
+   * @param field name of field
+   * @param array array to store the field in
+   * @return false if the file could not be read or does not contain field
+   */
+  virtual bool readField(const std::string &file, const std::string &field,
+                         BinaryArray &array) = 0;
+
+  /**
+   * @brief Read a range of elements along the first dimension of a field
+   *
+   * The default implementation reads the whole field and copies the range.
+   * Readers that return true in supportsPartialReads() read only the
+   * requested elements.
+   */
+  virtual bool readFieldElements(const std::string &file,
+                                 const std::string &field, size_t begin,
+                                 size_t count, BinaryArray &array);
+
+  virtual bool supportsPartialReads() { return false; }
+
+  /**
+   * @brief Read all numeric fields in file
+   * @return false if not supported by reader or file can't be read
+   *
+   * Readers that need to parse the whole file to extract a field implement
+   * this so that all fields can be cached from a single read.
+   */
+  virtual bool readAllFields(const std::string &file,
+                             std::map<std::string, BinaryArray> &fields) {
+    return false;
+  }
+};
+
+/**
+ * @brief Reads fields from the top level object of a JSON file
+ *
+ * Fields must be numbers or rectangular nested arrays of numbers. Values are
+ * read as FLOAT64.
+ */
+class JsonFieldReader : public FieldReader {
+public:
+  bool readField(const std::string &file, const std::string &field,
+                 BinaryArray &array) override;
+  bool readAllFields(const std::string &file,
+                     std::map<std::string, BinaryArray> &fields) override;
+};
+
+/**
+ * @brief Reads columns from a CSV file
+ *
+ * The first line contains the column names. Every other line is one element
+ * of the field. Values are read as FLOAT64. Columns with values that are not
+ * numbers are ignored.
+ */
+class CsvFieldReader : public FieldReader {
+public:
+  CsvFieldReader(char delimiter = ',') : mDelimiter(delimiter) {}
+
+  bool readField(const std::string &file, const std::string &field,
+                 BinaryArray &array) override;
+  bool readAllFields(const std::string &file,
+                     std::map<std::string, BinaryArray> &fields) override;
+
+private:
+  char mDelimiter;
+};
+
+/**
+ * @brief Reads TINC binary array files
+ *
+ * A binary array file holds a single field, so the field name is ignored.
+ * Files are memory mapped where available so that reading a range of elements
+ * only touches the pages that hold them.
+ */
+class BinaryArrayFieldReader : public FieldReader {
+public:
+  bool readField(const std::string &file, const std::string &field,
+                 BinaryArray &array) override;
+  bool readFieldElements(const std::string &file, const std::string &field,
+                         size_t begin, size_t count,
+                         BinaryArray &array) override;
+  bool supportsPartialReads() override { return true; }
+};
+
+#ifdef TINC_HAS_NETCDF
+/**
+ * @brief Reads variables from NetCDF files
+ *
+ * The field is the variable name. Values are read in the type they are stored
+ * in the file. Partial reads use hyperslabs so only the requested elements
+ * are read from disk.
+ */
+class NetCDFFieldReader : public FieldReader {
+public:
+  bool readField(const std::string &file, const std::string &field,
+                 BinaryArray &array) override;
+  bool readFieldElements(const std::string &file, const std::string &field,
+                         size_t begin, size_t count,
+                         BinaryArray &array) override;
+  bool supportsPartialReads() override { return true; }
+};
+#endif
+
+} // namespace tinc
+
+#endif // FIELDREADER_HPP
@@ -35,10 +35,14 @@
 
 #include "tinc/ParameterSpaceDimension.hpp"
 #include "tinc/Processor.hpp"
+#include "tinc/ProcessorCpp.hpp"
 #include "tinc/IdObject.hpp"
 #include "tinc/CacheManager.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <thread>
@@ -175,6 +179,26 @@ public:
              std::map<std::string, VariantValue> dependencies = {},
              bool recompute = false);
 
+  /**
+   * @brief Sweep the parameter space in blocks of samples
+   * @param processor processor with a batchProcessingFunction
+   * @param outputs result columns by name. Resized to the number of samples
+   * @param dimensionNames names of dimensions to sweep, all if empty
+   * @param blockSize maximum number of samples passed in each call
+   * @return false if the processor failed or the sweep was stopped
+   *
+   * Samples are ordered as in sweep(), with the first dimension changing
+   * fastest. The sample at index i of the sweep writes to element i of each
+   * output column. Values of the dimensions that are not swept and the
+   * dependencies are set in the processor's configuration. Caching and
+   * running directories are not used.
+   */
+  bool sweepBatch(ProcessorCpp &processor,
+                  std::map<std::string, std::vector<double>> &outputs,
+                  std::vector<std::string> dimensionNames = {},
+                  std::map<std::string, VariantValue> dependencies = {},
+                  size_t blockSize = 1024);
+
   /**
    * @brief Run a parameter sweep asynchronously (non-blocking)
    *
@@ -184,8 +208,9 @@ public:
                   std::vector<std::string> dimensionNames = {},
                   bool recompute = false);
   /**
-   * @brief Interrupts an asynchronous parameter sweep after current computation
-   * is done
+   * @brief Interrupts a parameter sweep
+   *
+   * The computation in progress is cancelled through its CancellationToken.
    */
   void stopSweep();
 
@@ -193,6 +218,11 @@ public:
    * @brief Create necessary filesystem directories to be populated by data
    * @return true if successfully created (or checked existence) of
    * directories.
+   *
+   * Directories are created in parallel, level by level starting from the
+   * root, so parents always exist before their children. Each directory is
+   * checked at most once, and directories under a newly created parent are
+   * created without checking.
    */
   bool createDataDirectories();
 
@@ -209,10 +239,31 @@ public:
    * @brief Remove all directories related to this parameter space
    * @return true if all directories could be cleaned and recreated.
    *
-   * Use this function with extreme care, as it can be very destructive!!
+   * The root path itself is never removed, even if running paths resolve to
+   * it. Use this function with extreme care, as it can be very destructive!!
    */
   bool removeDataDirectories();
 
+  /**
+   * @brief Set maximum number of concurrent filesystem operations
+   *
+   * Used by createDataDirectories() and removeDataDirectories(). Metadata
+   * operations on network filesystems are slow, so the default (8) is larger
+   * than what is useful for local disks.
+   */
+  void setFilesystemConcurrency(size_t concurrency) {
+    mFilesystemConcurrency = std::max<size_t>(concurrency, 1);
+  }
+  size_t getFilesystemConcurrency() { return mFilesystemConcurrency; }
+
+  /**
+   * @brief onDataDirectoriesProgress is called as directories are created or
+   * removed by createDataDirectories() and removeDataDirectories()
+   *
+   * The function is called from the worker threads, but never concurrently.
+   */
+  std::function<void(double progress)> onDataDirectoriesProgress;
+
   /**
    * @brief Load parameter space dimensions from disk file
    * @param ncFile
@@ -375,17 +426,28 @@ protected:
  */
   void updateParameterSpace(ParameterSpaceDimension *ps);
 
-  bool executeProcess(Processor &processor, bool recompute);
+  bool executeProcess(Processor &processor, bool recompute,
+                      CancellationToken token = CancellationToken());
+
+  /// sweep() that stops when token is cancelled
+  void sweepCancellable(Processor &processor,
+                        std::vector<std::string> dimensionNames,
+                        std::map<std::string, VariantValue> dependencies,
+                        bool recompute, CancellationToken token);
 
   std::vector<std::shared_ptr<ParameterSpaceDimension>> mDimensions;
 
   /// Stores template to generate current path using resolveFilename()
   std::string mCurrentPathTemplate;
 
-  std::unique_ptr<std::thread> mAsyncProcessingThread;
+  std::future<void> mAsyncSweep;
   std::shared_ptr<ParameterSpace> mAsyncPSCopy;
 
   bool mSweepRunning{false};
+  std::mutex mSweepLock; // Protects mSweepToken
+  CancellationToken mSweepToken;
+
+  std::atomic<size_t> mFilesystemConcurrency{8};
 
   // Subdirectories that have a parameter space file in them.
   std::map<std::string, std::string> mSpecialDirs;
@@ -36,73 +36,68 @@
 #include <atomic>
 #include <chrono>
 #include <functional>
-#include <thread>
+#include <memory>
 
 using namespace std::chrono_literals;
 
 namespace tinc {
 
+class PeriodicTaskScheduler;
+
+/**
+ * @brief Call a function periodically
+ *
+ * All periodic tasks are run from a single shared timer thread that sleeps
+ * until the next deadline, so functions should return quickly and must not
+ * block. The function is first called as soon as start() is called.
+ *
+ * In FIXED_RATE mode, calls are scheduled at absolute deadlines a waitTime()
+ * apart, so the time taken by the function does not make the period drift.
+ * Deadlines missed because the function took longer than the period are
+ * skipped. In FIXED_DELAY mode, waitTime() is counted from the end of the
+ * previous call.
+ */
 class PeriodicTask {
+  friend class PeriodicTaskScheduler;
+
 public:
-  ~PeriodicTask() { stop(); }
-
-  bool start(std::function<bool()> func) {
-    if (mFuncThread) {
-      return false;
-    }
-    mRunning = true;
-    mFuncThread = std::make_shared<std::thread>(threadFunction, func, this);
-    return mFuncThread != nullptr;
-  }
-
-  bool running() { return mRunning || mFuncThread != nullptr; }
-
-  void stop() {
-    if (mFuncThread) {
-      mRunning = false;
-      mFuncThread->join();
-      mFuncThread = nullptr;
-    }
-  }
+  typedef enum { FIXED_RATE, FIXED_DELAY } Mode;
+
+  PeriodicTask();
+  ~PeriodicTask();
+
+  PeriodicTask(const PeriodicTask &) = delete;
+  PeriodicTask &operator=(const PeriodicTask &) = delete;
+
+  /**
+   * @brief Start calling func periodically until it returns false or stop() is
+   * called
+   * @return false if the task is already running
+   */
+  bool start(std::function<bool()> func);
+
+  bool running();
+
+  /**
+   * @brief Stop calling the function
+   *
+   * Returns immediately unless the function is currently running in which case
+   * it waits for it to finish. Can be called from the function.
+   */
+  void stop();
 
   std::chrono::nanoseconds waitTime() const;
   void setWaitTime(std::chrono::nanoseconds waitTime);
 
-  //  std::chrono::nanoseconds granularity() const
-  //  {
-  //    return mGranularity;
-  //  }
-  //  void setGranularity(std::chrono::nanoseconds granularity)
-  //  {
-  //    mGranularity = granularity;
-  //  }
+  Mode mode() const;
+  void setMode(Mode mode);
 
 private:
-  static void threadFunction(std::function<bool()> func,
-                             PeriodicTask *thisPtr) {
-    auto waitTime = thisPtr->waitTime();
-    while (thisPtr->mRunning) {
-      if (!func()) {
-        thisPtr->mRunning = false;
-        break;
-      }
-      std::this_thread::sleep_for(waitTime);
-    }
-  }
-
-  std::chrono::nanoseconds mWaitTime{10000ns};
-  // Fixme implement granularity for snappier shutdown of waiting
-  std::chrono::nanoseconds mGranularity{10000ns};
-  std::atomic<bool> mRunning;
-  std::shared_ptr<std::thread> mFuncThread;
+  struct State;
+  std::shared_ptr<State> mState;
+  std::shared_ptr<PeriodicTaskScheduler> mScheduler;
 };
 
-std::chrono::nanoseconds PeriodicTask::waitTime() const { return mWaitTime; }
-
-void PeriodicTask::setWaitTime(std::chrono::nanoseconds waitTime) {
-  mWaitTime = waitTime;
-}
-
 } // namespace tinc
 
 #endif // PERIODICTASK_HPP
@@ -33,13 +33,17 @@
  * authors: Andres Cabrera
 */
 
+#include "tinc/CancellationToken.hpp"
 #include "tinc/IdObject.hpp"
 #include "tinc/ParameterSpaceDimension.hpp"
 #include "tinc/VariantValue.hpp"
 
 #include "al/scene/al_PolySynth.hpp"
 
+#include <atomic>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace tinc {
@@ -87,6 +91,39 @@ public:
    */
   virtual bool process(bool forceRecompute = false) = 0;
 
+  /**
+   * @brief Run process() so that it can be cancelled through token
+   *
+   * Cancelling the token stops the run as soon as possible and the function
+   * returns false. The token applies only to this run, so runs of the same
+   * processor can overlap with different tokens.
+   */
+  bool processCancellable(bool forceRecompute, CancellationToken token);
+
+  /**
+   * @brief Cancel the current runs
+   *
+   * Only has an effect while process() is running.
+   */
+  void cancel();
+
+  /**
+   * @brief true if the current run has been cancelled
+   *
+   * The current run is the one on the calling thread. Long running
+   * computation, e.g. in ProcessorCpp::processingFunction, should check this
+   * regularly and return false when cancelled.
+   */
+  bool cancelled();
+
+  /**
+   * @brief Token for the current run on the calling thread
+   *
+   * Can be passed to other processors or threads, or used to register
+   * functions to be called on cancellation.
+   */
+  CancellationToken cancellationToken();
+
   /**
    * @brief returns true is the process() function is currently running
    */
@@ -231,7 +268,32 @@ protected:
   }
   std::mutex mProcessLock;
 
+  /**
+   * @brief Prepare cancellation for a new run
+   *
+   * Must be called at the start of process() in child classes. Unless a
+   * token was given to processCancellable(), a new token is used for the
+   * run, so a previous cancel() does not affect it.
+   */
+  void startCancellableRun();
+
+  /**
+   * @brief Record that process() succeeded without computing
+   *
+   * Child classes must call this when a run returns without producing its
+   * outputs, e.g. ProcessorCpp when forceRecompute is not set, so that
+   * ProcessorGraph doesn't consider the outputs up to date.
+   */
+  void skipComputation() { mSkippedRuns++; }
+
 private:
+  std::atomic<uint64_t> mSkippedRuns{0};
+  std::mutex mCancellationLock; // Protects token members
+  // Token for runs not started through processCancellable()
+  CancellationToken mCancellationToken;
+  // Tokens of runs started through processCancellable(), by calling thread
+  std::map<std::thread::id, CancellationToken> mRunTokens;
+
   std::vector<std::function<void()>> mStartCallbacks;
   std::vector<std::function<void(bool)>> mDoneCallbacks;
 };
@@ -35,10 +35,8 @@
 
 #include "tinc/Processor.hpp"
 
-#include <condition_variable>
-#include <memory>
+#include <future>
 #include <mutex>
-#include <thread>
 
 namespace tinc {
 
@@ -49,6 +47,9 @@ namespace tinc {
  * both synchronously and asynchronously, for example when requesting a
  * synchronous
  * run while there is an asynchronous parameter sweep taking place.
+ *
+ * Runs are submitted to Executor::global(), so wrappers don't use a thread
+ * while idle.
  */
 class ProcessorAsyncWrapper : public Processor {
 public:
@@ -65,7 +66,8 @@ public:
   }
   ProcessorAsyncWrapper(
       ProcessorAsyncWrapper &&other) noexcept // move constructor
-      : mThread(std::exchange(other.mThread, nullptr)) {
+      : mProcessor(other.mProcessor),
+        mResult(std::move(other.mResult)) {
     mId = other.mId;
   }
   ProcessorAsyncWrapper &
@@ -78,30 +80,33 @@ public:
   operator=(ProcessorAsyncWrapper &&other) noexcept // move assignment
   {
     mId = other.mId;
-    std::swap(mThread, other.mThread);
+    std::swap(mProcessor, other.mProcessor);
+    std::swap(mResult, other.mResult);
     return *this;
   }
 
+  /**
+   * @brief Start processing and return immediately
+   *
+   * Waits for the previous run to finish before starting. cancel() cancels
+   * the run in the background.
+   */
   bool process(bool forceRecompute = false) override;
+
+  /**
+   * @brief Wait for the current run to finish
+   * @return result of the last run
+   */
   bool waitUntilDone();
 
   Processor *processor() const;
   void setProcessor(Processor *processor);
 
-protected:
-  void startThread();
-
 private:
   Processor *mProcessor{nullptr};
-  bool mRunning{true};
-  bool mRequestForce{false};
-  bool mRetValue;
-  std::unique_ptr<std::thread> mThread;
+  bool mRetValue{true};
+  std::future<bool> mResult;
   std::mutex mLock;
-  std::condition_variable mCondVariable;
-
-  std::mutex mStartLock;
-  std::condition_variable mStartCondVariable;
 };
 
 } // namespace tinc
@@ -36,6 +36,7 @@
 #include "tinc/Processor.hpp"
 
 #include <functional>
+#include <map>
 
 namespace tinc {
 
@@ -47,12 +48,54 @@ namespace tinc {
  */
 class ProcessorCpp : public Processor {
 public:
+  /**
+   * @brief Block of parameter space samples computed in a single call
+   *
+   * Inputs and outputs are stored as one contiguous column per dimension or
+   * output, so that batchProcessingFunction can loop over the samples and be
+   * vectorized. Columns hold size elements.
+   */
+  struct SampleBlock {
+    /// Number of samples in the block
+    size_t size{0};
+    /// Index of the first sample of the block within the whole sweep
+    size_t offset{0};
+    /// Value of each swept dimension per sample
+    std::map<std::string, const double *> inputs;
+    /// Index within each swept dimension per sample
+    std::map<std::string, const uint64_t *> indeces;
+    /// Preallocated columns for the results
+    std::map<std::string, double *> outputs;
+  };
+
   ProcessorCpp(std::string id = "");
 
   bool process(bool forceRecompute = true) override;
 
+  /**
+   * @brief Function that performs the computation
+   *
+   * Long computations should check cancelled() regularly and return false
+   * if the run was cancelled.
+   */
   std::function<bool(void)> processingFunction;
 
+  /**
+   * @brief Compute a block of samples with batchProcessingFunction
+   *
+   * Values of dimensions that are not part of the block are read from
+   * configuration as in process(). Usually called from
+   * ParameterSpace::sweepBatch().
+   */
+  bool processBatch(SampleBlock &block);
+
+  /**
+   * @brief Function that computes a block of samples
+   *
+   * Must write to all output columns of the block.
+   */
+  std::function<bool(SampleBlock &block)> batchProcessingFunction;
+
 private:
 };
 
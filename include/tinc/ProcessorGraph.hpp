@@ -36,14 +36,48 @@
 #include "tinc/ProcessorAsyncWrapper.hpp"
 #include "tinc/ProcessorScript.hpp"
 
+#include <algorithm>
+#include <map>
 #include <mutex>
 #include <thread>
 
 namespace tinc {
 
+/**
+ * @brief Runs a set of processors
+ *
+ * PROCESS_SERIAL runs processors one after the other in the order they were
+ * added. PROCESS_ASYNC starts all processors at the same time and waits for
+ * all of them.
+ *
+ * PROCESS_GRAPH runs processors as soon as the processors they depend on have
+ * finished, running up to getMaxConcurrency() processors at the same time as
+ * tasks of Executor::global(). A
+ * processor depends on another if one of its input files is an output file of
+ * the other, or if the dependency was added with addDependency(). Processors
+ * that depend on a failed processor are not run.
+ *
+ * For PROCESS_SERIAL and PROCESS_GRAPH, each processor's configuration and
+ * input files are fingerprinted when it runs successfully. When not forcing
+ * recompute, a processor whose fingerprint is unchanged and whose output files
+ * exist is skipped and its outputs are reused. If the fingerprint changed the
+ * processor is run with forceRecompute set. A processor that has no
+ * fingerprint yet, e.g. on the first run, gets the forceRecompute passed to
+ * process(), so its own caching decides whether to compute. Runs that don't
+ * compute, e.g. ProcessorCpp without forceRecompute, are not fingerprinted.
+ * Input files are compared by size
+ * and modification time, and by contents if those changed, so processors
+ * downstream of a processor that rewrote identical files are skipped.
+ * Processors without output files always run. As they are not connected by
+ * files, processors added with addDependency() are run with forceRecompute
+ * when an upstream processor ran and its output files changed (or it has no
+ * output files). By default a processor depends
+ * on all its configuration, use setConfigurationKeys() to restrict it, so
+ * that e.g. a parameter change only recomputes the processors that use it.
+ */
 class ProcessorGraph : public Processor {
 public:
-  typedef enum { PROCESS_SERIAL, PROCESS_ASYNC } ChainType;
+  typedef enum { PROCESS_SERIAL, PROCESS_ASYNC, PROCESS_GRAPH } ChainType;
   ProcessorGraph(ChainType type = PROCESS_SERIAL, std::string id = "")
       : Processor(id), mType(type) {}
   ProcessorGraph(std::string id) : Processor(id), mType(PROCESS_SERIAL) {}
@@ -53,7 +87,8 @@ public:
    * @param proc
    * @param connectFiles true if output files should be connected to input files
    *
-   * connectFiles only has effect if ChainType is PROCESS_SERIAL, it is ingored
+   * For PROCESS_GRAPH, dependencies are derived from file names only for
+   * processors added with connectFiles set to true. connectFiles has no effect
    * for PROCESS_ASYNC
    */
   void addProcessor(Processor &proc, bool connectFiles = true);
@@ -96,7 +131,88 @@ public:
    */
   std::vector<Processor *> getProcessors();
 
+  /**
+   * @brief Run downstream only after upstream has finished successfully
+   *
+   * Both processors must have been added to the graph. Only used for
+   * PROCESS_GRAPH.
+   */
+  void addDependency(Processor &upstream, Processor &downstream);
+
+  /**
+   * @brief Get dependencies as (upstream, downstream) pairs
+   *
+   * Includes the dependencies added with addDependency() and the ones derived
+   * from current file names.
+   */
+  std::vector<std::pair<Processor *, Processor *>> getDependencies();
+
+  /**
+   * @brief Set maximum number of processors running at the same time for
+   * PROCESS_GRAPH
+   */
+  void setMaxConcurrency(size_t concurrency);
+
+  /**
+   * @brief Set the configuration keys a processor depends on
+   * @param proc processor in this graph
+   * @param keys configuration keys
+   *
+   * Changes to other configuration keys don't cause the processor to
+   * recompute. Parameters registered with the processor are always included.
+   */
+  void setConfigurationKeys(Processor &proc, std::vector<std::string> keys);
+
+  size_t getMaxConcurrency() { return mMaxConcurrency; }
+
+  struct ProcessorTiming {
+    double start{0};    ///< seconds from the start of process()
+    double duration{0}; ///< seconds the processor took to run
+    bool skipped{false}; ///< true if processor was not run
+  };
+
+  /**
+   * @brief get timing of the last computation by processor name
+   *
+   * Not available for PROCESS_ASYNC.
+   */
+  std::map<std::string, ProcessorTiming> getTimings();
+
 private:
+  struct InputFingerprint {
+    std::string path;
+    int64_t modified{0}; // nanoseconds
+    int64_t size{0};
+    uint64_t contentHash{0}; // 0 if contents were not hashed
+  };
+
+  // Fingerprint of a processor's last successful run
+  struct NodeState {
+    bool valid{false};
+    uint64_t configurationHash{0};
+    std::vector<InputFingerprint> inputs;
+  };
+
+  // Nodes run on other threads, so the run's token is passed explicitly
+  bool processGraph(bool forceRecompute, CancellationToken token);
+  // Run processor unless its fingerprint is unchanged. If outputsChanged is
+  // given, it is set if the processor ran and its output files changed or it
+  // has none.
+  bool processNode(Processor *proc, NodeState &state, bool forceRecompute,
+                   CancellationToken token, bool &skipped,
+                   bool *outputsChanged = nullptr);
+  // Dependencies as indeces into mProcessors. If explicitOnly, only the ones
+  // added with addDependency(). Requires mChainLock
+  std::vector<std::vector<size_t>> downstreamIndeces(bool explicitOnly = false);
+  uint64_t configurationHash(Processor *proc);
+  bool inputsChanged(Processor *proc, NodeState &state);
+
+  std::map<std::string, ProcessorTiming> mTimings;
+  std::vector<std::pair<Processor *, Processor *>> mDependencies;
+  std::map<Processor *, NodeState> mNodeStates;
+  std::map<Processor *, std::vector<std::string>> mConfigurationKeys;
+  size_t mMaxConcurrency{std::max(std::thread::hardware_concurrency(), 1u)};
+
   std::map<std::string, bool> mResults;
   std::mutex mChainLock; // Exclusive access to processor list mProcessors
   std::vector<std::pair<Processor *, bool>> mProcessors;
@@ -38,10 +38,14 @@
 #include "al/ui/al_ParameterServer.hpp"
 
 #include "tinc/Processor.hpp"
+#include "tinc/Subprocess.hpp"
 
 #include "nlohmann/json.hpp"
 
 #include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -68,10 +72,12 @@ namespace tinc {
  */
 class ProcessorScript : public Processor {
 public:
+  typedef enum { CONFIG_JSON, CONFIG_MSGPACK, CONFIG_CBOR } ConfigFormat;
+
   // TODO change constructor to match Processor constructor
   ProcessorScript(std::string id = "") : Processor(id) {}
 
-  virtual ~ProcessorScript() {}
+  virtual ~ProcessorScript();
 
   // Copy constructor
   ProcessorScript(ProcessorScript &p)
@@ -121,9 +127,46 @@ public:
 
   /**
    * @brief process
+   *
+   * If the run is cancelled, the script is terminated.
    */
   bool process(bool forceRecompute = false) override;
 
+  /**
+   * @brief Run the script asynchronously
+   * @param forceRecompute force running even if cache is valid
+   * @param doneCallback called with the result when the script finishes
+   * @return future holding the result of the run
+   *
+   * The configuration, parameter values, directories and file names are copied
+   * when this function is called, so they can be changed for the next run
+   * while the script runs. Each run writes its own json config file. Runs are
+   * tasks of Executor::global(). Up to getMaxAsyncProcesses() scripts of this
+   * processor run at the same time, further runs are queued. prepareFunction
+   * is called before returning.
+   *
+   * Changes made by the script to output directory and file names are not
+   * applied to this processor. Start and done callbacks are called from the
+   * executor's threads and can be called concurrently. cancel() terminates all
+   * runs queued or started before it was called.
+   */
+  std::future<bool>
+  processAsync(bool forceRecompute = false,
+               std::function<void(bool)> doneCallback = nullptr);
+
+  /**
+   * @brief Set maximum number of scripts running at the same time through
+   * processAsync()
+   */
+  void setMaxAsyncProcesses(int maxProcesses);
+
+  int getMaxAsyncProcesses() { return mMaxAsyncProcesses; }
+
+  /**
+   * @brief Wait until all runs started with processAsync() have finished
+   */
+  void waitForAsyncProcesses();
+
   /**
    * @brief Cleans a name up so it can be written to disk
    * @param output_name the source name
@@ -146,9 +189,56 @@ public:
    */
   void useCache(bool use = true);
 
+  /**
+   * @brief Keep the interpreter running between runs
+   * @param use
+   *
+   * Starting the interpreter and importing modules can take longer than the
+   * script itself. When enabled, the script is run by long-lived python
+   * interpreters that compile the script once. Configurations are passed to
+   * the interpreter through its standard input instead of through a file in
+   * the running directory, and the updated configuration is read back from
+   * its standard output. The script interface does not change: the
+   * interpreter writes the json config for the script, executes the script as
+   * __main__ with the config file name as argument and returns the config the
+   * script leaves.
+   *
+   * The command must be a python interpreter. Script output is forwarded to
+   * std::cerr. Interpreters are restarted if they exit or if the script file
+   * is modified. Modules imported by the script are not reloaded. Runs from
+   * processAsync() share the interpreters, one per concurrent run. Not
+   * supported on Windows, where scripts always run in a new process.
+   */
+  void usePersistentInterpreter(bool use = true);
+
+  bool usingPersistentInterpreter() { return mUsePersistentInterpreter; }
+
+  /**
+   * @brief Set the format of the configuration passed to the script
+   *
+   * CONFIG_JSON, the default, writes a json file to the running directory.
+   * The binary formats encode the same configuration with MessagePack or
+   * CBOR, which is faster for large array values. On Linux the binary
+   * configuration is passed through an anonymous memory file, so nothing is
+   * written to disk, and the script receives "/dev/fd/3" as the config file
+   * name. The script reads the configuration from that path and writes the
+   * updated configuration back to it in the same format, e.g. with the
+   * msgpack or cbor2 python modules. Persistent interpreters also use the
+   * format to communicate with this process. Only CONFIG_JSON is supported on
+   * Windows.
+   */
+  void setConfigFormat(ConfigFormat format) { mConfigFormat = format; }
+
+  ConfigFormat getConfigFormat() { return mConfigFormat; }
+
 protected:
   std::string writeJsonConfig();
 
+  nlohmann::json makeJsonConfig();
+
+  // Apply configuration returned by script
+  bool applyJsonConfig(nlohmann::json &j);
+
   // Read configuration from disk. The python script can write configuration to
   // override the configuration provided
   bool readJsonConfig(std::string filename);
@@ -160,18 +250,61 @@ private:
   std::string mScriptName;
 
   std::mutex mProcessingLock;
+
+  // Runs from processAsync() waiting to be submitted to the executor. Queue
+  // and counters are protected by mAsyncQueueLock
   int mMaxAsyncProcesses{4};
-  std::atomic<int> mNumAsyncProcesses{0};
-  std::vector<std::thread> mAsyncThreads;
-  std::thread mAsyncDoneThread;
+  int mNumAsyncProcesses{0};
+  std::deque<std::function<void()>> mAsyncQueue;
   std::condition_variable mAsyncDoneTrigger;
-  std::mutex mAsyncDoneTriggerLock;
+  std::mutex mAsyncQueueLock;
+
+  // Parameter values copied for runs from processAsync()
+  nlohmann::json mParameterValues;
 
   bool mUseCache{false};
+  ConfigFormat mConfigFormat{CONFIG_JSON};
+
+  // Interpreters for usePersistentInterpreter(). The pool is shared with the
+  // copies made by processAsync()
+  struct ScriptWorker {
+    Subprocess process;
+    std::string command;
+    std::string scriptPath;
+    al_sec scriptModified;
+    ConfigFormat configFormat;
+  };
+  struct ScriptWorkerPool {
+    std::mutex lock;
+    std::vector<std::unique_ptr<ScriptWorker>> idleWorkers;
+  };
+  bool mUsePersistentInterpreter{false};
+  std::shared_ptr<ScriptWorkerPool> mWorkerPool{
+      std::make_shared<ScriptWorkerPool>()};
+
+  std::string jsonConfigFilename();
+  // Config file name for the current config format
+  std::string configFilename();
+  std::string scriptPath();
+  std::vector<std::string> commandArguments();
+  std::unique_ptr<ScriptWorker> acquireWorker();
+  bool runInWorker(nlohmann::json &config, std::string configFilename);
+  // Run script with config in a binary format. config is replaced by the
+  // config written by the script
+  bool runWithBinaryConfig(nlohmann::json &config);
+
+  // Write config, run script and read config back. Requires valid script
+  // name and command
+  bool runScript(bool forceRecompute);
+
+  // Submit queued runs while fewer than mMaxAsyncProcesses are running.
+  // Requires mAsyncQueueLock
+  void startAsyncRuns();
 
   std::string makeCommandLine();
 
-  bool runCommand(const std::string &command);
+  bool runCommand(const std::vector<std::string> &arguments,
+                  const std::vector<int> &inheritedFds = {});
 
   bool writeMeta();
 
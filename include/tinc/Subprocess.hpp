@@ -0,0 +1,175 @@
+#ifndef SUBPROCESS_HPP
+#define SUBPROCESS_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Run a program as a child process without going through a shell
+ *
+ * Arguments are passed directly to the program, so they don't need quoting.
+ * The working directory is set for the child only, so the working directory of
+ * this process is never changed and several children can be started at the
+ * same time from different threads. Standard output and error are captured
+ * through pipes.
+ *
+ * The child is started with posix_spawn, or with vfork when posix_spawn can't
+ * set the working directory on this platform. Not supported on Windows.
+ *
+ * By default the child stays in the process group of this process, so
+ * signals from the terminal such as Ctrl-C reach it as they would with popen.
+ * See useProcessGroup() to run it in its own process group instead.
+ *
+ * @code
+Subprocess process;
+int exitCode;
+std::string output, errors;
+if (process.start({"python3", "script.py", "config.json"}, "run_dir/") &&
+    process.wait(exitCode, &output, &errors)) {
+  std::cout << output;
+}
+ * @endcode
+ */
+class Subprocess {
+public:
+  Subprocess() {}
+  Subprocess(const Subprocess &) = delete;
+  Subprocess &operator=(const Subprocess &) = delete;
+
+  /**
+   * @brief Terminates the child if it is still running
+   */
+  ~Subprocess();
+
+  /**
+   * @brief Start child process
+   * @param arguments program followed by its arguments. If the program
+   * contains no '/' it is searched for in PATH.
+   * @param workingDirectory working directory for the child. If empty the
+   * current working directory is used.
+   * @param pipeInput if true, the child's standard input can be written with
+   * writeInput(). Otherwise standard input is /dev/null.
+   * @param inheritedFds file descriptors passed to the child as descriptors
+   * 3, 4, ... in order. They remain open in this process.
+   * @return false if the process could not be started
+   */
+  bool start(const std::vector<std::string> &arguments,
+             std::string workingDirectory = "", bool pipeInput = false,
+             const std::vector<int> &inheritedFds = {});
+
+  /**
+   * @brief Run the child in its own process group
+   *
+   * terminate() then also reaches the processes the child starts, but signals
+   * from the terminal don't, so they keep running if this process is
+   * interrupted. Must be set before start().
+   */
+  void useProcessGroup(bool use = true) { mUseProcessGroup = use; }
+
+  /**
+   * @brief Write to the child's standard input
+   * @return false if the child has closed its input, e.g. because it exited
+   *
+   * The process must have been started with pipeInput set.
+   */
+  bool writeInput(const void *data, size_t size);
+
+  /**
+   * @brief Close the child's standard input
+   */
+  void closeInput();
+
+  /**
+   * @brief Read an exact number of bytes from the child's standard output
+   * @param data buffer for size bytes
+   * @param errorOutput standard error received while reading is appended
+   * here. Discarded if nullptr
+   * @return false if the output was closed before size bytes were read
+   *
+   * Standard error is drained while waiting, so the child can't block on it.
+   */
+  bool readOutput(void *data, size_t size, std::string *errorOutput = nullptr);
+
+  /**
+   * @brief Read output until the child exits
+   * @param[out] exitCode exit code of the child, or -1 if it was terminated
+   * by a signal. 127 if the program could not be executed.
+   * @param[out] output standard output of the child. Discarded if nullptr
+   * @param[out] errorOutput standard error of the child. Discarded if nullptr
+   * @return false if the child was not running or waiting failed
+   */
+  bool wait(int &exitCode, std::string *output = nullptr,
+            std::string *errorOutput = nullptr);
+
+  /**
+   * @brief Ask the child to terminate by sending SIGTERM
+   *
+   * With useProcessGroup() the signal is sent to the child's process group.
+   * Otherwise it only reaches the child, and wait() returns once the child
+   * has exited, even if processes it started still hold its output open. Can
+   * be called from a different thread than the one in wait().
+   */
+  void terminate();
+
+  /**
+   * @brief true if start() succeeded and wait() has not finished yet
+   */
+  bool running();
+
+  /**
+   * @brief true if the child has exited and wait() has not been called yet
+   *
+   * Does not block.
+   */
+  bool exited();
+
+private:
+  void closePipes();
+
+  bool mUseProcessGroup{false};
+  std::mutex mPidLock; // Protects mPid and mTerminated
+  int mPid{-1};
+  bool mTerminated{false};
+  int mInputFd{-1};
+  int mOutputFd{-1};
+  int mErrorFd{-1};
+};
+
+} // namespace tinc
+
+#endif // SUBPROCESS_HPP
@@ -39,8 +39,15 @@
 #include "tinc/DataPool.hpp"
 #include "tinc/DiskBuffer.hpp"
 #include "tinc/ParameterSpace.hpp"
+#include "tinc/PeriodicTask.hpp"
 #include "tinc/Processor.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
+
 namespace tinc {
 
 static const uint16_t TINC_PROTOCOL_VERSION = 1;
@@ -48,6 +55,8 @@ static const uint16_t TINC_PROTOCOL_REVISION = 0;
 
 class TincProtocol {
 public:
+  virtual ~TincProtocol();
+
   // Data pool commands
   enum { CREATE_DATA_SLICE = 0x01 };
 
@@ -178,6 +187,15 @@ public:
 
   void setVerbose(bool v) { mVerbose = v; }
 
+  /**
+   * @brief Set defaults for data pool slices streamed over the connection
+   * @param chunkSize maximum data bytes in each STREAM_DATA message
+   * @param window maximum bytes sent before the client acknowledges them
+   *
+   * Clients can override these values in the DataPoolCommandSlice command.
+   */
+  void setSliceStreamDefaults(size_t chunkSize, size_t window);
+
   virtual void markBusy();
 
   virtual void markAvailable();
@@ -274,9 +292,22 @@ protected:
   bool processCommandParameterSpace(void *any, al::Socket *src);
   bool processCommandDataPool(void *any, al::Socket *src);
 
+  // Streamed data pool slices
+  bool processCommandDataPoolStreamSlice(DataPool *dp, void *any,
+                                         al::Socket *src);
+  void startSliceStream(uint64_t streamId, BinaryArray &&slice,
+                        al::Socket *dst, size_t chunkSize, size_t window);
+  bool processSliceStreamAck(void *any, al::Socket *src);
+  // Stop streams to dst, or all streams if dst is nullptr
+  void cancelSliceStreams(al::Socket *dst = nullptr);
+
   // send proto message (No checks. sends to dst socket)
   bool sendProtobufMessage(void *message, al::Socket *dst);
 
+  // Write bytes to dst socket. All messages are sent through this function.
+  // Requires mSendLock
+  virtual size_t sendBytes(al::Socket *dst, const char *data, size_t size);
+
   // Send tinc message. Overriden on TincServer or TincClient
   /**
    * @brief sendTincMessage
@@ -308,6 +339,44 @@ protected:
   uint32_t mBusyCount = 0;
 
   bool mVerbose{false};
+
+private:
+  struct SliceStream {
+    uint64_t id;
+    al::Socket *dst;
+    BinaryArray slice;
+    size_t chunkSize;
+    size_t window;
+    size_t sentBytes{0};
+    size_t acknowledgedBytes{0};
+    std::chrono::steady_clock::time_point lastAcknowledged;
+    std::string error; // Sent to the client to abort the stream
+    bool cancelled{false};
+    bool sending{false}; // sliceStreamFunction() is queued or running
+    bool finished{false};
+    std::future<void> task;
+  };
+
+  // Sends chunks until the window is full. Runs on Executor::global()
+  void sliceStreamFunction(SliceStream *stream);
+  // Queue sliceStreamFunction() if the stream can make progress. Requires
+  // mSliceStreamsLock
+  void scheduleSliceStream(SliceStream &stream);
+  // Abort streams whose client stopped acknowledging data
+  bool checkSliceStreamTimeouts();
+  bool sendSliceStreamChunk(SliceStream &stream, size_t offset, size_t size,
+                            std::string error = "");
+
+  // Frames are written to sockets from stream tasks, so all sends are
+  // serialized.
+  std::mutex mSendLock;
+
+  std::mutex mSliceStreamsLock;
+  std::map<uint64_t, std::unique_ptr<SliceStream>> mSliceStreams;
+  uint64_t mNextSliceStreamId{1};
+  size_t mSliceStreamChunkSize{1 << 16};
+  size_t mSliceStreamWindow{1 << 20};
+  PeriodicTask mSliceStreamTimeouts;
 };
 } // namespace tinc
 #endif // TINCPROTOCOL_HPP
@@ -0,0 +1,194 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+#include <atomic>
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+class IdObject;
+
+/**
+ * @brief Records timed spans of TINC work in an in-memory ring buffer
+ *
+ * Processors and ParameterSpace record spans for preparation, configuration
+ * writing, execution and cache lookup, restore and store to global() when it
+ * is enabled. Spans recorded during ParameterSpace::sweep() are tagged with
+ * the index of the sample, spans recorded during ParameterSpace::sweepBatch()
+ * with the first sample of the block. The sample is kept per thread and
+ * passed on to the Executor tasks a thread queues. When the buffer is full,
+ * the oldest spans are overwritten.
+ *
+ * The spans can be exported as Chrome trace event JSON, to be viewed in
+ * chrome://tracing or Perfetto:
+ * @code
+Tracer::global().enable();
+ps.sweep(processor);
+Tracer::global().writeChromeTrace("sweep_trace.json");
+ * @endcode
+ */
+class Tracer {
+public:
+  struct Span {
+    std::string name;
+    std::string category; ///< Id of the object doing the work
+    uint64_t start{0};    ///< Nanoseconds since the tracer's epoch
+    uint64_t duration{0}; ///< Nanoseconds
+    uint64_t threadId{0};
+    int64_t sample{-1}; ///< Sweep sample index or -1 if not in a sweep
+  };
+
+  /**
+   * @param capacity maximum number of spans kept
+   */
+  Tracer(size_t capacity = 16384);
+
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  /**
+   * @brief Tracer used by TINC classes. Disabled by default.
+   */
+  static Tracer &global();
+
+  void enable(bool enable = true) { mEnabled = enable; }
+  bool enabled() const { return mEnabled; }
+
+  /**
+   * @brief Change the maximum number of spans. Clears recorded spans.
+   */
+  void setCapacity(size_t capacity);
+  size_t capacity();
+
+  /**
+   * @brief Monotonic time in nanoseconds since the tracer's epoch
+   */
+  uint64_t now() const;
+
+  /**
+   * @brief Store span, overwriting the oldest span if the buffer is full
+   *
+   * Spans are stored even if the tracer is disabled.
+   */
+  void record(Span span);
+
+  /**
+   * @brief Copy of the recorded spans, oldest first
+   */
+  std::vector<Span> spans();
+
+  /**
+   * @brief Number of spans overwritten since the last clear()
+   */
+  uint64_t droppedSpans();
+
+  void clear();
+
+  /**
+   * @brief Recorded spans as Chrome trace event JSON
+   */
+  std::string toChromeTrace();
+
+  bool writeChromeTrace(std::string filename);
+
+  /**
+   * @brief Set the sweep sample index for spans recorded by this thread
+   * @param sample sample index or -1 if not in a sweep
+   */
+  static void setCurrentSample(int64_t sample);
+  static int64_t currentSample();
+
+  /**
+   * @brief Small number identifying the calling thread in spans
+   */
+  static uint64_t currentThreadId();
+
+private:
+  std::atomic<bool> mEnabled{false};
+  const uint64_t mEpoch;
+
+  std::mutex mSpansLock; // Protects members below
+  std::vector<Span> mSpans;
+  size_t mCapacity;
+  size_t mNext{0};
+  uint64_t mRecorded{0};
+};
+
+/**
+ * @brief Records a span from construction to destruction
+ *
+ * Nothing is recorded if the tracer is disabled when the scope starts.
+ * @code
+{
+  TraceScope scope("execute", getId());
+  // work to be timed
+}
+ * @endcode
+ */
+class TraceScope {
+public:
+  TraceScope(const char *name, const std::string &category,
+             Tracer &tracer = Tracer::global());
+  /**
+   * @brief Use the id of object as category
+   *
+   * The id is only copied if the tracer is enabled.
+   */
+  TraceScope(const char *name, IdObject &object,
+             Tracer &tracer = Tracer::global());
+  ~TraceScope();
+
+  /**
+   * @brief Record the span now instead of on destruction
+   */
+  void end();
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  Tracer &mTracer;
+  const char *mName;
+  std::string mCategory;
+  uint64_t mStart{0};
+  bool mActive;
+};
+
+} // namespace tinc
+
+#endif // TRACER_HPP
@@ -0,0 +1,30 @@
+#include "tinc/CancellationToken.hpp"
+
+using namespace tinc;
+
+void CancellationToken::cancel() {
+  // Callbacks are called with the lock held, so that removing a callback
+  // waits for it to finish
+  std::unique_lock<std::mutex> lk(mState->callbackLock);
+  if (mState->cancelled.exchange(true)) {
+    return;
+  }
+  for (auto &callback : mState->callbacks) {
+    callback.second();
+  }
+}
+
+uint64_t CancellationToken::registerCancelCallback(std::function<void()> func) {
+  std::unique_lock<std::mutex> lk(mState->callbackLock);
+  if (mState->cancelled) {
+    func();
+  }
+  auto handle = mState->nextHandle++;
+  mState->callbacks[handle] = func;
+  return handle;
+}
+
+void CancellationToken::removeCancelCallback(uint64_t handle) {
+  std::unique_lock<std::mutex> lk(mState->callbackLock);
+  mState->callbacks.erase(handle);
+}
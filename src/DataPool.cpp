@@ -1,4 +1,7 @@
 #include "tinc/DataPool.hpp"
+#include "tinc/Executor.hpp"
+
+#include "FileStamp.hpp"
 
 #include "al/io/al_File.hpp"
 
@@ -9,7 +12,11 @@ using json = nlohmann::json;
 #include <netcdf.h>
 #endif
 
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <limits>
 
 using namespace tinc;
 
@@ -19,6 +26,7 @@ DataPool::DataPool(ParameterSpace &ps, std::string sliceCacheDir)
     sliceCacheDir = al::File::currentPath();
   }
   setCacheDirectory(sliceCacheDir);
+  registerDefaultFieldReaders();
 }
 
 DataPool::DataPool(std::string id, ParameterSpace &ps,
@@ -29,6 +37,7 @@ DataPool::DataPool(std::string id, ParameterSpace &ps,
     sliceCacheDir = al::File::currentPath();
   }
   setCacheDirectory(sliceCacheDir);
+  registerDefaultFieldReaders();
 }
 
 std::string DataPool::createDataSlice(std::string field,
@@ -36,159 +45,530 @@ std::string DataPool::createDataSlice(std::string field,
   return createDataSlice(field, std::vector<std::string>{sliceDimension});
 }
 
+#ifdef TINC_HAS_NETCDF
+// Returns provenance stored in slice file or an empty string if the file does
+// not exist or has no provenance.
+static std::string readSliceProvenance(std::string fileName) {
+  if (!al::File::exists(fileName)) {
+    return std::string();
+  }
+  int ncid;
+  if (nc_open(fileName.c_str(), NC_NOWRITE, &ncid)) {
+    return std::string();
+  }
+  std::string provenance;
+  size_t len;
+  if (!nc_inq_attlen(ncid, NC_GLOBAL, "tinc_provenance", &len)) {
+    provenance.resize(len);
+    if (nc_get_att_text(ncid, NC_GLOBAL, "tinc_provenance", &provenance[0])) {
+      provenance.clear();
+    }
+  }
+  nc_close(ncid);
+  return provenance;
+}
+
+static nc_type netCDFType(BinaryArray::Datatype type) {
+  switch (type) {
+  case BinaryArray::INT8:
+    return NC_BYTE;
+  case BinaryArray::UINT8:
+    return NC_UBYTE;
+  case BinaryArray::INT16:
+    return NC_SHORT;
+  case BinaryArray::UINT16:
+    return NC_USHORT;
+  case BinaryArray::INT32:
+    return NC_INT;
+  case BinaryArray::UINT32:
+    return NC_UINT;
+  case BinaryArray::INT64:
+    return NC_INT64;
+  case BinaryArray::UINT64:
+    return NC_UINT64;
+  case BinaryArray::FLOAT32:
+    return NC_FLOAT;
+  case BinaryArray::FLOAT64:
+    return NC_DOUBLE;
+  }
+  return NC_NAT;
+}
+
+static bool binaryArrayType(nc_type ncType, BinaryArray::Datatype &type) {
+  switch (ncType) {
+  case NC_BYTE:
+    type = BinaryArray::INT8;
+    return true;
+  case NC_UBYTE:
+    type = BinaryArray::UINT8;
+    return true;
+  case NC_SHORT:
+    type = BinaryArray::INT16;
+    return true;
+  case NC_USHORT:
+    type = BinaryArray::UINT16;
+    return true;
+  case NC_INT:
+    type = BinaryArray::INT32;
+    return true;
+  case NC_UINT:
+    type = BinaryArray::UINT32;
+    return true;
+  case NC_INT64:
+    type = BinaryArray::INT64;
+    return true;
+  case NC_UINT64:
+    type = BinaryArray::UINT64;
+    return true;
+  case NC_FLOAT:
+    type = BinaryArray::FLOAT32;
+    return true;
+  case NC_DOUBLE:
+    type = BinaryArray::FLOAT64;
+    return true;
+  }
+  return false;
+}
+
+static bool writeNetCDFSlice(std::string fileName,
+                             const std::vector<std::string> &dimensionNames,
+                             const std::vector<std::vector<float>> &coordinates,
+                             const BinaryArray &slice,
+                             const std::string &provenance) {
+  int retval, ncid;
+  if ((retval = nc_create(fileName.c_str(), NC_NETCDF4 | NC_CLOBBER, &ncid))) {
+    std::cerr << "Error opening file: " << fileName << std::endl;
+    return false;
+  }
+  std::vector<int> dimids;
+  std::vector<int> coordVarids;
+  for (size_t i = 0; i < dimensionNames.size(); i++) {
+    int dimid, varid;
+    if ((retval = nc_def_dim(ncid, dimensionNames[i].c_str(),
+                             coordinates[i].size(), &dimid)) ||
+        (retval = nc_def_var(ncid, dimensionNames[i].c_str(), NC_FLOAT, 1,
+                             &dimid, &varid))) {
+      std::cerr << "Error defining dimension " << dimensionNames[i] << ": "
+                << nc_strerror(retval) << std::endl;
+      nc_close(ncid);
+      return false;
+    }
+    dimids.push_back(dimid);
+    coordVarids.push_back(varid);
+  }
+  auto shape = slice.getShape();
+  if (shape.size() > dimensionNames.size()) {
+    int dimid;
+    if ((retval = nc_def_dim(ncid, "components", shape.back(), &dimid))) {
+      std::cerr << "Error defining field dimension: " << nc_strerror(retval)
+                << std::endl;
+      nc_close(ncid);
+      return false;
+    }
+    dimids.push_back(dimid);
+  }
+
+  int varid;
+  if ((retval = nc_def_var(ncid, "data", netCDFType(slice.getDataType()),
+                           (int)dimids.size(),
+                           dimids.data(), &varid)) ||
+      (retval = nc_put_att_text(ncid, NC_GLOBAL, "tinc_provenance",
+                                provenance.size(), provenance.data())) ||
+      (retval = nc_enddef(ncid))) {
+    std::cerr << "Error defining data variable: " << nc_strerror(retval)
+              << std::endl;
+    nc_close(ncid);
+    return false;
+  }
+  for (size_t i = 0; i < dimensionNames.size(); i++) {
+    if ((retval = nc_put_var_float(ncid, coordVarids[i],
+                                   coordinates[i].data()))) {
+      std::cerr << "Error writing coordinates for " << dimensionNames[i]
+                << ": " << nc_strerror(retval) << std::endl;
+      nc_close(ncid);
+      return false;
+    }
+  }
+  if ((retval = nc_put_var(ncid, varid, slice.data()))) {
+    std::cerr << "Error writing slice data: " << nc_strerror(retval)
+              << std::endl;
+    nc_close(ncid);
+    return false;
+  }
+  if ((retval = nc_close(ncid))) {
+    return false;
+  }
+  return true;
+}
+#endif
+
+DataPool::~DataPool() { waitForSliceWrites(); }
+
 std::string
 DataPool::createDataSlice(std::string field,
                           std::vector<std::string> sliceDimensions) {
+  SliceRequest request;
+  if (!prepareSlice(field, sliceDimensions, request, true)) {
+    return std::string();
+  }
+#ifdef TINC_HAS_NETCDF
+  if (readSliceProvenance(mSliceCacheDirectory + request.fileName) ==
+      request.provenance) {
+    return request.fileName;
+  }
+#endif
+  BinaryArray slice;
+  if (!readSlice(request, slice) || !writeSliceFile(request, slice)) {
+    return std::string();
+  }
+  return request.fileName;
+}
 
-  std::vector<std::string> filesystemDims;
-  for (auto dim : mParameterSpace->getDimensions()) {
-    if (mParameterSpace->isFilesystemDimension(dim->getName())) {
-      filesystemDims.push_back(dim->getName());
-    }
+bool DataPool::sliceToMemory(std::string field, std::string sliceDimension,
+                             BinaryArray &slice, bool writeFile) {
+  return sliceToMemory(field, std::vector<std::string>{sliceDimension}, slice,
+                       writeFile);
+}
+
+bool DataPool::sliceToMemory(std::string field,
+                             std::vector<std::string> sliceDimensions,
+                             BinaryArray &slice, bool writeFile) {
+  auto request = std::make_shared<SliceRequest>();
+  if (!prepareSlice(field, sliceDimensions, *request, writeFile) ||
+      !readSlice(*request, slice)) {
+    return false;
   }
-  // FIXME implement slicing along more than one dimension.
-  std::vector<float> values;
-  std::string filename = "slice_";
+  if (writeFile) {
+    // Sample information is not needed to write the file
+    request->sampleIndeces.clear();
+    request->samplesPerDirectory.clear();
+    auto sliceCopy = std::make_shared<BinaryArray>(slice);
+    std::unique_lock<std::mutex> lk(mSliceWritesLock);
+    // Remove writes that have completed
+    mSliceWrites.remove_if([](std::future<bool> &write) {
+      return write.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    });
+    mSliceWrites.push_back(
+        Executor::global().submit([this, request, sliceCopy]() {
+#ifdef TINC_HAS_NETCDF
+          if (readSliceProvenance(mSliceCacheDirectory + request->fileName) ==
+              request->provenance) {
+            return true;
+          }
+#endif
+          return writeSliceFile(*request, *sliceCopy);
+        }));
+  }
+  return true;
+}
 
-  size_t fieldSize = 1; // FIXME get actual field size
-  size_t dimCount = fieldSize;
+bool DataPool::waitForSliceWrites() {
+  std::list<std::future<bool>> writes;
+  {
+    std::unique_lock<std::mutex> lk(mSliceWritesLock);
+    writes.swap(mSliceWrites);
+  }
+  bool ok = true;
+  for (auto &write : writes) {
+    ok &= write.get();
+  }
+  return ok;
+}
+
+bool DataPool::prepareSlice(std::string field,
+                            std::vector<std::string> sliceDimensions,
+                            SliceRequest &request, bool computeProvenance) {
+  std::vector<std::shared_ptr<ParameterSpaceDimension>> sliceDims;
   for (auto sliceDimension : sliceDimensions) {
     auto dim = mParameterSpace->getDimension(sliceDimension);
-    if (dim) {
-      dimCount *= dim->size();
-    } else {
+    if (!dim) {
       std::cerr << "ERROR: Unknown dimension: " << sliceDimension << std::endl;
-      return std::string();
+      return false;
+    }
+    if (std::find(sliceDims.begin(), sliceDims.end(), dim) !=
+        sliceDims.end()) {
+      std::cerr << "ERROR: Repeated slice dimension: " << sliceDimension
+                << std::endl;
+      return false;
+    }
+    sliceDims.push_back(dim);
+  }
+  request.field = field;
+  request.dimensionNames = sliceDimensions;
+  request.coordinates.clear();
+  for (auto dim : sliceDims) {
+    std::vector<float> coordinates(dim->size());
+    for (size_t i = 0; i < coordinates.size(); i++) {
+      coordinates[i] = dim->at(i);
+    }
+    request.coordinates.push_back(coordinates);
+  }
+
+  // Dimensions that are not part of the slice are fixed at their current
+  // index.
+  std::map<std::string, size_t> fixedIndeces;
+  for (auto dim : mParameterSpace->getDimensions()) {
+    auto index = dim->getCurrentIndex();
+    fixedIndeces[dim->getName()] = index == SIZE_MAX ? 0 : index;
+  }
+
+  size_t sampleCount = 1;
+  for (auto &coordinates : request.coordinates) {
+    sampleCount *= coordinates.size();
+  }
+
+  // Determine the parameter space indeces for every sample in the slice (row
+  // major order over sliceDimensions) and group samples by directory, so that
+  // every data file is only read once regardless of how many samples it holds.
+  std::string rootPath =
+      al::File::conformPathToOS(mParameterSpace->getRootPath());
+  request.sampleIndeces.assign(sampleCount, fixedIndeces);
+  request.samplesPerDirectory.clear();
+  for (size_t sample = 0; sample < sampleCount; sample++) {
+    size_t remainder = sample;
+    for (size_t i = sliceDims.size(); i > 0; i--) {
+      auto &dim = sliceDims[i - 1];
+      request.sampleIndeces[sample][dim->getName()] = remainder % dim->size();
+      remainder /= dim->size();
+    }
+    auto directory =
+        rootPath + mParameterSpace->generateRelativeRunPath(
+                       request.sampleIndeces[sample], mParameterSpace);
+    if (directory.size() > 0) {
+      directory = al::File::conformDirectory(directory);
     }
+    request.samplesPerDirectory[directory].push_back(sample);
   }
-  values.reserve(dimCount);
 
-  // TODO check if file exists and is the correct slice to use cache instead.
-  // TODO for this we need to add metadata to the file indicating where the
-  // slice came from. This is part of the bigger TINC metadata idea
+  request.fileName = "slice_" + field;
   for (auto sliceDimension : sliceDimensions) {
-    auto dim = mParameterSpace->getDimension(sliceDimension);
-    assert(dim);
-    if (std::find(filesystemDims.begin(), filesystemDims.end(),
-                  sliceDimension) == filesystemDims.end()) {
-      // TODO should we perform a  copy of the parameter space to avoid race
-      // conditions?
-      // sliceDimension is a dimension that affects filesystem paths.
-      size_t dimCount = dim->size();
-      values.reserve(dimCount);
-
-      auto dataPaths = getAllPaths();
-      for (auto directory : dataPaths) {
-        for (auto file : mDataFilenames) {
-          float value;
-          size_t index =
-              mParameterSpace->getDimension(file.second)->getCurrentIndex();
-          if (getFieldFromFile(field, al::File::conformDirectory(directory) +
-                                          file.first,
-                               index, &value)) {
-            values.push_back(value);
-            break;
+    request.fileName += "_" + sliceDimension;
+  }
+  for (auto dim : mParameterSpace->getDimensions()) {
+    if (std::find(sliceDims.begin(), sliceDims.end(), dim) ==
+        sliceDims.end()) {
+      request.fileName += "_" + dim->getName() + "_" +
+                          std::to_string(fixedIndeces[dim->getName()]);
+    }
+  }
+  request.fileName += ".nc";
+
+  if (!computeProvenance) {
+    request.provenance.clear();
+    return true;
+  }
+  // Provenance identifies the data the slice was created from. If an existing
+  // slice file has the same provenance, it can be used as is.
+  std::vector<std::string> directories;
+  for (auto &directorySamples : request.samplesPerDirectory) {
+    directories.push_back(directorySamples.first);
+  }
+  std::vector<uint64_t> directoryFingerprints(directories.size());
+  Executor::io().parallelFor(
+      directories.size(),
+      [&](size_t i) {
+        uint64_t fingerprint = FNV_OFFSET_BASIS;
+        for (auto &file : mDataFilenames) {
+          int64_t modified, fileSize;
+          auto fullName = directories[i] + file.first;
+          if (fileStamp(fullName, modified, fileSize)) {
+            fingerprint = fnv1a(fullName.data(), fullName.size(), fingerprint);
+            fingerprint = fnv1a(&modified, sizeof(modified), fingerprint);
+            fingerprint = fnv1a(&fileSize, sizeof(fileSize), fingerprint);
           }
         }
-      }
-    } else { // We can slice the data from a single file
-      values.resize(dim->size());
-      std::map<std::string, size_t> currentIndeces;
-      for (auto dimension : mParameterSpace->getDimensions()) {
-        currentIndeces[dimension->getName()] = dimension->getCurrentIndex();
-      }
-      auto directory = mParameterSpace->generateRelativeRunPath(
-          currentIndeces, mParameterSpace);
-      for (auto file : mDataFilenames) {
-        if (getFieldFromFile(field,
-                             al::File::conformDirectory(directory) + file.first,
-                             values.data(), values.size())) {
-          break;
-        }
-      }
+        directoryFingerprints[i] = fingerprint;
+        return true;
+      },
+      mReadConcurrency);
+  json provenance;
+  provenance["field"] = field;
+  provenance["sliceDimensions"] = sliceDimensions;
+  for (size_t i = 0; i < sliceDimensions.size(); i++) {
+    provenance["coordinates"][sliceDimensions[i]] = request.coordinates[i];
+  }
+  provenance["fixedIndeces"] = json::object();
+  for (auto &index : fixedIndeces) {
+    if (std::find(sliceDimensions.begin(), sliceDimensions.end(),
+                  index.first) == sliceDimensions.end()) {
+      provenance["fixedIndeces"][index.first] = index.second;
     }
-    filename += sliceDimension + +"_" +
-                mParameterSpace->getDimension(sliceDimension)->getCurrentId();
   }
+  provenance["dataFiles"] = mDataFilenames;
+  provenance["sourceDirectories"] = directories.size();
+  provenance["sourcesFingerprint"] =
+      fnv1a(directoryFingerprints.data(),
+            directoryFingerprints.size() * sizeof(uint64_t), FNV_OFFSET_BASIS);
+  request.provenance = provenance.dump();
+  return true;
+}
 
-  for (auto dim : mParameterSpace->getDimensions()) {
-    if (std::find(sliceDimensions.begin(), sliceDimensions.end(),
-                  dim->getName()) == sliceDimensions.end()) {
-      filename += "_" + dim->getName();
+bool DataPool::readSlice(SliceRequest &request, BinaryArray &slice) {
+  // Directories are read concurrently. Each directory writes only to its own
+  // samples in sampleValues, so the output order is deterministic.
+  size_t sampleCount = request.sampleIndeces.size();
+  std::vector<std::shared_ptr<const BinaryArray>> sampleValues(sampleCount);
+  std::vector<std::map<std::string, std::vector<size_t>>::const_iterator>
+      directories;
+  for (auto it = request.samplesPerDirectory.cbegin();
+       it != request.samplesPerDirectory.cend(); it++) {
+    directories.push_back(it);
+  }
+  Executor::io().parallelFor(
+      directories.size(),
+      [&](size_t i) {
+        readSliceSamples(request.field, directories[i]->first,
+                         directories[i]->second, request.sampleIndeces,
+                         sampleValues);
+        return true;
+      },
+      mReadConcurrency);
+
+  // All samples must have the same number of components. The slice keeps the
+  // data type of the samples and only falls back to FLOAT64 when types differ
+  // or when integer data has missing samples that need to be filled with NaN.
+  size_t fieldSize = 0;
+  bool hasType = false;
+  bool missingSamples = false;
+  BinaryArray::Datatype type = BinaryArray::FLOAT64;
+  for (auto &value : sampleValues) {
+    if (!value) {
+      missingSamples = true;
+      continue;
+    }
+    if (fieldSize == 0) {
+      fieldSize = value->elementCount();
+    } else if (fieldSize != value->elementCount()) {
+      std::cerr << "ERROR: Inconsistent size for field " << request.field
+                << " across slice" << std::endl;
+      return false;
+    }
+    if (!hasType) {
+      type = value->getDataType();
+      hasType = true;
+    } else if (type != value->getDataType()) {
+      type = BinaryArray::FLOAT64;
     }
   }
-  filename += ".nc";
-#ifdef TINC_HAS_NETCDF
-  int retval, ncid;
-  if ((retval = nc_create((mSliceCacheDirectory + filename).c_str(),
-                          NC_NETCDF4 | NC_CLOBBER, &ncid))) {
-    std::cerr << "Error opening file: " << filename << std::endl;
-    filename.clear();
+  if (fieldSize == 0) {
+    std::cerr << "ERROR: No data found for field " << request.field
+              << std::endl;
+    return false;
   }
-  int x_dimid, varid;
-  int dimids[1];
-  if ((retval = nc_def_dim(ncid, "values", values.size(), &x_dimid))) {
-    filename.clear();
+  if (missingSamples && !BinaryArray::isFloatingPoint(type)) {
+    type = BinaryArray::FLOAT64;
   }
-  dimids[0] = x_dimid;
-
-  /* Define the variable.*/
-  if ((retval = nc_def_var(ncid, "data", NC_FLOAT, 1, dimids, &varid))) {
-    filename.clear();
+  std::vector<uint64_t> shape;
+  for (auto &coordinates : request.coordinates) {
+    shape.push_back(coordinates.size());
   }
-  if ((retval = nc_enddef(ncid))) {
-    filename.clear();
+  if (fieldSize > 1) {
+    shape.push_back(fieldSize);
   }
-  if ((retval = nc_put_var_float(ncid, varid, values.data()))) {
-    filename.clear();
+  slice.allocate(type, shape);
+  if (type == BinaryArray::FLOAT32) {
+    float *values = slice.dataAs<float>();
+    std::fill(values, values + sampleCount * fieldSize,
+              std::numeric_limits<float>::quiet_NaN());
+  } else if (type == BinaryArray::FLOAT64) {
+    double *values = slice.dataAs<double>();
+    std::fill(values, values + sampleCount * fieldSize,
+              std::numeric_limits<double>::quiet_NaN());
   }
-  if ((retval = nc_close(ncid))) {
-    filename.clear();
+  size_t sampleBytes = fieldSize * BinaryArray::elementSize(type);
+  auto values = static_cast<uint8_t *>(slice.data());
+  for (size_t sample = 0; sample < sampleCount; sample++) {
+    if (sampleValues[sample]) {
+      sampleValues[sample]->convertTo(type, values + sample * sampleBytes);
+    }
   }
+  return true;
+}
 
+bool DataPool::writeSliceFile(const SliceRequest &request,
+                              const BinaryArray &slice) {
+#ifdef TINC_HAS_NETCDF
+  // Write to a temporary file first, so that clients never see a partially
+  // written slice with valid provenance.
+  auto fileName = mSliceCacheDirectory + request.fileName;
+  auto temporaryName =
+      fileName + ".tmp" +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  if (!writeNetCDFSlice(temporaryName, request.dimensionNames,
+                        request.coordinates, slice, request.provenance)) {
+    std::remove(temporaryName.c_str());
+    return false;
+  }
+#ifdef AL_WINDOWS
+  std::remove(fileName.c_str());
+#endif
+  if (std::rename(temporaryName.c_str(), fileName.c_str()) != 0) {
+    std::cerr << "ERROR writing slice file: " << fileName << std::endl;
+    std::remove(temporaryName.c_str());
+    return false;
+  }
+  return true;
 #else
   std::cerr << " ERROR not implemented" << std::endl;
-  filename.clear();
+  return false;
 #endif
-  return filename;
 }
 
 size_t DataPool::readDataSlice(std::string field, std::string sliceDimension,
                                void *data, size_t maxLen) {
-  auto filename = DataPool::createDataSlice(field, sliceDimension);
-  if (filename.size() > 0) {
-#ifdef TINC_HAS_NETCDF
-    int retval, ncid, varid, nattsp;
-    size_t lenp;
-    nc_type xtypep;
-    int ndimsp;
-    int dimidsp[32];
-    if ((retval = nc_open(filename.c_str(), NC_NETCDF4, &ncid))) {
-      std::cerr << "Error opening file: " << filename << std::endl;
-    }
-    if ((retval = nc_inq_varid(ncid, "data", &varid))) {
-      return 0;
-    }
-
-    if ((retval = nc_inq_var(ncid, varid, nullptr, &xtypep, &ndimsp, dimidsp,
-                             &nattsp))) {
-      return 0;
-    }
-    if ((retval = nc_inq_dimlen(ncid, dimidsp[0], &lenp))) {
-      return 0;
-    }
+  BinaryArray slice;
+  if (!sliceToMemory(field, sliceDimension, slice)) {
+    return 0;
+  }
+  if (maxLen < slice.elementCount()) {
+    return 0; // FIXME finish the edge case
+  }
+  slice.convertTo(BinaryArray::FLOAT32, data);
+  return slice.elementCount();
+}
 
-    if (maxLen >= lenp) {
-      if ((retval = nc_get_var(ncid, varid, data))) {
-        return 0;
-      }
-      return lenp;
+bool DataPool::getSliceInfo(std::string sliceFile, BinaryArray::Datatype &type,
+                            std::vector<uint64_t> &shape) {
+#ifdef TINC_HAS_NETCDF
+  int ncid, varid, ndims, retval;
+  nc_type ncType;
+  if ((retval = nc_open((mSliceCacheDirectory + sliceFile).c_str(), NC_NOWRITE,
+                        &ncid))) {
+    std::cerr << "ERROR opening slice file " << sliceFile << ": "
+              << nc_strerror(retval) << std::endl;
+    return false;
+  }
+  int dimids[NC_MAX_VAR_DIMS];
+  if ((retval = nc_inq_varid(ncid, "data", &varid)) ||
+      (retval = nc_inq_var(ncid, varid, nullptr, &ncType, &ndims, dimids,
+                           nullptr))) {
+    std::cerr << "ERROR reading slice file " << sliceFile << ": "
+              << nc_strerror(retval) << std::endl;
+    nc_close(ncid);
+    return false;
+  }
+  if (!binaryArrayType(ncType, type)) {
+    std::cerr << "ERROR unsupported data type in slice file " << sliceFile
+              << std::endl;
+    nc_close(ncid);
+    return false;
+  }
+  shape.clear();
+  for (int i = 0; i < ndims; i++) {
+    size_t len;
+    if ((retval = nc_inq_dimlen(ncid, dimids[i], &len))) {
+      nc_close(ncid);
+      return false;
     }
-#endif
-    return 0; // FIXME finish the edge case
-  } else {
-    return 0;
+    shape.push_back(len);
   }
+  nc_close(ncid);
+  return true;
+#else
+  std::cerr << " ERROR not implemented" << std::endl;
+  return false;
+#endif
 }
 
 void DataPool::setCacheDirectory(std::string cacheDirectory) {
@@ -204,41 +584,282 @@ void DataPool::setCacheDirectory(std::string cacheDirectory) {
 
 bool DataPool::getFieldFromFile(std::string field, std::string file,
                                 size_t dimensionInFileIndex, void *data) {
-  std::ifstream f(file);
-  if (!f.good()) {
-    std::cerr << "ERROR reading file: " << file << std::endl;
+  auto reader = getFieldReader(file);
+  if (!reader) {
+    return false;
+  }
+  BinaryArray element;
+  if (reader->supportsPartialReads()) {
+    if (!reader->readFieldElements(file, field, dimensionInFileIndex, 1,
+                                   element)) {
+      return false;
+    }
+  } else {
+    auto fieldData = getFieldData(field, file);
+    if (!fieldData) {
+      return false;
+    }
+    if (!fieldData->copyElements(dimensionInFileIndex, 1, element)) {
+      std::cerr << "ERROR: Index " << dimensionInFileIndex
+                << " out of range for field " << field << " in " << file
+                << std::endl;
+      return false;
+    }
+  }
+  std::vector<float> values;
+  element.appendValues(values);
+  if (values.size() == 0) {
     return false;
   }
-  json j = json::parse(f);
-  auto fieldData = j[field].at(dimensionInFileIndex).get<float>();
-  *(float *)data = fieldData;
+  *(float *)data = values[0];
   return true;
 }
 
 bool DataPool::getFieldFromFile(std::string field, std::string file, void *data,
                                 size_t length) {
+  auto fieldData = getFieldData(field, file);
+  if (!fieldData || fieldData->getShape().size() == 0) {
+    return false;
+  }
+  std::vector<float> values;
+  fieldData->appendValues(values);
+  memcpy((float *)data, values.data(),
+         std::min(length, values.size()) * sizeof(float));
+  return true;
+}
 
-  auto fileType = getFileType(file);
-  std::ifstream f(file);
-  if (!f.good()) {
+std::shared_ptr<const BinaryArray>
+DataPool::getFieldData(const std::string &field, const std::string &file) {
+  int64_t modified, fileSize;
+  if (!fileStamp(file, modified, fileSize)) {
     std::cerr << "ERROR reading file: " << file << std::endl;
-    return false;
+    return nullptr;
   }
-  json j;
-  f >> j;
-  auto fieldData = j[field];
-  if (fieldData && fieldData.is_array()) {
-    memcpy((float *)data, fieldData.get<std::vector<float>>().data(),
-           length * sizeof(float));
-  } else {
-    return false;
+  std::string key = file + '\n' + field;
+  {
+    std::unique_lock<std::mutex> lk(mFieldCacheLock);
+    auto entry = mFieldCache.find(key);
+    if (entry != mFieldCache.end()) {
+      if (entry->second.modified == modified &&
+          entry->second.fileSize == fileSize) {
+        mFieldCacheLru.splice(mFieldCacheLru.begin(), mFieldCacheLru,
+                              entry->second.lruPosition);
+        return entry->second.data;
+      }
+    }
   }
-  return true;
+
+  auto reader = getFieldReader(file);
+  if (!reader) {
+    return nullptr;
+  }
+  // If the reader needs to parse the whole file, extract all fields so that
+  // requests for other fields in the same file don't need to read it again.
+  std::map<std::string, BinaryArray> fields;
+  if (reader->readAllFields(file, fields)) {
+    std::shared_ptr<const BinaryArray> requested;
+    for (auto &fileField : fields) {
+      auto fieldData =
+          std::make_shared<const BinaryArray>(std::move(fileField.second));
+      if (fileField.first == field) {
+        requested = fieldData;
+      }
+      insertInFieldCache(file + '\n' + fileField.first, fieldData, modified,
+                         fileSize);
+    }
+    return requested;
+  }
+  auto fieldData = std::make_shared<BinaryArray>();
+  if (!reader->readField(file, field, *fieldData)) {
+    return nullptr;
+  }
+  insertInFieldCache(key, fieldData, modified, fileSize);
+  return fieldData;
+}
+
+void DataPool::setFieldCacheSize(size_t bytes) {
+  std::unique_lock<std::mutex> lk(mFieldCacheLock);
+  mFieldCacheBudget = bytes;
+  evictFromFieldCache(mFieldCacheBudget);
+}
+
+void DataPool::clearFieldCache() {
+  std::unique_lock<std::mutex> lk(mFieldCacheLock);
+  evictFromFieldCache(0);
+}
+
+void DataPool::insertInFieldCache(const std::string &key,
+                                  std::shared_ptr<const BinaryArray> data,
+                                  int64_t modified, int64_t fileSize) {
+  size_t bytes = key.size() + sizeof(FieldCacheEntry) + sizeof(BinaryArray) +
+                 data->byteSize();
+  std::unique_lock<std::mutex> lk(mFieldCacheLock);
+  auto existing = mFieldCache.find(key);
+  if (existing != mFieldCache.end()) {
+    mFieldCacheBytes -= existing->second.bytes;
+    mFieldCacheLru.erase(existing->second.lruPosition);
+    mFieldCache.erase(existing);
+  }
+  if (bytes > mFieldCacheBudget) {
+    return;
+  }
+  evictFromFieldCache(mFieldCacheBudget - bytes);
+  mFieldCacheLru.push_front(key);
+  mFieldCache[key] = {data, modified, fileSize, bytes, mFieldCacheLru.begin()};
+  mFieldCacheBytes += bytes;
 }
 
-std::string DataPool::getFileType(std::string file) { /*if (file.substr())*/
-  std::string type;
-  return type;
+// mFieldCacheLock must be held when calling this function
+void DataPool::evictFromFieldCache(size_t budget) {
+  while (mFieldCacheBytes > budget && mFieldCacheLru.size() > 0) {
+    auto entry = mFieldCache.find(mFieldCacheLru.back());
+    mFieldCacheBytes -= entry->second.bytes;
+    mFieldCache.erase(entry);
+    mFieldCacheLru.pop_back();
+  }
+}
+
+bool DataPool::readSliceSamples(
+    const std::string &field, const std::string &directory,
+    const std::vector<size_t> &samples,
+    const std::vector<std::map<std::string, size_t>> &sampleIndeces,
+    std::vector<std::shared_ptr<const BinaryArray>> &sampleValues) {
+  for (auto file : mDataFilenames) {
+    auto fullName = directory + file.first;
+    if (!al::File::exists(fullName)) {
+      continue;
+    }
+    auto reader = getFieldReader(fullName);
+    if (!reader) {
+      continue;
+    }
+    // If the dimension in file is not part of the parameter space, the whole
+    // field is a single sample.
+    bool hasDimensionInFile =
+        mParameterSpace->getDimension(file.second) != nullptr;
+    std::shared_ptr<const BinaryArray> fieldData;
+    size_t firstIndex = 0;
+    if (hasDimensionInFile && reader->supportsPartialReads()) {
+      // Read only the range of elements used by the samples
+      size_t lastIndex = 0;
+      firstIndex = SIZE_MAX;
+      for (auto sample : samples) {
+        size_t index = sampleIndeces[sample].at(file.second);
+        firstIndex = std::min(firstIndex, index);
+        lastIndex = std::max(lastIndex, index);
+      }
+      auto range = std::make_shared<BinaryArray>();
+      if (!reader->readFieldElements(fullName, field, firstIndex,
+                                     lastIndex - firstIndex + 1, *range)) {
+        continue;
+      }
+      fieldData = range;
+    } else {
+      fieldData = getFieldData(field, fullName);
+      if (!fieldData) {
+        continue;
+      }
+    }
+    for (auto sample : samples) {
+      if (hasDimensionInFile) {
+        size_t index = sampleIndeces[sample].at(file.second);
+        auto element = std::make_shared<BinaryArray>();
+        if (!fieldData->copyElements(index - firstIndex, 1, *element)) {
+          std::cerr << "ERROR: Index " << index << " out of range for field "
+                    << field << " in " << fullName << std::endl;
+          return false;
+        }
+        sampleValues[sample] = element;
+      } else {
+        // Samples share the (cached) field data
+        sampleValues[sample] = fieldData;
+      }
+    }
+    return true;
+  }
+  std::cerr << "ERROR: Field " << field << " not found in " << directory
+            << std::endl;
+  return false;
+}
+
+void DataPool::registerFieldReader(std::string fileType,
+                                   std::shared_ptr<FieldReader> reader,
+                                   std::vector<std::string> extensions,
+                                   std::vector<std::string> signatures) {
+  std::unique_lock<std::mutex> lk(mFieldReadersLock);
+  mFieldReaders[fileType] = reader;
+  for (auto extension : extensions) {
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   ::tolower);
+    mFileTypeExtensions[extension] = fileType;
+  }
+  for (auto &signature : signatures) {
+    mFileTypeSignatures.push_back({signature, fileType});
+  }
+}
+
+void DataPool::registerDefaultFieldReaders() {
+  registerFieldReader("json", std::make_shared<JsonFieldReader>(), {".json"});
+  registerFieldReader("csv", std::make_shared<CsvFieldReader>(), {".csv"});
+  registerFieldReader("tincarr", std::make_shared<BinaryArrayFieldReader>(),
+                      {".tincarr"}, {std::string("TINCARR\0", 8)});
+#ifdef TINC_HAS_NETCDF
+  registerFieldReader("netcdf", std::make_shared<NetCDFFieldReader>(),
+                      {".nc", ".nc4"},
+                      {"CDF\x01", "CDF\x02", "CDF\x05", "\x89HDF\r\n\x1a\n"});
+#endif
+}
+
+std::string DataPool::getFileType(std::string file) {
+  std::string extension;
+  auto dotPosition = file.find_last_of('.');
+  if (dotPosition != std::string::npos &&
+      file.find_first_of("/\\", dotPosition) == std::string::npos) {
+    extension = file.substr(dotPosition);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   ::tolower);
+  }
+  size_t longestSignature = 0;
+  {
+    std::unique_lock<std::mutex> lk(mFieldReadersLock);
+    auto type = mFileTypeExtensions.find(extension);
+    if (type != mFileTypeExtensions.end()) {
+      return type->second;
+    }
+    for (auto &signature : mFileTypeSignatures) {
+      longestSignature = std::max(longestSignature, signature.first.size());
+    }
+  }
+  // Unknown extension. Check the first bytes of the file.
+  std::string header(longestSignature, '\0');
+  std::ifstream f(file, std::ios::binary);
+  if (!f.read(&header[0], header.size())) {
+    header.resize(f.gcount());
+  }
+  std::unique_lock<std::mutex> lk(mFieldReadersLock);
+  for (auto &signature : mFileTypeSignatures) {
+    if (header.compare(0, signature.first.size(), signature.first) == 0) {
+      return signature.second;
+    }
+  }
+  return std::string();
+}
+
+std::shared_ptr<FieldReader>
+DataPool::getFieldReader(const std::string &file) {
+  auto fileType = getFileType(file);
+  if (fileType.empty()) {
+    // Data files were JSON before other readers existed, so files of unknown
+    // type such as "results.txt" are still read as JSON.
+    fileType = "json";
+  }
+  std::unique_lock<std::mutex> lk(mFieldReadersLock);
+  auto reader = mFieldReaders.find(fileType);
+  if (reader == mFieldReaders.end()) {
+    std::cerr << "ERROR: No reader for file type of " << file << std::endl;
+    return nullptr;
+  }
+  return reader->second;
 }
 
 std::vector<std::string> DataPool::getCurrentFiles() {
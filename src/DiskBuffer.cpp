@@ -1,7 +1,86 @@
 #include "tinc/DiskBuffer.hpp"
 
+#include "FileStamp.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
 using namespace tinc;
 
+std::string DiskBufferAbstract::temporaryFileName(std::string fileName) {
+  static std::atomic<uint64_t> counter{0};
+  std::string directory;
+  std::string name = fileName;
+  auto pos = fileName.find_last_of("/\\");
+  if (pos != std::string::npos) {
+    directory = fileName.substr(0, pos + 1);
+    name = fileName.substr(pos + 1);
+  }
+  auto stamp =
+      std::chrono::steady_clock::now().time_since_epoch().count() + counter++;
+  return directory + ".tinc_tmp_" + std::to_string(stamp) + "_" + name;
+}
+
+DiskBufferAbstract::FileStamp
+DiskBufferAbstract::fileStamp(const std::string &fileName) {
+  FileStamp stamp;
+  int64_t size;
+  if (tinc::fileStamp(fileName, stamp.modified, size, &stamp.inode)) {
+    stamp.size = size;
+    stamp.valid = true;
+  }
+  return stamp;
+}
+
+bool DiskBufferAbstract::isOwnWrite(std::string fileName) {
+  auto stamp = fileStamp(fileName);
+  std::unique_lock<std::mutex> lk(mOwnWriteLock);
+  return stamp.valid && mOwnWriteStamp.valid && fileName == mOwnWriteName &&
+         stamp.inode == mOwnWriteStamp.inode &&
+         stamp.size == mOwnWriteStamp.size &&
+         stamp.modified == mOwnWriteStamp.modified;
+}
+
+bool DiskBufferAbstract::publishTemporaryFile(std::string tempFileName,
+                                              std::string fileName) {
+  // The stamp is taken before the rename, which keeps it, so a file written
+  // by others right after the rename is not mistaken for this write.
+  auto stamp = fileStamp(tempFileName);
+#ifdef AL_WINDOWS
+  // rename() fails on Windows if the destination exists
+  std::remove(fileName.c_str());
+#endif
+  if (std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+    std::cerr << "ERROR replacing " << fileName << ": " << std::strerror(errno)
+              << std::endl;
+    std::remove(tempFileName.c_str());
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(mOwnWriteLock);
+  mOwnWriteName = fileName;
+  mOwnWriteStamp = stamp;
+  return true;
+}
+
+bool DiskBufferAbstract::writeFileAtomically(std::string fileName,
+                                             const std::string &contents) {
+  auto tempFileName = temporaryFileName(fileName);
+  std::ofstream of(tempFileName, std::ofstream::out | std::ofstream::binary);
+  if (!of.good()) {
+    std::cerr << "ERROR creating file " << tempFileName << std::endl;
+    return false;
+  }
+  of.write(contents.data(), contents.size());
+  of.close();
+  if (!of.good()) {
+    std::cerr << "ERROR writing file " << tempFileName << std::endl;
+    std::remove(tempFileName.c_str());
+    return false;
+  }
+  return publishTemporaryFile(tempFileName, fileName);
+}
+
 // void AbstractDiskBuffer::exposeToNetwork(al::ParameterServer &p) {
 //  if (m_trigger) {
 //    std::cerr << "ERROR: already registered. Aborting." << std::endl;
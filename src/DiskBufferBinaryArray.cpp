@@ -0,0 +1,455 @@
+#include "tinc/DiskBufferBinaryArray.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace tinc;
+
+static const char TINC_ARRAY_MAGIC[8] = {'T', 'I', 'N', 'C',
+                                         'A', 'R', 'R', '\0'};
+static const size_t TINC_ARRAY_FIXED_HEADER_SIZE = 16;
+static const size_t TINC_ARRAY_ALIGNMENT = 64;
+
+static bool hostIsLittleEndian() {
+  const uint16_t value = 1;
+  return *reinterpret_cast<const uint8_t *>(&value) == 1;
+}
+
+template <class T> static T readLittleEndian(const uint8_t *bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    value |= uint64_t(bytes[i]) << (8 * i);
+  }
+  return (T)(typename std::make_unsigned<T>::type)value;
+}
+
+template <class T> static void appendLittleEndian(std::string &out, T value) {
+  uint64_t bits = (uint64_t)(typename std::make_unsigned<T>::type)value;
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out.push_back(char((bits >> (8 * i)) & 0xFF));
+  }
+}
+
+static bool checkedMultiply(uint64_t a, uint64_t b, uint64_t &result) {
+  if (a != 0 && b > UINT64_MAX / a) {
+    return false;
+  }
+  result = a * b;
+  return true;
+}
+
+static bool checkedAdd(uint64_t a, uint64_t b, uint64_t &result) {
+  if (b > UINT64_MAX - a) {
+    return false;
+  }
+  result = a + b;
+  return true;
+}
+
+// Number of elements in shape. Returns false on overflow.
+static bool checkedElementCount(const std::vector<uint64_t> &shape,
+                                uint64_t &count) {
+  count = 1;
+  for (auto len : shape) {
+    if (!checkedMultiply(count, len, count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Bytes from the first to the end of the last element. Returns false on
+// overflow.
+static bool checkedSpan(size_t elementSize, const std::vector<uint64_t> &shape,
+                        const std::vector<int64_t> &strides, uint64_t &span) {
+  span = elementSize;
+  for (size_t i = 0; i < shape.size(); i++) {
+    if (shape[i] == 0) {
+      span = 0;
+      return true;
+    }
+  }
+  for (size_t i = 0; i < shape.size(); i++) {
+    uint64_t extent;
+    if (!checkedMultiply(shape[i] - 1, (uint64_t)strides[i], extent) ||
+        !checkedAdd(span, extent, span)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reverse the bytes of every element. Used on big endian hosts only.
+static void swapElements(uint8_t *data, size_t byteSize, size_t elementSize) {
+  for (size_t i = 0; i + elementSize <= byteSize; i += elementSize) {
+    std::reverse(data + i, data + i + elementSize);
+  }
+}
+
+size_t BinaryArray::elementSize(Datatype type) {
+  switch (type) {
+  case INT8:
+  case UINT8:
+    return 1;
+  case INT16:
+  case UINT16:
+    return 2;
+  case INT32:
+  case UINT32:
+  case FLOAT32:
+    return 4;
+  case INT64:
+  case UINT64:
+  case FLOAT64:
+    return 8;
+  }
+  return 0;
+}
+
+void BinaryArray::allocate(Datatype type, std::vector<uint64_t> shape) {
+  uint64_t count, bytes;
+  if (!checkedElementCount(shape, count) ||
+      !checkedMultiply(count, elementSize(type), bytes) || bytes > SIZE_MAX) {
+    std::cerr << __FUNCTION__ << ": ERROR array size overflows" << std::endl;
+    shape = {0};
+  }
+  mDataType = type;
+  mShape = shape;
+  mStrides.resize(shape.size());
+  int64_t stride = elementSize(type);
+  for (size_t i = shape.size(); i > 0; i--) {
+    mStrides[i - 1] = stride;
+    stride *= shape[i - 1];
+  }
+  mDataOffset = 0;
+  mBytes.clear();
+  mBytes.resize(byteSize());
+}
+
+size_t BinaryArray::elementCount() const {
+  // allocate() and decode() reject shapes that overflow, so this only
+  // guards against shapes set some other way
+  uint64_t count;
+  if (!checkedElementCount(mShape, count) || count > SIZE_MAX) {
+    return 0;
+  }
+  return count;
+}
+
+size_t BinaryArray::byteSize() const {
+  uint64_t span;
+  if (!checkedSpan(elementSize(mDataType), mShape, mStrides, span) ||
+      span > SIZE_MAX) {
+    return 0;
+  }
+  return span;
+}
+
+bool BinaryArray::decodeHeader(const uint8_t *fileBytes, size_t fileSize,
+                               Datatype &type, std::vector<uint64_t> &shape,
+                               std::vector<int64_t> &strides,
+                               size_t &dataOffset) {
+  if (fileSize < TINC_ARRAY_FIXED_HEADER_SIZE ||
+      memcmp(fileBytes, TINC_ARRAY_MAGIC, 8) != 0) {
+    std::cerr << "ERROR: Not a TINC binary array" << std::endl;
+    return false;
+  }
+  const uint8_t *header = fileBytes;
+  if (header[8] != FORMAT_VERSION) {
+    std::cerr << "ERROR: Unsupported binary array version " << int(header[8])
+              << std::endl;
+    return false;
+  }
+  if (header[9] > FLOAT64) {
+    std::cerr << "ERROR: Unknown binary array data type " << int(header[9])
+              << std::endl;
+    return false;
+  }
+  if (header[10] != COMPRESSION_NONE) {
+    std::cerr << "ERROR: Unsupported binary array compression "
+              << int(header[10]) << std::endl;
+    return false;
+  }
+  size_t ndims = header[11];
+  dataOffset = readLittleEndian<uint32_t>(header + 12);
+  if (dataOffset < TINC_ARRAY_FIXED_HEADER_SIZE + 16 * ndims ||
+      dataOffset > fileSize) {
+    std::cerr << "ERROR: Invalid binary array header" << std::endl;
+    return false;
+  }
+  type = (Datatype)header[9];
+  shape.resize(ndims);
+  strides.resize(ndims);
+  for (size_t i = 0; i < ndims; i++) {
+    shape[i] = readLittleEndian<uint64_t>(header +
+                                          TINC_ARRAY_FIXED_HEADER_SIZE + 8 * i);
+    strides[i] = readLittleEndian<int64_t>(
+        header + TINC_ARRAY_FIXED_HEADER_SIZE + 8 * (ndims + i));
+    if (strides[i] < 0) {
+      std::cerr << "ERROR: Negative strides not supported in binary array"
+                << std::endl;
+      return false;
+    }
+  }
+  // A crafted header must not be able to wrap the size checks below
+  uint64_t count, bytes, span, end;
+  if (!checkedElementCount(shape, count) ||
+      !checkedMultiply(count, elementSize(type), bytes) || bytes > SIZE_MAX ||
+      !checkedSpan(elementSize(type), shape, strides, span) ||
+      !checkedAdd(dataOffset, span, end)) {
+    std::cerr << "ERROR: Binary array size overflows" << std::endl;
+    return false;
+  }
+  if (end > fileSize) {
+    std::cerr << "ERROR: Binary array file truncated" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool BinaryArray::decode(std::vector<uint8_t> &&fileBytes) {
+  Datatype dataType;
+  std::vector<uint64_t> shape;
+  std::vector<int64_t> strides;
+  size_t dataOffset;
+  if (!decodeHeader(fileBytes.data(), fileBytes.size(), dataType, shape,
+                    strides, dataOffset)) {
+    return false;
+  }
+  mDataType = dataType;
+  mShape = shape;
+  mStrides = strides;
+  mBytes = std::move(fileBytes);
+  mDataOffset = dataOffset;
+  if (!hostIsLittleEndian()) {
+    swapElements(mBytes.data() + mDataOffset, byteSize(),
+                 elementSize(mDataType));
+  }
+  return true;
+}
+
+// Copy strided elements into contiguous row-major destination
+static void copyStrided(const uint8_t *source, std::vector<uint64_t> shape,
+                        std::vector<int64_t> strides, size_t elementSize,
+                        uint8_t *destination) {
+  size_t count = 1;
+  for (auto len : shape) {
+    count *= len;
+  }
+  std::vector<uint64_t> index(shape.size(), 0);
+  for (size_t i = 0; i < count; i++) {
+    int64_t offset = 0;
+    for (size_t d = 0; d < shape.size(); d++) {
+      offset += index[d] * strides[d];
+    }
+    memcpy(destination + i * elementSize, source + offset, elementSize);
+    for (size_t d = shape.size(); d > 0; d--) {
+      if (++index[d - 1] < shape[d - 1]) {
+        break;
+      }
+      index[d - 1] = 0;
+    }
+  }
+}
+
+bool BinaryArray::copyElements(size_t begin, size_t count,
+                               BinaryArray &destination) const {
+  if (mShape.size() == 0 || count > mShape[0] || begin > mShape[0] - count) {
+    return false;
+  }
+  auto shape = mShape;
+  shape[0] = count;
+  destination.allocate(mDataType, shape);
+  copyStrided(static_cast<const uint8_t *>(data()) + begin * mStrides[0], shape,
+              mStrides, elementSize(mDataType),
+              static_cast<uint8_t *>(destination.data()));
+  return true;
+}
+
+bool BinaryArray::decodeElements(const uint8_t *fileBytes, size_t fileSize,
+                                 size_t begin, size_t count) {
+  Datatype dataType;
+  std::vector<uint64_t> shape;
+  std::vector<int64_t> strides;
+  size_t dataOffset;
+  if (!decodeHeader(fileBytes, fileSize, dataType, shape, strides,
+                    dataOffset)) {
+    return false;
+  }
+  if (shape.size() == 0 || count > shape[0] || begin > shape[0] - count) {
+    return false;
+  }
+  shape[0] = count;
+  allocate(dataType, shape);
+  copyStrided(fileBytes + dataOffset + begin * strides[0], shape, strides,
+              elementSize(mDataType), mBytes.data());
+  if (!hostIsLittleEndian()) {
+    swapElements(mBytes.data(), byteSize(), elementSize(mDataType));
+  }
+  return true;
+}
+
+void BinaryArray::convertTo(Datatype type, void *destination) const {
+  switch (type) {
+  case INT8:
+    copyValues(static_cast<int8_t *>(destination));
+    break;
+  case UINT8:
+    copyValues(static_cast<uint8_t *>(destination));
+    break;
+  case INT16:
+    copyValues(static_cast<int16_t *>(destination));
+    break;
+  case UINT16:
+    copyValues(static_cast<uint16_t *>(destination));
+    break;
+  case INT32:
+    copyValues(static_cast<int32_t *>(destination));
+    break;
+  case UINT32:
+    copyValues(static_cast<uint32_t *>(destination));
+    break;
+  case INT64:
+    copyValues(static_cast<int64_t *>(destination));
+    break;
+  case UINT64:
+    copyValues(static_cast<uint64_t *>(destination));
+    break;
+  case FLOAT32:
+    copyValues(static_cast<float *>(destination));
+    break;
+  case FLOAT64:
+    copyValues(static_cast<double *>(destination));
+    break;
+  }
+}
+
+std::string BinaryArray::encode() const {
+  std::string out;
+  size_t ndims = mShape.size();
+  size_t dataOffset = TINC_ARRAY_FIXED_HEADER_SIZE + 16 * ndims;
+  dataOffset =
+      ((dataOffset + TINC_ARRAY_ALIGNMENT - 1) / TINC_ARRAY_ALIGNMENT) *
+      TINC_ARRAY_ALIGNMENT;
+  out.reserve(dataOffset + byteSize());
+  out.append(TINC_ARRAY_MAGIC, 8);
+  out.push_back(char(FORMAT_VERSION));
+  out.push_back(char(mDataType));
+  out.push_back(char(COMPRESSION_NONE));
+  out.push_back(char(ndims));
+  appendLittleEndian<uint32_t>(out, (uint32_t)dataOffset);
+  for (auto len : mShape) {
+    appendLittleEndian<uint64_t>(out, len);
+  }
+  for (auto stride : mStrides) {
+    appendLittleEndian<int64_t>(out, stride);
+  }
+  out.resize(dataOffset, '\0');
+  size_t start = out.size();
+  out.append((const char *)data(), byteSize());
+  if (!hostIsLittleEndian()) {
+    swapElements((uint8_t *)&out[start], byteSize(), elementSize(mDataType));
+  }
+  return out;
+}
+
+// Read complete file into memory. Uses a single pread() where available.
+static bool readWholeFile(std::string fileName, std::vector<uint8_t> &bytes) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR opening " << fileName << ": " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct stat s;
+  if (fstat(fd, &s) != 0) {
+    close(fd);
+    return false;
+  }
+  bytes.resize(s.st_size);
+  size_t done = 0;
+  while (done < bytes.size()) {
+    auto count = pread(fd, bytes.data() + done, bytes.size() - done, done);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      std::cerr << "ERROR reading " << fileName << std::endl;
+      close(fd);
+      return false;
+    }
+    done += count;
+  }
+  close(fd);
+  return true;
+#else
+  std::ifstream f(fileName, std::ios::binary | std::ios::ate);
+  if (!f.good()) {
+    std::cerr << "ERROR opening " << fileName << std::endl;
+    return false;
+  }
+  bytes.resize(f.tellg());
+  f.seekg(0);
+  f.read((char *)bytes.data(), bytes.size());
+  return f.good();
+#endif
+}
+
+bool DiskBufferBinaryArray::updateData(std::string filename) {
+  if (filename.size() > 0) {
+    m_fileName = filename;
+  }
+  bool ret = false;
+  std::vector<uint8_t> bytes;
+  if (readWholeFile(m_path + m_fileName, bytes)) {
+    auto buffer = getWritable();
+    ret = buffer->decode(std::move(bytes));
+    if (ret) {
+      BufferManager<BinaryArray>::doneWriting(buffer);
+    }
+  }
+  for (auto cb : mUpdateCallbacks) {
+    cb(ret);
+  }
+  return ret;
+}
+
+bool DiskBufferBinaryArray::writeArray(BinaryArray &&array,
+                                       std::string filename) {
+  if (filename.size() > 0) {
+    m_fileName = filename;
+  }
+  bool previousWritten = waitForPendingWrites();
+  auto data = publishData(std::move(array));
+  std::string fullName = m_path + m_fileName;
+  persistAsync([this, data, fullName]() {
+    if (!writeFileAtomically(fullName, data->encode())) {
+      std::cerr << "Error writing binary array file: " << fullName
+                << std::endl;
+      return false;
+    }
+    return true;
+  });
+  return previousWritten;
+}
+
+bool DiskBufferBinaryArray::parseFile(std::ifstream &file,
+                                      std::shared_ptr<BinaryArray> newData) {
+  std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+  return newData->decode(std::move(bytes));
+}
@@ -0,0 +1,290 @@
+#include "tinc/DiskBufferWatcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#if defined(AL_LINUX)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace tinc;
+
+// Split full path into directory (including trailing delimiter) and file name
+static void splitPath(const std::string &fullPath, std::string &directory,
+                      std::string &name) {
+  auto pos = fullPath.find_last_of('/');
+  if (pos == std::string::npos) {
+    directory = "";
+    name = fullPath;
+  } else {
+    directory = fullPath.substr(0, pos + 1);
+    name = fullPath.substr(pos + 1);
+  }
+}
+
+DiskBufferWatcher::DiskBufferWatcher(std::chrono::milliseconds debounceTime)
+    : mDebounceTime(debounceTime) {}
+
+DiskBufferWatcher::~DiskBufferWatcher() { stop(); }
+
+void DiskBufferWatcher::registerDiskBuffer(DiskBufferAbstract &db) {
+  {
+    std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+    if (std::find(mDiskBuffers.begin(), mDiskBuffers.end(), &db) !=
+        mDiskBuffers.end()) {
+      return;
+    }
+    mDiskBuffers.push_back(&db);
+  }
+  refresh();
+}
+
+void DiskBufferWatcher::unregisterDiskBuffer(DiskBufferAbstract &db) {
+  {
+    std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+    auto it = std::find(mDiskBuffers.begin(), mDiskBuffers.end(), &db);
+    if (it != mDiskBuffers.end()) {
+      mDiskBuffers.erase(it);
+    }
+    if (std::this_thread::get_id() != mWatcherThreadId) {
+      mUpdateDone.wait(lk, [&]() { return mUpdatingBuffer != &db; });
+    }
+  }
+  refresh();
+}
+
+bool DiskBufferWatcher::start() {
+#if defined(AL_LINUX)
+  if (mThread) {
+    return false;
+  }
+  mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mInotifyFd < 0) {
+    std::cerr << __FUNCTION__ << ": ERROR initializing inotify: "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mWakeLock);
+    if (pipe2(mWakeFd, O_NONBLOCK | O_CLOEXEC) != 0) {
+      std::cerr << __FUNCTION__ << ": ERROR creating pipe: "
+                << strerror(errno) << std::endl;
+      close(mInotifyFd);
+      mInotifyFd = -1;
+      return false;
+    }
+  }
+  mRunning = true;
+  mThread = std::make_unique<std::thread>([this]() { threadFunction(); });
+  return true;
+#else
+  std::cerr << __FUNCTION__
+            << ": ERROR DiskBufferWatcher is only supported on Linux"
+            << std::endl;
+  return false;
+#endif
+}
+
+void DiskBufferWatcher::stop() {
+  if (!mThread) {
+    return;
+  }
+  mRunning = false;
+  refresh(); // Wake up thread
+  mThread->join();
+  mThread = nullptr;
+  std::unique_lock<std::mutex> lk(mWakeLock);
+#if defined(AL_LINUX)
+  close(mInotifyFd);
+  close(mWakeFd[0]);
+  close(mWakeFd[1]);
+#endif
+  mInotifyFd = -1;
+  mWakeFd[0] = mWakeFd[1] = -1;
+  mWatches.clear();
+}
+
+void DiskBufferWatcher::refresh() {
+#if defined(AL_LINUX)
+  std::unique_lock<std::mutex> lk(mWakeLock);
+  if (mWakeFd[1] >= 0) {
+    char c = 0;
+    if (write(mWakeFd[1], &c, 1) < 0 && errno != EAGAIN) {
+      std::cerr << __FUNCTION__ << ": ERROR waking watcher thread" << std::endl;
+    }
+  }
+#endif
+}
+
+void DiskBufferWatcher::updateWatches() {
+#if defined(AL_LINUX)
+  std::set<std::string> directories;
+  {
+    std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+    for (auto *db : mDiskBuffers) {
+      std::string directory, name;
+      splitPath(db->getPath() + db->getCurrentFileName(), directory, name);
+      if (name.size() > 0) {
+        directories.insert(directory);
+      }
+    }
+  }
+  auto it = mWatches.begin();
+  while (it != mWatches.end()) {
+    if (directories.find(it->second) == directories.end()) {
+      inotify_rm_watch(mInotifyFd, it->first);
+      it = mWatches.erase(it);
+    } else {
+      directories.erase(it->second);
+      it++;
+    }
+  }
+  for (auto &directory : directories) {
+    std::string watchPath = directory.size() > 0 ? directory : ".";
+    int wd = inotify_add_watch(mInotifyFd, watchPath.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+      // Directory might not exist yet. Will be retried on next refresh.
+      std::cerr << __FUNCTION__ << ": Unable to watch " << watchPath << ": "
+                << strerror(errno) << std::endl;
+      continue;
+    }
+    mWatches[wd] = directory;
+  }
+#endif
+}
+
+void DiskBufferWatcher::threadFunction() {
+#if defined(AL_LINUX)
+  std::map<DiskBufferAbstract *, std::chrono::steady_clock::time_point>
+      pending;
+  {
+    std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+    mWatcherThreadId = std::this_thread::get_id();
+  }
+  updateWatches();
+
+  while (mRunning) {
+    int timeoutMs = -1;
+    auto now = std::chrono::steady_clock::now();
+    for (auto &p : pending) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           p.second - now)
+                           .count();
+      if (remaining < 0) {
+        remaining = 0;
+      }
+      if (timeoutMs < 0 || remaining < timeoutMs) {
+        timeoutMs = (int)remaining;
+      }
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = mInotifyFd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = mWakeFd[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (poll(fds, 2, timeoutMs) < 0 && errno != EINTR) {
+      std::cerr << __FUNCTION__ << ": ERROR polling: " << strerror(errno)
+                << std::endl;
+      break;
+    }
+    if (!mRunning) {
+      break;
+    }
+    bool needsWatchUpdate = false;
+    if (fds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(mWakeFd[0], drain, sizeof(drain)) > 0) {
+      }
+      needsWatchUpdate = true;
+    }
+    if (fds[0].revents & POLLIN) {
+      alignas(struct inotify_event) char buffer[4096];
+      ssize_t len;
+      auto deadline = std::chrono::steady_clock::now() + mDebounceTime.load();
+      while ((len = read(mInotifyFd, buffer, sizeof(buffer))) > 0) {
+        const struct inotify_event *event;
+        for (char *ptr = buffer; ptr < buffer + len;
+             ptr += sizeof(struct inotify_event) + event->len) {
+          event = (const struct inotify_event *)ptr;
+          if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost. Reload everything
+            std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+            for (auto *db : mDiskBuffers) {
+              pending[db] = deadline;
+            }
+            continue;
+          }
+          auto watch = mWatches.find(event->wd);
+          if (watch == mWatches.end()) {
+            continue;
+          }
+          if (event->mask & IN_IGNORED) {
+            // Directory was removed
+            mWatches.erase(watch);
+            continue;
+          }
+          if (event->len == 0) {
+            continue;
+          }
+          std::string changedFile = watch->second + event->name;
+          std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+          for (auto *db : mDiskBuffers) {
+            // Files written through the buffer are already loaded
+            if (db->getPath() + db->getCurrentFileName() == changedFile &&
+                !db->isOwnWrite(changedFile)) {
+              pending[db] = deadline;
+            }
+          }
+        }
+      }
+      needsWatchUpdate = true;
+    }
+    if (needsWatchUpdate) {
+      updateWatches();
+    }
+
+    now = std::chrono::steady_clock::now();
+    std::vector<DiskBufferAbstract *> due;
+    auto it = pending.begin();
+    while (it != pending.end()) {
+      if (it->second <= now) {
+        due.push_back(it->first);
+        it = pending.erase(it);
+      } else {
+        it++;
+      }
+    }
+    // Update callbacks run without the lock, so they can register and
+    // unregister buffers. Unregistering waits for mUpdatingBuffer.
+    for (auto *db : due) {
+      {
+        std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+        // Buffer might have been unregistered while waiting
+        if (std::find(mDiskBuffers.begin(), mDiskBuffers.end(), db) ==
+            mDiskBuffers.end()) {
+          continue;
+        }
+        mUpdatingBuffer = db;
+      }
+      db->updateData("");
+      {
+        std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+        mUpdatingBuffer = nullptr;
+      }
+      mUpdateDone.notify_all();
+    }
+  }
+  std::unique_lock<std::mutex> lk(mDiskBuffersLock);
+  mWatcherThreadId = std::thread::id();
+#endif
+}
@@ -0,0 +1,256 @@
+#include "tinc/Executor.hpp"
+#include "tinc/Tracer.hpp"
+
+#include <algorithm>
+
+using namespace tinc;
+
+// Worker the current thread belongs to, if any
+static thread_local Executor *currentExecutor = nullptr;
+static thread_local size_t currentWorker = 0;
+
+const size_t Executor::MAX_CONCURRENCY;
+
+Executor::Executor(size_t concurrency)
+    : mQueues(new TaskQueue[MAX_CONCURRENCY + 1]) {
+  setConcurrency(concurrency);
+}
+
+Executor::~Executor() {
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    mStop = true;
+  }
+  mWakeUp.notify_all();
+  for (auto &thread : mThreads) {
+    thread.join();
+  }
+}
+
+Executor &Executor::global() {
+  // Processors spend much of their time waiting for scripts and files, so
+  // some concurrency is useful even with few cores.
+  static Executor executor(std::max(std::thread::hardware_concurrency(), 4u));
+  return executor;
+}
+
+Executor &Executor::io() {
+  static Executor executor(std::max(std::thread::hardware_concurrency(), 4u));
+  return executor;
+}
+
+void Executor::setConcurrency(size_t concurrency) {
+  if (concurrency == 0) {
+    concurrency = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    startThreads(concurrency);
+  }
+  mWakeUp.notify_all();
+}
+
+void Executor::ensureConcurrency(size_t concurrency) {
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    if (concurrency <= mConcurrency) {
+      return;
+    }
+    startThreads(concurrency);
+  }
+  mWakeUp.notify_all();
+}
+
+void Executor::startThreads(size_t concurrency) {
+  concurrency = std::min(concurrency, MAX_CONCURRENCY);
+  mConcurrency = concurrency;
+  while (mThreads.size() < concurrency) {
+    size_t index = mThreads.size();
+    mThreads.emplace_back([this, index]() { workerFunction(index); });
+  }
+  mThreadCount = mThreads.size();
+}
+
+bool Executor::parallelFor(size_t count,
+                           const std::function<bool(size_t)> &function,
+                           size_t concurrency) {
+  if (concurrency == 0) {
+    concurrency = mConcurrency + 1;
+  } else if (concurrency > 1) {
+    ensureConcurrency(concurrency - 1);
+  }
+  size_t threadCount =
+      std::min<size_t>(std::max<size_t>(concurrency, 1), count);
+
+  // Helper tasks that start after the work is done return without touching
+  // function, so the caller only waits for helpers that are running.
+  struct State {
+    std::atomic<size_t> next{0};
+    std::atomic<bool> ok{true};
+    std::mutex lock;
+    std::condition_variable done;
+    size_t running{0};
+    bool finished{false};
+  };
+  auto state = std::make_shared<State>();
+  auto work = [state, count, &function]() {
+    size_t i;
+    while (state->ok && (i = state->next++) < count) {
+      if (!function(i)) {
+        state->ok = false;
+      }
+    }
+  };
+  for (size_t i = 1; i < threadCount; i++) {
+    post([state, work]() {
+      {
+        std::unique_lock<std::mutex> lk(state->lock);
+        if (state->finished) {
+          return;
+        }
+        state->running++;
+      }
+      work();
+      std::unique_lock<std::mutex> lk(state->lock);
+      state->running--;
+      state->done.notify_all();
+    });
+  }
+  work();
+  std::unique_lock<std::mutex> lk(state->lock);
+  state->finished = true;
+  state->done.wait(lk, [&]() { return state->running == 0; });
+  return state->ok;
+}
+
+bool Executor::runPendingTask() {
+  size_t queueIndex = currentExecutor == this ? currentWorker + 1 : 0;
+  Task task;
+  if (!takeTask(queueIndex, task)) {
+    return false;
+  }
+  runTask(task);
+  notifyTaskEvent();
+  return true;
+}
+
+void Executor::runTask(Task &task) {
+  // Tasks run nested in wait() must not change the sample of the waiting task
+  int64_t previousSample = Tracer::currentSample();
+  Tracer::setCurrentSample(task.traceSample);
+  task.function();
+  Tracer::setCurrentSample(previousSample);
+}
+
+void Executor::waitForTaskEvent(const std::function<bool()> &done) {
+  mTaskEventWaiters++;
+  // Pairs with the fence in notifyTaskEvent(), so either the waiter sees the
+  // finished task or the notifier sees the waiter.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    mTaskEvent.wait(lk, [&]() { return done() || mQueuedTasks > 0; });
+  }
+  mTaskEventWaiters--;
+}
+
+void Executor::notifyTaskEvent() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (mTaskEventWaiters > 0) {
+    {
+      std::unique_lock<std::mutex> lk(mSleepLock);
+    }
+    mTaskEvent.notify_all();
+  }
+}
+
+bool Executor::isWorkerThread() { return currentExecutor == this; }
+
+void Executor::post(std::function<void()> function) {
+  Task task{std::move(function), Tracer::currentSample()};
+  if (currentExecutor == this) {
+    // Newest first on the worker's own queue, so its data is still in cache
+    auto &queue = mQueues[currentWorker + 1];
+    std::unique_lock<std::mutex> lk(queue.lock);
+    queue.tasks.push_front(std::move(task));
+  } else {
+    auto &queue = mQueues[0];
+    std::unique_lock<std::mutex> lk(queue.lock);
+    queue.tasks.push_back(std::move(task));
+  }
+  mQueuedTasks++;
+  {
+    // Makes sure a worker about to sleep sees the new task
+    std::unique_lock<std::mutex> lk(mSleepLock);
+  }
+  if (mThreadCount > mConcurrency) {
+    // Idle workers above the concurrency can't take the task
+    mWakeUp.notify_all();
+  } else {
+    mWakeUp.notify_one();
+  }
+  if (mTaskEventWaiters > 0) {
+    mTaskEvent.notify_all();
+  }
+}
+
+bool Executor::takeTask(size_t queueIndex, Task &task) {
+  if (mQueuedTasks == 0) {
+    return false;
+  }
+  auto pop = [&](size_t index, bool front) {
+    auto &queue = mQueues[index];
+    std::unique_lock<std::mutex> lk(queue.lock);
+    if (queue.tasks.size() == 0) {
+      return false;
+    }
+    if (front) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    mQueuedTasks--;
+    return true;
+  };
+  if (queueIndex > 0 && pop(queueIndex, true)) {
+    return true;
+  }
+  if (pop(0, true)) {
+    return true;
+  }
+  // Steal oldest task from other workers
+  size_t threadCount = mThreadCount;
+  for (size_t i = 1; i <= threadCount; i++) {
+    size_t index = (queueIndex + i) % threadCount + 1;
+    if (index != queueIndex && pop(index, false)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Executor::workerFunction(size_t index) {
+  currentExecutor = this;
+  currentWorker = index;
+  Task task;
+  while (true) {
+    if ((index < mConcurrency || mStop) && takeTask(index + 1, task)) {
+      runTask(task);
+      task.function = nullptr;
+      notifyTaskEvent();
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    if (mStop && mQueuedTasks == 0) {
+      return;
+    }
+    mWakeUp.wait(lk, [&]() {
+      return mStop || (index < mConcurrency && mQueuedTasks > 0);
+    });
+    if (mStop && mQueuedTasks == 0) {
+      return;
+    }
+  }
+}
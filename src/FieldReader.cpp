@@ -0,0 +1,389 @@
+#include "tinc/FieldReader.hpp"
+
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+#ifdef TINC_HAS_NETCDF
+#include <netcdf.h>
+#endif
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace tinc;
+
+bool FieldReader::readFieldElements(const std::string &file,
+                                    const std::string &field, size_t begin,
+                                    size_t count, BinaryArray &array) {
+  BinaryArray fieldArray;
+  if (!readField(file, field, fieldArray)) {
+    return false;
+  }
+  return fieldArray.copyElements(begin, count, array);
+}
+
+// JSON ------------------------------------------------------------------------
+
+static bool flattenJson(const json &value, const std::vector<uint64_t> &shape,
+                        size_t depth, double *&out) {
+  if (depth == shape.size()) {
+    if (!value.is_number()) {
+      return false;
+    }
+    *out++ = value.get<double>();
+    return true;
+  }
+  if (!value.is_array() || value.size() != shape[depth]) {
+    return false;
+  }
+  for (auto &element : value) {
+    if (!flattenJson(element, shape, depth + 1, out)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Convert number or rectangular nested arrays of numbers to an array
+static bool jsonToArray(const json &value, BinaryArray &array) {
+  std::vector<uint64_t> shape;
+  const json *element = &value;
+  while (element->is_array()) {
+    shape.push_back(element->size());
+    if (element->size() == 0) {
+      break;
+    }
+    element = &(*element)[0];
+  }
+  array.allocate(BinaryArray::FLOAT64, shape);
+  double *out = array.dataAs<double>();
+  return flattenJson(value, shape, 0, out);
+}
+
+static bool parseJsonFile(const std::string &file, json &j) {
+  std::ifstream f(file);
+  if (!f.good()) {
+    std::cerr << "ERROR reading file: " << file << std::endl;
+    return false;
+  }
+  j = json::parse(f, nullptr, false);
+  if (j.is_discarded() || !j.is_object()) {
+    std::cerr << "ERROR parsing file: " << file << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool JsonFieldReader::readField(const std::string &file,
+                                const std::string &field, BinaryArray &array) {
+  json j;
+  if (!parseJsonFile(file, j) || !j.contains(field)) {
+    return false;
+  }
+  if (!jsonToArray(j[field], array)) {
+    std::cerr << "ERROR: Field " << field << " in " << file
+              << " is not numeric" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool JsonFieldReader::readAllFields(
+    const std::string &file, std::map<std::string, BinaryArray> &fields) {
+  json j;
+  if (!parseJsonFile(file, j)) {
+    return false;
+  }
+  for (auto it = j.begin(); it != j.end(); it++) {
+    BinaryArray array;
+    if (jsonToArray(it.value(), array)) {
+      fields[it.key()] = std::move(array);
+    }
+  }
+  return true;
+}
+
+// CSV -------------------------------------------------------------------------
+
+static std::vector<std::string> splitCsvLine(const std::string &line,
+                                             char delimiter) {
+  std::vector<std::string> cells(1);
+  bool inQuotes = false;
+  for (auto c : line) {
+    if (c == '"') {
+      inQuotes = !inQuotes;
+    } else if (c == delimiter && !inQuotes) {
+      cells.emplace_back();
+    } else if (c != '\r') {
+      cells.back().push_back(c);
+    }
+  }
+  for (auto &cell : cells) {
+    auto begin = cell.find_first_not_of(" \t");
+    auto end = cell.find_last_not_of(" \t");
+    cell = begin == std::string::npos ? std::string()
+                                      : cell.substr(begin, end - begin + 1);
+  }
+  return cells;
+}
+
+bool CsvFieldReader::readField(const std::string &file,
+                               const std::string &field, BinaryArray &array) {
+  std::map<std::string, BinaryArray> fields;
+  if (!readAllFields(file, fields)) {
+    return false;
+  }
+  auto column = fields.find(field);
+  if (column == fields.end()) {
+    return false;
+  }
+  array = std::move(column->second);
+  return true;
+}
+
+bool CsvFieldReader::readAllFields(const std::string &file,
+                                   std::map<std::string, BinaryArray> &fields) {
+  std::ifstream f(file);
+  if (!f.good()) {
+    std::cerr << "ERROR reading file: " << file << std::endl;
+    return false;
+  }
+  std::string line;
+  if (!std::getline(f, line)) {
+    return false;
+  }
+  auto names = splitCsvLine(line, mDelimiter);
+  std::vector<std::vector<double>> columns(names.size());
+  std::vector<bool> isNumeric(names.size(), true);
+  while (std::getline(f, line)) {
+    if (line.size() == 0 || line == "\r") {
+      continue;
+    }
+    auto cells = splitCsvLine(line, mDelimiter);
+    for (size_t i = 0; i < names.size(); i++) {
+      double value = std::numeric_limits<double>::quiet_NaN();
+      if (i < cells.size() && cells[i].size() > 0) {
+        char *end;
+        value = strtod(cells[i].c_str(), &end);
+        if (*end != '\0') {
+          isNumeric[i] = false;
+        }
+      }
+      columns[i].push_back(value);
+    }
+  }
+  for (size_t i = 0; i < names.size(); i++) {
+    if (isNumeric[i] && names[i].size() > 0) {
+      BinaryArray array;
+      array.allocate(BinaryArray::FLOAT64, {columns[i].size()});
+      std::copy(columns[i].begin(), columns[i].end(), array.dataAs<double>());
+      fields[names[i]] = std::move(array);
+    }
+  }
+  return true;
+}
+
+// Binary array ----------------------------------------------------------------
+
+namespace {
+// Read only view of the complete contents of a file. Memory mapped where
+// available.
+class MappedFile {
+public:
+  MappedFile(const std::string &fileName) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat s;
+    if (fstat(fd, &s) == 0 && s.st_size > 0) {
+      void *mapped = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        mData = static_cast<const uint8_t *>(mapped);
+        mSize = s.st_size;
+      }
+    }
+    close(fd);
+#else
+    std::ifstream f(fileName, std::ios::binary | std::ios::ate);
+    if (!f.good()) {
+      return;
+    }
+    mBytes.resize(f.tellg());
+    f.seekg(0);
+    if (f.read((char *)mBytes.data(), mBytes.size())) {
+      mData = mBytes.data();
+      mSize = mBytes.size();
+    }
+#endif
+  }
+
+  ~MappedFile() {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+    if (mData) {
+      munmap((void *)mData, mSize);
+    }
+#endif
+  }
+
+  const uint8_t *data() { return mData; }
+  size_t size() { return mSize; }
+
+private:
+  const uint8_t *mData{nullptr};
+  size_t mSize{0};
+#if !(defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN))
+  std::vector<uint8_t> mBytes;
+#endif
+};
+} // namespace
+
+bool BinaryArrayFieldReader::readField(const std::string &file,
+                                       const std::string &field,
+                                       BinaryArray &array) {
+  MappedFile mapped(file);
+  if (!mapped.data()) {
+    std::cerr << "ERROR reading file: " << file << std::endl;
+    return false;
+  }
+  return array.decode(
+      std::vector<uint8_t>(mapped.data(), mapped.data() + mapped.size()));
+}
+
+bool BinaryArrayFieldReader::readFieldElements(const std::string &file,
+                                               const std::string &field,
+                                               size_t begin, size_t count,
+                                               BinaryArray &array) {
+  MappedFile mapped(file);
+  if (!mapped.data()) {
+    std::cerr << "ERROR reading file: " << file << std::endl;
+    return false;
+  }
+  return array.decodeElements(mapped.data(), mapped.size(), begin, count);
+}
+
+// NetCDF ----------------------------------------------------------------------
+
+#ifdef TINC_HAS_NETCDF
+static bool netCDFDataType(nc_type type, BinaryArray::Datatype &dataType) {
+  switch (type) {
+  case NC_BYTE:
+    dataType = BinaryArray::INT8;
+    return true;
+  case NC_UBYTE:
+    dataType = BinaryArray::UINT8;
+    return true;
+  case NC_SHORT:
+    dataType = BinaryArray::INT16;
+    return true;
+  case NC_USHORT:
+    dataType = BinaryArray::UINT16;
+    return true;
+  case NC_INT:
+    dataType = BinaryArray::INT32;
+    return true;
+  case NC_UINT:
+    dataType = BinaryArray::UINT32;
+    return true;
+  case NC_INT64:
+    dataType = BinaryArray::INT64;
+    return true;
+  case NC_UINT64:
+    dataType = BinaryArray::UINT64;
+    return true;
+  case NC_FLOAT:
+    dataType = BinaryArray::FLOAT32;
+    return true;
+  case NC_DOUBLE:
+    dataType = BinaryArray::FLOAT64;
+    return true;
+  }
+  return false;
+}
+
+// Read variable. If count is 0, the complete variable is read, otherwise only
+// the range [begin, begin + count) along the first dimension.
+static bool readNetCDFVariable(const std::string &file,
+                               const std::string &field, size_t begin,
+                               size_t count, BinaryArray &array) {
+  int retval, ncid, varid, ndims;
+  nc_type type;
+  int dimids[NC_MAX_VAR_DIMS];
+  if ((retval = nc_open(file.c_str(), NC_NOWRITE, &ncid))) {
+    std::cerr << "ERROR opening file: " << file << ": " << nc_strerror(retval)
+              << std::endl;
+    return false;
+  }
+  if (nc_inq_varid(ncid, field.c_str(), &varid) ||
+      nc_inq_var(ncid, varid, nullptr, &type, &ndims, dimids, nullptr)) {
+    nc_close(ncid);
+    return false;
+  }
+  BinaryArray::Datatype dataType;
+  if (!netCDFDataType(type, dataType)) {
+    std::cerr << "ERROR: Unsupported type for variable " << field << " in "
+              << file << std::endl;
+    nc_close(ncid);
+    return false;
+  }
+  std::vector<size_t> start(ndims, 0);
+  std::vector<size_t> counts(ndims);
+  for (int i = 0; i < ndims; i++) {
+    if ((retval = nc_inq_dimlen(ncid, dimids[i], &counts[i]))) {
+      nc_close(ncid);
+      return false;
+    }
+  }
+  if (count > 0) {
+    if (ndims == 0 || begin + count > counts[0]) {
+      std::cerr << "ERROR: Index " << begin + count - 1
+                << " out of range for variable " << field << " in " << file
+                << std::endl;
+      nc_close(ncid);
+      return false;
+    }
+    start[0] = begin;
+    counts[0] = count;
+  }
+  array.allocate(dataType, std::vector<uint64_t>(counts.begin(), counts.end()));
+  if (count > 0) {
+    retval =
+        nc_get_vara(ncid, varid, start.data(), counts.data(), array.data());
+  } else {
+    retval = nc_get_var(ncid, varid, array.data());
+  }
+  nc_close(ncid);
+  if (retval) {
+    std::cerr << "ERROR reading variable " << field << " in " << file << ": "
+              << nc_strerror(retval) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool NetCDFFieldReader::readField(const std::string &file,
+                                  const std::string &field,
+                                  BinaryArray &array) {
+  return readNetCDFVariable(file, field, 0, 0, array);
+}
+
+bool NetCDFFieldReader::readFieldElements(const std::string &file,
+                                          const std::string &field,
+                                          size_t begin, size_t count,
+                                          BinaryArray &array) {
+  if (count == 0) {
+    return false;
+  }
+  return readNetCDFVariable(file, field, begin, count, array);
+}
+#endif
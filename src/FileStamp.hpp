@@ -0,0 +1,84 @@
+#ifndef FILESTAMP_HPP
+#define FILESTAMP_HPP
+
+/*
+ * Copyright 2020 AlloSphere Research Group
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ *        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * authors: Andres Cabrera
+*/
+
+// Internal helpers to detect changed files, shared by DataPool, DiskBuffer
+// and ProcessorGraph. Not installed.
+
+#include <cstdint>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace tinc {
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+// 64 bit FNV-1a hash of data, continuing from hash
+inline uint64_t fnv1a(const void *data, size_t size,
+                      uint64_t hash = FNV_OFFSET_BASIS) {
+  auto bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Modification time in nanoseconds, size and optionally inode of file.
+// Returns false if the file can't be accessed.
+inline bool fileStamp(const std::string &file, int64_t &modified,
+                      int64_t &size, uint64_t *inode = nullptr) {
+  struct stat s;
+  if (stat(file.c_str(), &s) != 0) {
+    return false;
+  }
+#if defined(AL_LINUX)
+  modified = int64_t(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+#elif defined(AL_OSX)
+  modified =
+      int64_t(s.st_mtimespec.tv_sec) * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+  modified = int64_t(s.st_mtime) * 1000000000;
+#endif
+  size = s.st_size;
+  if (inode) {
+    *inode = s.st_ino;
+  }
+  return true;
+}
+
+} // namespace tinc
+
+#endif // FILESTAMP_HPP
@@ -1,4 +1,6 @@
 #include "tinc/ParameterSpace.hpp"
+#include "tinc/Executor.hpp"
+#include "tinc/Tracer.hpp"
 
 #include "al/io/al_File.hpp"
 
@@ -16,6 +18,8 @@
 #include <ctime>
 #include <chrono>
 #include <iomanip>
+#include <set>
+#include <unordered_map>
 
 #include "picosha2.h" // SHA256 hash generator
 
@@ -151,6 +155,7 @@ ParameterSpace::getDimensions() {
 
 std::vector<std::string> ParameterSpace::runningPaths() {
   std::vector<std::string> paths;
+  std::set<std::string> uniquePaths;
 
   std::map<std::string, size_t> currentIndeces;
   for (auto dimension : mDimensions) {
@@ -163,8 +168,7 @@ std::vector<std::string> ParameterSpace::runningPaths() {
     done = true;
     auto path = al::File::conformPathToOS(mRootPath) +
                 generateRelativeRunPath(currentIndeces, this);
-    if (path.size() > 0 &&
-        std::find(paths.begin(), paths.end(), path) == paths.end()) {
+    if (path.size() > 0 && uniquePaths.insert(path).second) {
       paths.push_back(path);
     }
     done = incrementIndeces(currentIndeces);
@@ -273,8 +277,20 @@ void ParameterSpace::sweep(Processor &processor,
                            std::vector<std::string> dimensionNames_,
                            std::map<std::string, VariantValue> dependencies,
                            bool recompute) {
+  sweepCancellable(processor, dimensionNames_, dependencies, recompute,
+                   CancellationToken());
+}
+
+void ParameterSpace::sweepCancellable(
+    Processor &processor, std::vector<std::string> dimensionNames_,
+    std::map<std::string, VariantValue> dependencies, bool recompute,
+    CancellationToken token) {
   uint64_t sweepCount = 0;
   uint64_t sweepTotal = 1;
+  {
+    std::unique_lock<std::mutex> lk(mSweepLock);
+    mSweepToken = token;
+  }
   mSweepRunning = true;
   if (dimensionNames_.size() == 0) {
     dimensionNames_ = dimensionNames();
@@ -299,7 +315,10 @@ void ParameterSpace::sweep(Processor &processor,
     }
   }
 
-  while (mSweepRunning) {
+  int64_t previousSample = Tracer::currentSample();
+  while (mSweepRunning && !token.cancelled()) {
+    Tracer::setCurrentSample(sweepCount);
+    TraceScope sampleTrace("sample", mId);
     std::map<std::string, VariantValue> args;
     {
       std::unique_lock<std::mutex> lk(mDimensionsLock);
@@ -328,7 +347,12 @@ void ParameterSpace::sweep(Processor &processor,
       processor.setRunningDirectory(path);
     }
     sweepCount++;
-    if (!executeProcess(processor, recompute) && !processor.ignoreFail) {
+    bool ok = executeProcess(processor, recompute, token);
+    sampleTrace.end();
+    if (token.cancelled()) {
+      break;
+    }
+    if (!ok && !processor.ignoreFail) {
       std::cerr << "Processor failed in parameter sweep. Aborting" << std::endl;
       break;
     } else {
@@ -359,12 +383,123 @@ void ParameterSpace::sweep(Processor &processor,
     }
   }
   mSweepRunning = false;
+  Tracer::setCurrentSample(previousSample);
+}
+
+bool ParameterSpace::sweepBatch(
+    ProcessorCpp &processor, std::map<std::string, std::vector<double>> &outputs,
+    std::vector<std::string> dimensionNames_,
+    std::map<std::string, VariantValue> dependencies, size_t blockSize) {
+  CancellationToken token;
+  {
+    std::unique_lock<std::mutex> lk(mSweepLock);
+    mSweepToken = token;
+  }
+  if (dimensionNames_.size() == 0) {
+    dimensionNames_ = dimensionNames();
+  }
+  // Values of each swept dimension are looked up once
+  std::vector<std::vector<double>> dimensionValues;
+  size_t sampleCount = 1;
+  for (auto dimensionName : dimensionNames_) {
+    auto dim = getDimension(dimensionName);
+    if (!dim) {
+      std::cerr << __FUNCTION__
+                << " ERROR: dimension not found: " << dimensionName
+                << std::endl;
+      return false;
+    }
+    std::vector<double> values(dim->size());
+    for (size_t i = 0; i < values.size(); i++) {
+      values[i] = dim->at(i);
+    }
+    sampleCount *= values.size();
+    dimensionValues.push_back(std::move(values));
+  }
+  {
+    std::unique_lock<std::mutex> lk(mDimensionsLock);
+    for (auto dim : mDimensions) {
+      if (std::find(dimensionNames_.begin(), dimensionNames_.end(),
+                    dim->getName()) != dimensionNames_.end()) {
+        continue;
+      }
+      if (dim->mRepresentationType == ParameterSpaceDimension::VALUE) {
+        processor.configuration[dim->getName()] = dim->getCurrentValue();
+      } else if (dim->mRepresentationType == ParameterSpaceDimension::ID) {
+        processor.configuration[dim->getName()] = dim->getCurrentId();
+      } else if (dim->mRepresentationType == ParameterSpaceDimension::INDEX) {
+        assert(dim->getCurrentIndex() < std::numeric_limits<int64_t>::max());
+        processor.configuration[dim->getName()] =
+            (int64_t)dim->getCurrentIndex();
+      }
+    }
+  }
+  for (auto &dep : dependencies) {
+    processor.configuration[dep.first] = dep.second;
+  }
+  for (auto &output : outputs) {
+    output.second.resize(sampleCount);
+  }
+
+  blockSize = std::max(blockSize, size_t(1));
+  size_t dimensionCount = dimensionNames_.size();
+  std::vector<std::vector<double>> inputColumns(
+      dimensionCount, std::vector<double>(blockSize));
+  std::vector<std::vector<uint64_t>> indexColumns(
+      dimensionCount, std::vector<uint64_t>(blockSize));
+  ProcessorCpp::SampleBlock block;
+  for (size_t d = 0; d < dimensionCount; d++) {
+    block.inputs[dimensionNames_[d]] = inputColumns[d].data();
+    block.indeces[dimensionNames_[d]] = indexColumns[d].data();
+  }
+
+  mSweepRunning = true;
+  auto cancelHandle =
+      token.registerCancelCallback([&processor]() { processor.cancel(); });
+  bool ret = true;
+  int64_t previousSample = Tracer::currentSample();
+  for (size_t offset = 0; offset < sampleCount && !token.cancelled();
+       offset += blockSize) {
+    block.size = std::min(blockSize, sampleCount - offset);
+    block.offset = offset;
+    // The first dimension changes fastest, as in sweep()
+    size_t stride = 1;
+    for (size_t d = 0; d < dimensionCount; d++) {
+      auto &values = dimensionValues[d];
+      for (size_t i = 0; i < block.size; i++) {
+        size_t index = ((offset + i) / stride) % values.size();
+        indexColumns[d][i] = index;
+        inputColumns[d][i] = values[index];
+      }
+      stride *= values.size();
+    }
+    for (auto &output : outputs) {
+      block.outputs[output.first] = output.second.data() + offset;
+    }
+    // Spans for the block are tagged with its first sample
+    Tracer::setCurrentSample(offset);
+    if (!processor.processBatch(block)) {
+      if (!token.cancelled()) {
+        std::cerr << "Processor failed in parameter sweep. Aborting"
+                  << std::endl;
+      }
+      ret = false;
+      break;
+    }
+    if (onSweepProcess) {
+      onSweepProcess((offset + block.size) / (double)sampleCount);
+    }
+  }
+  Tracer::setCurrentSample(previousSample);
+  token.removeCancelCallback(cancelHandle);
+  mSweepRunning = false;
+  return ret && !token.cancelled();
 }
 
 void ParameterSpace::sweepAsync(Processor &processor,
                                 std::vector<std::string> dimensions,
                                 bool recompute) {
-  if (mAsyncProcessingThread || mAsyncPSCopy) {
+  if (mAsyncSweep.valid() || mAsyncPSCopy) {
     stopSweep();
   }
   mAsyncPSCopy = std::make_shared<ParameterSpace>();
@@ -379,17 +514,98 @@ void ParameterSpace::sweepAsync(Processor &processor,
     mAsyncPSCopy->generateRelativeRunPath = generateRelativeRunPath;
     mAsyncPSCopy->mCurrentPathTemplate = mCurrentPathTemplate;
   }
-  mAsyncProcessingThread = std::make_unique<std::thread>([=, &processor]() {
-    mAsyncPSCopy->sweep(processor, dimensions, {}, recompute);
+  // The token is installed before the task is queued, so stopSweep() cancels
+  // the sweep even if it has not started yet.
+  CancellationToken token;
+  {
+    std::unique_lock<std::mutex> lk(mSweepLock);
+    mSweepToken = token;
+  }
+  auto sweepCopy = mAsyncPSCopy;
+  mAsyncSweep = Executor::global().submit([=, &processor]() {
+    sweepCopy->sweepCancellable(processor, dimensions, {}, recompute, token);
   });
 }
 
+static bool isPathDelimiter(char c) {
+#ifdef AL_WINDOWS
+  return c == '/' || c == '\\';
+#else
+  return c == '/';
+#endif
+}
+
+static std::string trimPathDelimiters(std::string path) {
+  while (path.size() > 1 && isPathDelimiter(path.back())) {
+    path.pop_back();
+  }
+  return path;
+}
+
 bool ParameterSpace::createDataDirectories() {
-  for (auto path : runningPaths()) {
-    if (!al::File::isDirectory(path)) {
-      if (!al::Dir::make(path)) {
-        return false;
+  // Group all directories and their parents by depth, so that each level can
+  // be created in parallel once the previous level exists.
+  std::vector<std::vector<std::string>> levels;
+  // 0: not checked, 1: existed, 2: created by this function
+  std::unordered_map<std::string, int> state;
+  for (auto &path : runningPaths()) {
+    size_t depth = 0;
+    for (size_t i = 1; i <= path.size(); i++) {
+      if (i < path.size() && !isPathDelimiter(path[i])) {
+        continue;
+      }
+      if (isPathDelimiter(path[i - 1]) || path[i - 1] == ':') {
+        continue; // Filesystem root, drive or repeated delimiter
       }
+      auto directory = path.substr(0, i);
+      if (state.insert({directory, 0}).second) {
+        if (levels.size() <= depth) {
+          levels.resize(depth + 1);
+        }
+        levels[depth].push_back(directory);
+      }
+      depth++;
+    }
+  }
+
+  size_t total = state.size();
+  std::atomic<size_t> done{0};
+  std::mutex progressLock;
+  for (size_t level = 0; level < levels.size(); level++) {
+    auto &directories = levels[level];
+    // Entries are only modified in place while a level is processed, so the
+    // map can be read from all threads.
+    bool ok = Executor::io().parallelFor(
+        directories.size(),
+        [&](size_t i) {
+          auto &directory = directories[i];
+          size_t pos = directory.size() - 1;
+          while (pos > 0 && !isPathDelimiter(directory[pos])) {
+            pos--;
+          }
+          auto parentState = state.find(directory.substr(0, pos));
+          bool parentCreated =
+              parentState != state.end() && parentState->second == 2;
+          auto &directoryState = state.find(directory)->second;
+          if (!parentCreated && al::File::isDirectory(directory)) {
+            directoryState = 1;
+          } else if (al::Dir::make(directory)) {
+            directoryState = 2;
+          } else {
+            std::cerr << "ERROR creating directory: " << directory
+                      << std::endl;
+            return false;
+          }
+          size_t count = ++done;
+          if (onDataDirectoriesProgress) {
+            std::unique_lock<std::mutex> lk(progressLock);
+            onDataDirectoriesProgress(count / (double)total);
+          }
+          return true;
+        },
+        mFilesystemConcurrency);
+    if (!ok) {
+      return false;
     }
   }
   return true;
@@ -400,26 +616,65 @@ bool ParameterSpace::cleanDataDirectories() {
 }
 
 bool ParameterSpace::removeDataDirectories() {
-  for (auto path : runningPaths()) {
-    auto fullpath = getRootPath() + path;
-    if (al::File::isDirectory(fullpath)) {
-      if (!al::Dir::removeRecursively(fullpath)) {
-        return false;
+  // Only remove the top most directories, as contents are removed with them.
+  auto paths = runningPaths();
+  std::sort(paths.begin(), paths.end());
+  auto root = trimPathDelimiters(al::File::conformPathToOS(mRootPath));
+  std::set<std::string> removedPaths;
+  std::vector<std::string> topPaths;
+  for (auto &path : paths) {
+    // The root holds files that don't belong to any run path, so it is never
+    // removed. Running paths resolve to the root when there are no filesystem
+    // dimensions or the path template is empty.
+    if (trimPathDelimiters(path) == root) {
+      continue;
+    }
+    bool isContained = false;
+    for (size_t i = 1; i < path.size() && !isContained; i++) {
+      if (isPathDelimiter(path[i]) &&
+          removedPaths.find(path.substr(0, i)) != removedPaths.end()) {
+        isContained = true;
       }
     }
+    if (!isContained) {
+      removedPaths.insert(trimPathDelimiters(path));
+      topPaths.push_back(path);
+    }
   }
-  return true;
-  ;
+
+  std::atomic<size_t> done{0};
+  std::mutex progressLock;
+  return Executor::io().parallelFor(
+      topPaths.size(),
+      [&](size_t i) {
+        if (al::File::isDirectory(topPaths[i])) {
+          if (!al::Dir::removeRecursively(topPaths[i])) {
+            std::cerr << "ERROR removing directory: " << topPaths[i]
+                      << std::endl;
+            return false;
+          }
+        }
+        size_t count = ++done;
+        if (onDataDirectoriesProgress) {
+          std::unique_lock<std::mutex> lk(progressLock);
+          onDataDirectoriesProgress(count / (double)topPaths.size());
+        }
+        return true;
+      },
+      mFilesystemConcurrency);
 }
 
 void ParameterSpace::stopSweep() {
   mSweepRunning = false;
+  {
+    std::unique_lock<std::mutex> lk(mSweepLock);
+    mSweepToken.cancel();
+  }
   if (mAsyncPSCopy) {
     mAsyncPSCopy->stopSweep();
   }
-  if (mAsyncProcessingThread) {
-    mAsyncProcessingThread->join();
-    mAsyncProcessingThread = nullptr;
+  if (mAsyncSweep.valid()) {
+    Executor::global().wait(mAsyncSweep);
   }
   mAsyncPSCopy = nullptr;
 }
@@ -1214,7 +1469,8 @@ void ParameterSpace::updateParameterSpace(ParameterSpaceDimension *ps) {
   }
 }
 
-bool ParameterSpace::executeProcess(Processor &processor, bool recompute) {
+bool ParameterSpace::executeProcess(Processor &processor, bool recompute,
+                                    CancellationToken token) {
   std::time_t startTime =
       std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 
@@ -1222,6 +1478,7 @@ bool ParameterSpace::executeProcess(Processor &processor, bool recompute) {
 
   // TODO this is overriding args passed
   if (mCacheManager) {
+    TraceScope lookupTrace("cache lookup", processor);
     // Create sourceInfo section for cache entr
 
     entry.sourceInfo.type = al::demangle(typeid(processor).name());
@@ -1284,6 +1541,7 @@ bool ParameterSpace::executeProcess(Processor &processor, bool recompute) {
       entry.sourceInfo.arguments.push_back(arg);
     }
     auto cacheFiles = mCacheManager->findCache(entry.sourceInfo);
+    lookupTrace.end();
 
     // TODO caching is currently done by copying. There should also be an option
     // for in-place caching.
@@ -1294,6 +1552,7 @@ bool ParameterSpace::executeProcess(Processor &processor, bool recompute) {
         std::cout << "Warning processor output files and cache files mismatch"
                   << std::endl;
       } else {
+        TraceScope restoreTrace("cache restore", processor);
         for (size_t i = 0; i < cacheFiles.size(); i++) {
           if (!al::File::copy(
                   mCacheManager->cacheDirectory() + cacheFiles.at(i),
@@ -1316,9 +1575,11 @@ bool ParameterSpace::executeProcess(Processor &processor, bool recompute) {
     // Always recompute if not caching
     recompute = true;
   }
-  bool ret = processor.process(recompute);
+  bool ret = processor.processCancellable(recompute, token);
 
-  if (mCacheManager) {
+  // Outputs of cancelled runs are incomplete and are not cached
+  if (mCacheManager && !token.cancelled()) {
+    TraceScope storeTrace("cache store", processor);
     std::vector<std::string> cacheFilenames;
 
     for (auto filename : processor.getOutputFileNames()) {
@@ -0,0 +1,193 @@
+#include "tinc/PeriodicTask.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace tinc;
+
+struct PeriodicTask::State {
+  std::function<bool()> function;
+  std::atomic<int64_t> waitTime{10000}; // nanoseconds
+  std::atomic<int> mode{FIXED_RATE};
+  // Protected by the scheduler lock
+  bool running{false};
+  bool executing{false};
+  uint64_t generation{0};
+};
+
+namespace tinc {
+
+/**
+ * @brief Timer thread shared by all PeriodicTask objects
+ *
+ * Pending calls are kept in a heap ordered by deadline.
+ */
+class PeriodicTaskScheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  static std::shared_ptr<PeriodicTaskScheduler> instance() {
+    // Tasks keep the scheduler alive, so it can outlive this static
+    static std::shared_ptr<PeriodicTaskScheduler> scheduler =
+        std::make_shared<PeriodicTaskScheduler>();
+    return scheduler;
+  }
+
+  PeriodicTaskScheduler() : mThread([this]() { threadFunction(); }) {}
+
+  ~PeriodicTaskScheduler() {
+    {
+      std::unique_lock<std::mutex> lk(mLock);
+      mStop = true;
+    }
+    mWakeUp.notify_all();
+    if (std::this_thread::get_id() == mThread.get_id()) {
+      mThread.detach();
+    } else {
+      mThread.join();
+    }
+  }
+
+  bool start(std::shared_ptr<PeriodicTask::State> state,
+             std::function<bool()> func) {
+    std::unique_lock<std::mutex> lk(mLock);
+    if (state->running) {
+      return false;
+    }
+    state->running = true;
+    state->function = func;
+    state->generation++;
+    schedule({Clock::now(), state->generation, state});
+    return true;
+  }
+
+  void stop(std::shared_ptr<PeriodicTask::State> state) {
+    std::unique_lock<std::mutex> lk(mLock);
+    state->running = false;
+    state->generation++;
+    mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end(),
+                                [&](const Entry &entry) {
+                                  return entry.state == state;
+                                }),
+                 mQueue.end());
+    std::make_heap(mQueue.begin(), mQueue.end(), Later());
+    // Waiting from the function itself would never return
+    if (std::this_thread::get_id() != mThread.get_id()) {
+      mDone.wait(lk, [&]() { return !state->executing; });
+    }
+  }
+
+  bool running(std::shared_ptr<PeriodicTask::State> state) {
+    std::unique_lock<std::mutex> lk(mLock);
+    return state->running;
+  }
+
+private:
+  struct Entry {
+    Clock::time_point deadline;
+    uint64_t generation;
+    std::shared_ptr<PeriodicTask::State> state;
+  };
+
+  struct Later {
+    bool operator()(const Entry &a, const Entry &b) const {
+      return a.deadline > b.deadline;
+    }
+  };
+
+  // Requires mLock
+  void schedule(Entry entry) {
+    mQueue.push_back(entry);
+    std::push_heap(mQueue.begin(), mQueue.end(), Later());
+    mWakeUp.notify_one();
+  }
+
+  void threadFunction() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (!mStop) {
+      if (mQueue.size() == 0) {
+        mWakeUp.wait(lk);
+        continue;
+      }
+      auto deadline = mQueue.front().deadline;
+      if (Clock::now() < deadline) {
+        // Woken up early when a task is added or stopped
+        mWakeUp.wait_until(lk, deadline);
+        continue;
+      }
+      std::pop_heap(mQueue.begin(), mQueue.end(), Later());
+      auto entry = mQueue.back();
+      mQueue.pop_back();
+      auto state = entry.state;
+      if (!state->running || state->generation != entry.generation) {
+        continue;
+      }
+      // The function can be replaced by calling start() from the function
+      auto function = state->function;
+      state->executing = true;
+      lk.unlock();
+      bool keepRunning = function();
+      auto now = Clock::now();
+      lk.lock();
+      state->executing = false;
+      mDone.notify_all();
+      if (!keepRunning) {
+        state->running = false;
+      }
+      // The task might have been stopped or restarted by the function
+      if (!state->running || state->generation != entry.generation) {
+        continue;
+      }
+      auto waitTime = std::chrono::nanoseconds(state->waitTime.load());
+      if (state->mode == PeriodicTask::FIXED_DELAY ||
+          waitTime <= std::chrono::nanoseconds(0)) {
+        entry.deadline = now + waitTime;
+      } else {
+        // Skip deadlines that have already passed
+        auto elapsedPeriods = (now - entry.deadline) / waitTime;
+        entry.deadline += waitTime * (elapsedPeriods + 1);
+      }
+      schedule(entry);
+    }
+  }
+
+  std::mutex mLock;
+  std::condition_variable mWakeUp;
+  std::condition_variable mDone;
+  std::vector<Entry> mQueue; // Heap ordered by deadline
+  bool mStop{false};
+  std::thread mThread; // Must be initialized last
+};
+
+} // namespace tinc
+
+PeriodicTask::PeriodicTask()
+    : mState(std::make_shared<State>()),
+      mScheduler(PeriodicTaskScheduler::instance()) {}
+
+PeriodicTask::~PeriodicTask() { stop(); }
+
+bool PeriodicTask::start(std::function<bool()> func) {
+  return mScheduler->start(mState, func);
+}
+
+bool PeriodicTask::running() { return mScheduler->running(mState); }
+
+void PeriodicTask::stop() { mScheduler->stop(mState); }
+
+std::chrono::nanoseconds PeriodicTask::waitTime() const {
+  return std::chrono::nanoseconds(mState->waitTime.load());
+}
+
+void PeriodicTask::setWaitTime(std::chrono::nanoseconds waitTime) {
+  mState->waitTime = waitTime.count();
+}
+
+PeriodicTask::Mode PeriodicTask::mode() const {
+  return (Mode)mState->mode.load();
+}
+
+void PeriodicTask::setMode(Mode mode) { mState->mode = mode; }
@@ -48,6 +48,66 @@ PushDirectory::~PushDirectory() {
 
 // --------------------------------------------------
 
+bool Processor::processCancellable(bool forceRecompute,
+                                   CancellationToken token) {
+  // The token is installed for the calling thread only. A run nested on the
+  // same thread restores the outer run's token when done.
+  auto thread = std::this_thread::get_id();
+  bool nested = false;
+  CancellationToken outerToken;
+  {
+    std::unique_lock<std::mutex> lk(mCancellationLock);
+    auto runToken = mRunTokens.find(thread);
+    if (runToken != mRunTokens.end()) {
+      nested = true;
+      outerToken = runToken->second;
+    }
+    mRunTokens[thread] = token;
+  }
+  bool ret = process(forceRecompute) && !token.cancelled();
+  std::unique_lock<std::mutex> lk(mCancellationLock);
+  if (nested) {
+    mRunTokens[thread] = outerToken;
+  } else {
+    mRunTokens.erase(thread);
+  }
+  return ret;
+}
+
+void Processor::cancel() {
+  // Cancel callbacks are called outside the lock
+  std::vector<CancellationToken> tokens;
+  {
+    std::unique_lock<std::mutex> lk(mCancellationLock);
+    tokens.push_back(mCancellationToken);
+    for (auto &runToken : mRunTokens) {
+      tokens.push_back(runToken.second);
+    }
+  }
+  for (auto &token : tokens) {
+    token.cancel();
+  }
+}
+
+bool Processor::cancelled() { return cancellationToken().cancelled(); }
+
+CancellationToken Processor::cancellationToken() {
+  std::unique_lock<std::mutex> lk(mCancellationLock);
+  auto runToken = mRunTokens.find(std::this_thread::get_id());
+  if (runToken != mRunTokens.end()) {
+    return runToken->second;
+  }
+  return mCancellationToken;
+}
+
+void Processor::startCancellableRun() {
+  std::unique_lock<std::mutex> lk(mCancellationLock);
+  if (mRunTokens.find(std::this_thread::get_id()) == mRunTokens.end() &&
+      mCancellationToken.cancelled()) {
+    mCancellationToken = CancellationToken();
+  }
+}
+
 bool Processor::isRunning() {
   if (mProcessLock.try_lock()) {
     mProcessLock.unlock();
@@ -1,71 +1,52 @@
 #include "al/system/al_Time.hpp"
 
+#include "tinc/Executor.hpp"
 #include "tinc/ProcessorAsyncWrapper.hpp"
 
 #include <iostream>
-#include <thread>
 
 using namespace tinc;
 
-ProcessorAsyncWrapper::ProcessorAsyncWrapper(std::string id) : Processor(id) {
-  startThread();
-}
+ProcessorAsyncWrapper::ProcessorAsyncWrapper(std::string id) : Processor(id) {}
 
 ProcessorAsyncWrapper::ProcessorAsyncWrapper(Processor *processor)
-    : Processor(processor->getId()), mProcessor(processor) {
-  startThread();
-}
+    : Processor(processor ? processor->getId() : ""), mProcessor(processor) {}
 
-ProcessorAsyncWrapper::~ProcessorAsyncWrapper() {
-  mRunning = false;
-  mThread->join();
-}
+ProcessorAsyncWrapper::~ProcessorAsyncWrapper() { waitUntilDone(); }
 
 bool ProcessorAsyncWrapper::process(bool forceRecompute) {
-  {
-    std::unique_lock<std::mutex> lk(mLock);
-    //    std::cout << "start " << mProcessor->id << std::endl;
-    mRequestForce = forceRecompute;
-    //    std::cout << "notifying thread start " << mProcessor->id << std::endl;
-    mCondVariable.notify_one();
-  }
-  {
-    std::unique_lock<std::mutex> lk2(mStartLock);
-    mStartCondVariable.wait(lk2);
+  if (!mProcessor) {
+    std::cerr << __FUNCTION__ << ": ERROR no processor set for " << mId
+              << std::endl;
+    return false;
   }
+  // A processor can only run a single instance of its process() function
+  waitUntilDone();
+  startCancellableRun();
+  auto token = cancellationToken();
+  std::unique_lock<std::mutex> lk(mLock);
+  mResult = Executor::global().submit([this, forceRecompute, token]() {
+    bool ret = mProcessor->processCancellable(forceRecompute, token);
+    callDoneCallbacks(ret);
+    return ret;
+  });
   return true;
 }
 
 bool ProcessorAsyncWrapper::waitUntilDone() {
-  // As soon as we can acquire the lock, the thread is waiting
-  mLock.lock();
-  //  std::cout << "done " << mProcessor->id << std::endl;
-  mLock.unlock();
-  return mRetValue;
-}
-
-void ProcessorAsyncWrapper::startThread() {
-
-  mThread = std::make_unique<std::thread>([this]() {
+  std::future<bool> result;
+  {
     std::unique_lock<std::mutex> lk(mLock);
-    while (mRunning) {
-      mCondVariable.wait(lk);
-      {
-        std::unique_lock<std::mutex> lk(mStartLock);
-        mStartCondVariable.notify_one();
-      }
-      //      std::cout << "starting thread process " << mProcessor->id <<
-      //      std::endl;
-      if (mProcessor) {
-        mRetValue = mProcessor->process(mRequestForce);
-      } else {
-        mRetValue = this->process(mRequestForce);
-      }
-      callDoneCallbacks(mRetValue);
-      //      std::cout << "completed thread process " << mProcessor->id <<
-      //      std::endl;
+    if (!mResult.valid()) {
+      return mRetValue;
     }
-  });
+    result = std::move(mResult);
+  }
+  // Runs other tasks if waiting from a worker, e.g. in a nested graph
+  bool ret = Executor::global().wait(result);
+  std::unique_lock<std::mutex> lk(mLock);
+  mRetValue = ret;
+  return ret;
 }
 
 Processor *ProcessorAsyncWrapper::processor() const { return mProcessor; }
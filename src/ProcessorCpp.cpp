@@ -1,22 +1,64 @@
 #include "tinc/ProcessorCpp.hpp"
+#include "tinc/Tracer.hpp"
+
+#include <memory>
 
 using namespace tinc;
 
 ProcessorCpp::ProcessorCpp(std::string id) : Processor(id) {}
 
 bool ProcessorCpp::process(bool forceRecompute) {
+  startCancellableRun();
   callStartCallbacks();
-  PushDirectory dir(mRunningDirectory, mVerbose);
+  // Changing the working directory blocks other processors doing the same, so
+  // it is only done if needed.
+  std::unique_ptr<PushDirectory> dir;
+  if (mRunningDirectory.size() > 0) {
+    dir = std::make_unique<PushDirectory>(mRunningDirectory, mVerbose);
+  }
   if (!enabled) {
     return true;
   }
-  if (prepareFunction && !prepareFunction()) {
-    std::cerr << "ERROR preparing processor: " << mId << std::endl;
-    return false;
+  if (prepareFunction) {
+    TraceScope trace("prepare", mId);
+    if (!prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << mId << std::endl;
+      return false;
+    }
   }
   bool ret = true;
   if (forceRecompute) {
-    ret = processingFunction();
+    TraceScope trace("execute", mId);
+    ret = !cancelled() && processingFunction() && !cancelled();
+  } else {
+    skipComputation();
+  }
+  callDoneCallbacks(ret);
+  return ret;
+}
+
+bool ProcessorCpp::processBatch(SampleBlock &block) {
+  startCancellableRun();
+  callStartCallbacks();
+  if (!enabled) {
+    return true;
+  }
+  if (!batchProcessingFunction) {
+    std::cerr << __FUNCTION__ << ": ERROR no batchProcessingFunction set for "
+              << mId << std::endl;
+    return false;
+  }
+  if (prepareFunction) {
+    TraceScope trace("prepare", mId);
+    if (!prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << mId << std::endl;
+      return false;
+    }
+  }
+  bool ret;
+  {
+    TraceScope trace("execute", mId);
+    ret = !cancelled() && batchProcessingFunction(block) && !cancelled();
   }
   callDoneCallbacks(ret);
   return ret;
@@ -1,9 +1,48 @@
 #include "tinc/ProcessorGraph.hpp"
+#include "tinc/Executor.hpp"
+#include "tinc/Tracer.hpp"
 
+#include "FileStamp.hpp"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
 #include <iostream>
 
 using namespace tinc;
 
+// Files larger than this are compared by size and modification time only
+static const int64_t CONTENT_HASH_MAX_SIZE = 64 * 1024 * 1024;
+
+// Hash of file contents. Returns 0 if file is too large or can't be read
+static uint64_t contentHash(const std::string &file, int64_t size) {
+  if (size > CONTENT_HASH_MAX_SIZE) {
+    return 0;
+  }
+  std::ifstream f(file, std::ios::binary);
+  if (!f.good()) {
+    return 0;
+  }
+  uint64_t hash = FNV_OFFSET_BASIS;
+  char buffer[65536];
+  while (f.read(buffer, sizeof(buffer)) || f.gcount() > 0) {
+    hash = fnv1a(buffer, f.gcount(), hash);
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+// Content hashes of output files. 0 for missing or large files
+static std::vector<uint64_t> outputHashes(Processor *proc) {
+  std::vector<uint64_t> hashes;
+  for (auto &name : proc->getOutputFileNames()) {
+    auto path = proc->getOutputDirectory() + name;
+    int64_t modified, size;
+    hashes.push_back(fileStamp(path, modified, size) ? contentHash(path, size)
+                                                     : 0);
+  }
+  return hashes;
+}
+
 void ProcessorGraph::addProcessor(Processor &proc, bool connectFiles) {
   std::unique_lock<std::mutex> lk(mChainLock);
   switch (mType) {
@@ -14,6 +53,7 @@ void ProcessorGraph::addProcessor(Processor &proc, bool connectFiles) {
     mProcessors.push_back({mAsyncProcessesInternal.back(), false});
     break;
   case PROCESS_SERIAL:
+  case PROCESS_GRAPH:
     mProcessors.push_back({&proc, connectFiles});
     break;
   }
@@ -27,22 +67,30 @@ bool ProcessorGraph::process(bool forceRecompute) {
     return true;
   }
 
+  startCancellableRun();
+  auto token = cancellationToken();
   callStartCallbacks();
   std::unique_lock<std::mutex> lk2(mChainLock);
   std::unique_lock<std::mutex> lk(mProcessLock);
-  if (prepareFunction && !prepareFunction()) {
-    std::cerr << "ERROR preparing processor: " << mId << std::endl;
-    return false;
+  if (prepareFunction) {
+    TraceScope trace("prepare", mId);
+    if (!prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << mId << std::endl;
+      return false;
+    }
   }
   bool ret = true;
   bool thisRet = true;
+  mTimings.clear();
+  auto startTime = std::chrono::steady_clock::now();
   switch (mType) {
   case PROCESS_ASYNC:
     for (auto proc : mProcessors) {
       for (auto configEntry : configuration) {
         proc.first->configuration[configEntry.first] = configEntry.second;
       }
-      mResults[proc.first->getId()] = proc.first->process(forceRecompute);
+      mResults[proc.first->getId()] =
+          proc.first->processCancellable(forceRecompute, token);
     }
     for (auto proc : mProcessors) {
       thisRet = ((ProcessorAsyncWrapper *)proc.first)->waitUntilDone();
@@ -59,8 +107,20 @@ bool ProcessorGraph::process(bool forceRecompute) {
       for (auto configEntry : configuration) {
         proc.first->configuration[configEntry.first] = configEntry.second;
       }
-      thisRet = proc.first->process(forceRecompute);
+      auto &timing = mTimings[proc.first->getId()];
+      auto procStartTime = std::chrono::steady_clock::now();
+      thisRet = processNode(proc.first, mNodeStates[proc.first],
+                            forceRecompute, token, timing.skipped);
+      timing.start =
+          std::chrono::duration<double>(procStartTime - startTime).count();
+      timing.duration = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - procStartTime)
+                            .count();
       mResults[proc.first->getId()] = thisRet;
+      if (token.cancelled()) {
+        ret = false;
+        break;
+      }
       if (!proc.first->ignoreFail) {
         ret &= thisRet;
         if (!thisRet) {
@@ -69,11 +129,332 @@ bool ProcessorGraph::process(bool forceRecompute) {
       }
     }
     break;
+  case PROCESS_GRAPH:
+    ret = processGraph(forceRecompute, token);
+    break;
   }
+  ret = ret && !token.cancelled();
   callDoneCallbacks(ret);
   return ret;
 }
 
+bool ProcessorGraph::processGraph(bool forceRecompute,
+                                  CancellationToken token) {
+  auto startTime = std::chrono::steady_clock::now();
+  size_t count = mProcessors.size();
+  auto downstream = downstreamIndeces();
+  auto explicitDownstream = downstreamIndeces(true);
+  std::vector<size_t> pendingUpstream(count, 0);
+  for (auto &nodes : downstream) {
+    for (auto node : nodes) {
+      pendingUpstream[node]++;
+    }
+  }
+  std::deque<size_t> ready;
+  for (size_t i = 0; i < count; i++) {
+    if (pendingUpstream[i] == 0) {
+      ready.push_back(i);
+    }
+  }
+  {
+    // Check for cycles before running anything
+    auto pending = pendingUpstream;
+    std::deque<size_t> sorted = ready;
+    size_t sortedCount = 0;
+    while (sorted.size() > 0) {
+      auto node = sorted.front();
+      sorted.pop_front();
+      sortedCount++;
+      for (auto next : downstream[node]) {
+        if (--pending[next] == 0) {
+          sorted.push_back(next);
+        }
+      }
+    }
+    if (sortedCount != count) {
+      std::cerr << __FUNCTION__ << ": ERROR dependency cycle in graph "
+                << getId() << std::endl;
+      return false;
+    }
+  }
+
+  std::vector<NodeState *> states;
+  for (auto proc : mProcessors) {
+    for (auto configEntry : configuration) {
+      proc.first->configuration[configEntry.first] = configEntry.second;
+    }
+    states.push_back(&mNodeStates[proc.first]);
+    mTimings[proc.first->getId()] = ProcessorTiming();
+  }
+
+  // Ready nodes are run as tasks on the shared executor, up to
+  // mMaxConcurrency at a time. Finished nodes start their dependents. Node
+  // data is protected by lock
+  std::mutex lock;
+  std::deque<std::future<void>> tasks;
+  size_t running = 0;
+  size_t maxRunning = std::max(mMaxConcurrency, size_t(1));
+  bool ret = true;
+  std::vector<bool> upstreamFailed(count, false);
+  // Set when an upstream node added with addDependency() produced new results
+  std::vector<bool> upstreamChanged(count, false);
+
+  std::function<void(size_t)> runNode;
+  // Must be called with lock held
+  auto startReadyNodes = [&]() {
+    while (ready.size() > 0 && running < maxRunning) {
+      auto node = ready.front();
+      ready.pop_front();
+      running++;
+      tasks.push_back(
+          Executor::global().submit([&runNode, node]() { runNode(node); }));
+    }
+  };
+
+  runNode = [&](size_t node) {
+    std::unique_lock<std::mutex> lk(lock);
+    auto proc = mProcessors[node].first;
+    bool ok = !upstreamFailed[node] && !token.cancelled();
+    bool force = forceRecompute || upstreamChanged[node];
+    lk.unlock();
+
+    auto procStartTime = std::chrono::steady_clock::now();
+    bool skip = true;
+    bool outputsChanged = false;
+    if (ok) {
+      // Output files are only compared if a node depends on them
+      ok = processNode(proc, *states[node], force, token, skip,
+                       explicitDownstream[node].empty() ? nullptr
+                                                        : &outputsChanged);
+    }
+    auto procEndTime = std::chrono::steady_clock::now();
+
+    lk.lock();
+    auto &timing = mTimings[proc->getId()];
+    timing.start =
+        std::chrono::duration<double>(procStartTime - startTime).count();
+    timing.duration =
+        std::chrono::duration<double>(procEndTime - procStartTime).count();
+    timing.skipped = skip;
+    mResults[proc->getId()] = ok;
+    bool failed = !ok && (!proc->ignoreFail || token.cancelled());
+    if (failed) {
+      ret = false;
+    }
+    if (ok && outputsChanged) {
+      for (auto next : explicitDownstream[node]) {
+        upstreamChanged[next] = true;
+      }
+    }
+    for (auto next : downstream[node]) {
+      upstreamFailed[next] = upstreamFailed[next] || failed;
+      if (--pendingUpstream[next] == 0) {
+        ready.push_back(next);
+      }
+    }
+    running--;
+    startReadyNodes();
+  };
+
+  {
+    std::unique_lock<std::mutex> lk(lock);
+    startReadyNodes();
+  }
+  // Tasks queue the tasks they start before finishing, so all nodes have run
+  // once there are no tasks left to wait for.
+  while (true) {
+    std::future<void> task;
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      if (tasks.size() == 0) {
+        break;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    Executor::global().wait(task);
+  }
+  return ret;
+}
+
+std::vector<std::vector<size_t>>
+ProcessorGraph::downstreamIndeces(bool explicitOnly) {
+  std::vector<std::vector<size_t>> downstream(mProcessors.size());
+  std::map<Processor *, size_t> indeces;
+  for (size_t i = 0; i < mProcessors.size(); i++) {
+    indeces[mProcessors[i].first] = i;
+  }
+  auto addEdge = [&](size_t upstream, size_t node) {
+    if (upstream != node &&
+        std::find(downstream[upstream].begin(), downstream[upstream].end(),
+                  node) == downstream[upstream].end()) {
+      downstream[upstream].push_back(node);
+    }
+  };
+  for (auto &dependency : mDependencies) {
+    auto upstream = indeces.find(dependency.first);
+    auto node = indeces.find(dependency.second);
+    if (upstream != indeces.end() && node != indeces.end()) {
+      addEdge(upstream->second, node->second);
+    }
+  }
+  if (explicitOnly) {
+    return downstream;
+  }
+  std::map<std::string, std::vector<size_t>> producers;
+  for (size_t i = 0; i < mProcessors.size(); i++) {
+    if (mProcessors[i].second) {
+      auto proc = mProcessors[i].first;
+      for (auto &name : proc->getOutputFileNames()) {
+        producers[proc->getOutputDirectory() + name].push_back(i);
+      }
+    }
+  }
+  for (size_t i = 0; i < mProcessors.size(); i++) {
+    if (mProcessors[i].second) {
+      auto proc = mProcessors[i].first;
+      for (auto &name : proc->getInputFileNames()) {
+        auto producer = producers.find(proc->getInputDirectory() + name);
+        if (producer != producers.end()) {
+          for (auto upstream : producer->second) {
+            addEdge(upstream, i);
+          }
+        }
+      }
+    }
+  }
+  return downstream;
+}
+
+bool ProcessorGraph::processNode(Processor *proc, NodeState &state,
+                                 bool forceRecompute,
+                                 CancellationToken token, bool &skipped,
+                                 bool *outputsChanged) {
+  skipped = false;
+  auto hash = configurationHash(proc);
+  if (state.valid) {
+    bool outputsExist = proc->getOutputFileNames().size() > 0;
+    for (auto &name : proc->getOutputFileNames()) {
+      outputsExist &= al::File::exists(proc->getOutputDirectory() + name);
+    }
+    if (outputsExist && hash == state.configurationHash &&
+        !inputsChanged(proc, state)) {
+      if (!forceRecompute) {
+        if (mVerbose) {
+          std::cout << "Skipping up to date processor " << proc->getId()
+                    << std::endl;
+        }
+        skipped = true;
+        return true;
+      }
+    } else {
+      // Something changed since the processor last ran, so any caching done
+      // by the processor itself is not valid.
+      forceRecompute = true;
+    }
+  }
+  std::vector<uint64_t> previousOutputs;
+  if (outputsChanged && state.valid) {
+    previousOutputs = outputHashes(proc);
+  }
+  state.valid = false;
+  auto skippedRuns = proc->mSkippedRuns.load();
+  // Nodes are cancelled together with the graph
+  if (!proc->processCancellable(forceRecompute, token)) {
+    return false;
+  }
+  if (proc->mSkippedRuns != skippedRuns) {
+    // Processor didn't produce its outputs, so they can't be reused
+    return true;
+  }
+  if (outputsChanged) {
+    auto outputs = outputHashes(proc);
+    *outputsChanged = outputs.empty() || outputs != previousOutputs ||
+                      std::count(outputs.begin(), outputs.end(), 0u) > 0;
+  }
+  state.configurationHash = hash;
+  state.inputs.clear();
+  for (auto &name : proc->getInputFileNames()) {
+    InputFingerprint input;
+    input.path = proc->getInputDirectory() + name;
+    if (fileStamp(input.path, input.modified, input.size)) {
+      input.contentHash = contentHash(input.path, input.size);
+    }
+    state.inputs.push_back(input);
+  }
+  state.valid = true;
+  return true;
+}
+
+uint64_t ProcessorGraph::configurationHash(Processor *proc) {
+  std::vector<std::string> keys;
+  auto subset = mConfigurationKeys.find(proc);
+  if (subset != mConfigurationKeys.end()) {
+    keys = subset->second;
+    for (auto *param : proc->mParameters) {
+      keys.push_back(param->getName());
+    }
+  } else {
+    for (auto &entry : proc->configuration) {
+      keys.push_back(entry.first);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (auto &key : keys) {
+    hash = fnv1a(key.data(), key.size() + 1, hash);
+    auto entry = proc->configuration.find(key);
+    if (entry == proc->configuration.end()) {
+      continue;
+    }
+    auto &value = entry->second;
+    hash = fnv1a(&value.type, sizeof(value.type), hash);
+    switch (value.type) {
+    case VARIANT_INT64:
+    case VARIANT_INT32:
+      hash = fnv1a(&value.valueInt64, sizeof(value.valueInt64), hash);
+      break;
+    case VARIANT_DOUBLE:
+    case VARIANT_FLOAT:
+      hash = fnv1a(&value.valueDouble, sizeof(value.valueDouble), hash);
+      break;
+    case VARIANT_STRING:
+      hash = fnv1a(value.valueStr.data(), value.valueStr.size() + 1, hash);
+      break;
+    case VARIANT_NULL:
+      break;
+    }
+  }
+  return hash;
+}
+
+bool ProcessorGraph::inputsChanged(Processor *proc, NodeState &state) {
+  auto inputNames = proc->getInputFileNames();
+  if (inputNames.size() != state.inputs.size()) {
+    return true;
+  }
+  for (size_t i = 0; i < inputNames.size(); i++) {
+    auto &input = state.inputs[i];
+    int64_t modified, size;
+    if (input.path != proc->getInputDirectory() + inputNames[i] ||
+        !fileStamp(input.path, modified, size)) {
+      return true;
+    }
+    if (modified == input.modified && size == input.size) {
+      continue;
+    }
+    // File was rewritten, check if contents changed
+    if (size != input.size || input.contentHash == 0 ||
+        contentHash(input.path, size) != input.contentHash) {
+      return true;
+    }
+    input.modified = modified;
+  }
+  return false;
+}
+
 std::map<std::string, bool> ProcessorGraph::getResults() {
   std::unique_lock<std::mutex> lk2(mChainLock);
   return mResults;
@@ -84,6 +465,42 @@ ProcessorGraph &tinc::ProcessorGraph::operator<<(Processor &processor) {
   return *this;
 }
 
+void ProcessorGraph::addDependency(Processor &upstream, Processor &downstream) {
+  std::unique_lock<std::mutex> lk(mChainLock);
+  mDependencies.push_back({&upstream, &downstream});
+}
+
+std::vector<std::pair<Processor *, Processor *>>
+ProcessorGraph::getDependencies() {
+  std::unique_lock<std::mutex> lk(mChainLock);
+  std::vector<std::pair<Processor *, Processor *>> dependencies;
+  auto downstream = downstreamIndeces();
+  for (size_t i = 0; i < downstream.size(); i++) {
+    for (auto node : downstream[i]) {
+      dependencies.push_back(
+          {mProcessors[i].first, mProcessors[node].first});
+    }
+  }
+  return dependencies;
+}
+
+void ProcessorGraph::setConfigurationKeys(Processor &proc,
+                                          std::vector<std::string> keys) {
+  std::unique_lock<std::mutex> lk(mChainLock);
+  mConfigurationKeys[&proc] = keys;
+}
+
+void ProcessorGraph::setMaxConcurrency(size_t concurrency) {
+  std::unique_lock<std::mutex> lk(mChainLock);
+  mMaxConcurrency = std::max(concurrency, size_t(1));
+}
+
+std::map<std::string, ProcessorGraph::ProcessorTiming>
+ProcessorGraph::getTimings() {
+  std::unique_lock<std::mutex> lk2(mChainLock);
+  return mTimings;
+}
+
 std::vector<Processor *> ProcessorGraph::getProcessors() {
   std::vector<Processor *> procs;
   std::unique_lock<std::mutex> lk2(mChainLock);
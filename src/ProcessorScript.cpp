@@ -1,20 +1,28 @@
 
 #include "tinc/ProcessorScript.hpp"
+#include "tinc/Executor.hpp"
+#include "tinc/Subprocess.hpp"
+#include "tinc/Tracer.hpp"
 
 #include "nlohmann/json.hpp"
 
 #include <array>
 #include <atomic>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iomanip> // setprecision
 #include <iostream>
 #include <mutex>
+#include <sstream>
 #include <thread>
 #include <utility> // For pair
 
 #if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#ifdef AL_LINUX
+#include <sys/mman.h> // memfd_create
+#endif
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -33,6 +41,139 @@ using namespace tinc;
 
 constexpr auto DATASCRIPT_META_FORMAT_VERSION = 0;
 
+static std::string configFormatName(ProcessorScript::ConfigFormat format) {
+  switch (format) {
+  case ProcessorScript::CONFIG_MSGPACK:
+    return "msgpack";
+  case ProcessorScript::CONFIG_CBOR:
+    return "cbor";
+  case ProcessorScript::CONFIG_JSON:
+    break;
+  }
+  return "json";
+}
+
+static std::vector<uint8_t> encodeConfig(const nlohmann::json &config,
+                                         ProcessorScript::ConfigFormat format) {
+  switch (format) {
+  case ProcessorScript::CONFIG_MSGPACK:
+    return nlohmann::json::to_msgpack(config);
+  case ProcessorScript::CONFIG_CBOR:
+    return nlohmann::json::to_cbor(config);
+  case ProcessorScript::CONFIG_JSON:
+    break;
+  }
+  auto text = config.dump();
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static bool decodeConfig(const std::vector<uint8_t> &bytes,
+                         ProcessorScript::ConfigFormat format,
+                         nlohmann::json &config) {
+  try {
+    switch (format) {
+    case ProcessorScript::CONFIG_MSGPACK:
+      config = nlohmann::json::from_msgpack(bytes);
+      break;
+    case ProcessorScript::CONFIG_CBOR:
+      config = nlohmann::json::from_cbor(bytes);
+      break;
+    case ProcessorScript::CONFIG_JSON:
+      config = nlohmann::json::parse(bytes.begin(), bytes.end());
+      break;
+    }
+  } catch (std::exception &e) {
+    std::cerr << __FUNCTION__ << ": ERROR decoding "
+              << configFormatName(format) << " config: " << e.what()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Run by persistent interpreters. Requests and replies are objects in the
+// config format given as second argument, preceded by their size as
+// little-endian uint32. The script's own output is redirected to stderr, so
+// that it doesn't mix with replies.
+static const char *persistentInterpreterCode = R"PY(
+import json, os, struct, sys, traceback
+script = os.path.abspath(sys.argv[1])
+config_format = sys.argv[2]
+if config_format == 'msgpack':
+    import msgpack
+    loads, dumps = lambda data: msgpack.unpackb(data, raw=False), msgpack.packb
+elif config_format == 'cbor':
+    import cbor2
+    loads, dumps = cbor2.loads, cbor2.dumps
+else:
+    loads = lambda data: json.loads(data.decode())
+    dumps = lambda value: json.dumps(value).encode()
+requests = os.fdopen(os.dup(0), 'rb', 0)
+replies = os.fdopen(os.dup(1), 'wb', 0)
+os.dup2(os.open(os.devnull, os.O_RDONLY), 0)
+os.dup2(2, 1)
+sys.stdout = sys.stderr
+sys.path.insert(0, os.path.dirname(script))
+with open(script) as f:
+    code = compile(f.read(), script, 'exec')
+
+def read_exactly(size):
+    data = b''
+    while len(data) < size:
+        chunk = requests.read(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+while True:
+    header = read_exactly(4)
+    if header is None:
+        break
+    body = read_exactly(struct.unpack('<I', header)[0])
+    if body is None:
+        break
+    request = loads(body)
+    reply = {'ok': True}
+    memory_file = None
+    try:
+        os.chdir(request['working_directory'])
+        config_file = request['config_file']
+        if config_format == 'json':
+            with open(config_file, 'w') as f:
+                json.dump(request['config'], f, indent=4)
+        else:
+            if hasattr(os, 'memfd_create'):
+                memory_file = os.memfd_create('tinc_config')
+                config_file = '/proc/self/fd/%d' % memory_file
+            with open(config_file, 'wb') as f:
+                f.write(dumps(request['config']))
+        sys.argv = [script, config_file]
+        try:
+            exec(code, {'__name__': '__main__', '__file__': script})
+        except SystemExit as e:
+            reply['ok'] = e.code is None or e.code == 0
+        if config_format == 'json':
+            with open(config_file) as f:
+                reply['config'] = json.load(f)
+        else:
+            with open(config_file, 'rb') as f:
+                reply['config'] = loads(f.read())
+    except Exception:
+        traceback.print_exc()
+        reply['ok'] = False
+    if memory_file is not None:
+        os.close(memory_file)
+    sys.stderr.flush()
+    data = dumps(reply)
+    replies.write(struct.pack('<I', len(data)) + data)
+)PY";
+
+ProcessorScript::~ProcessorScript() {
+  // Queued runs are finished before exiting
+  waitForAsyncProcesses();
+}
+
 std::string ProcessorScript::scriptFile(bool fullPath) { return mScriptName; }
 
 std::string ProcessorScript::inputFile(bool fullPath, int index) {
@@ -61,12 +202,16 @@ std::string ProcessorScript::outputFile(bool fullPath, int index) {
 }
 
 bool ProcessorScript::process(bool forceRecompute) {
+  startCancellableRun();
   if (!enabled) {
     return true;
   }
-  if (prepareFunction && !prepareFunction()) {
-    std::cerr << "ERROR preparing processor: " << getId() << std::endl;
-    return false;
+  if (prepareFunction) {
+    TraceScope trace("prepare", mId);
+    if (!prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << getId() << std::endl;
+      return false;
+    }
   }
   if (mScriptName == "" || mScriptCommand == "") {
     std::cout << "ERROR: process() for '" << getId()
@@ -75,16 +220,154 @@ bool ProcessorScript::process(bool forceRecompute) {
   }
   callStartCallbacks();
   std::unique_lock<std::mutex> lk(mProcessingLock);
+  bool ok = runScript(forceRecompute);
+  callDoneCallbacks(ok);
+  return ok;
+}
 
-  auto jsonFilename = writeJsonConfig();
+std::future<bool>
+ProcessorScript::processAsync(bool forceRecompute,
+                              std::function<void(bool)> doneCallback) {
+  std::promise<bool> result;
+  startCancellableRun();
+  if (!enabled) {
+    result.set_value(true);
+    return result.get_future();
+  }
+  if (prepareFunction) {
+    TraceScope trace("prepare", mId);
+    if (!prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << getId() << std::endl;
+      result.set_value(false);
+      return result.get_future();
+    }
+  }
+  if (mScriptName == "" || mScriptCommand == "") {
+    std::cout << "ERROR: processAsync() for '" << getId()
+              << "' missing script name or script command." << std::endl;
+    result.set_value(false);
+    return result.get_future();
+  }
+
+  // Each run works on its own copy, so the json config file is unique
+  auto run = std::make_shared<ProcessorScript>(*this);
+  run->setId(getId());
+  run->configuration = configuration;
+  run->mInputFileNames = mInputFileNames;
+  run->mOutputFileNames = mOutputFileNames;
+  run->mVerbose = mVerbose;
+  run->mUseCache = mUseCache;
+  run->mUsePersistentInterpreter = mUsePersistentInterpreter;
+  run->mConfigFormat = mConfigFormat;
+  run->mWorkerPool = mWorkerPool;
+  parametersToConfig(run->mParameterValues);
+
+  auto token = cancellationToken();
+  auto task = std::make_shared<std::packaged_task<bool()>>(
+      [this, run, token, forceRecompute, doneCallback]() {
+        callStartCallbacks();
+        bool ok = run->processCancellable(forceRecompute, token);
+        callDoneCallbacks(ok);
+        if (doneCallback) {
+          doneCallback(ok);
+        }
+        return ok;
+      });
+  auto future = task->get_future();
+  std::unique_lock<std::mutex> lk(mAsyncQueueLock);
+  mAsyncQueue.push_back([task]() { (*task)(); });
+  startAsyncRuns();
+  return future;
+}
+
+void ProcessorScript::setMaxAsyncProcesses(int maxProcesses) {
+  // Lowering the maximum lets running scripts finish
+  std::unique_lock<std::mutex> lk(mAsyncQueueLock);
+  mMaxAsyncProcesses = std::max(maxProcesses, 1);
+  startAsyncRuns();
+}
+
+void ProcessorScript::waitForAsyncProcesses() {
+  std::unique_lock<std::mutex> lk(mAsyncQueueLock);
+  mAsyncDoneTrigger.wait(lk, [this]() {
+    return mAsyncQueue.empty() && mNumAsyncProcesses == 0;
+  });
+}
+
+void ProcessorScript::startAsyncRuns() {
+  while (!mAsyncQueue.empty() && mNumAsyncProcesses < mMaxAsyncProcesses) {
+    auto job = std::move(mAsyncQueue.front());
+    mAsyncQueue.pop_front();
+    mNumAsyncProcesses++;
+    Executor::global().submit([this, job]() {
+      job();
+      std::unique_lock<std::mutex> lk(mAsyncQueueLock);
+      mNumAsyncProcesses--;
+      startAsyncRuns();
+      mAsyncDoneTrigger.notify_all();
+    });
+  }
+}
+
+bool ProcessorScript::runScript(bool forceRecompute) {
+#ifndef AL_WINDOWS
+  if (mUsePersistentInterpreter) {
+    if (!needsRecompute() && !forceRecompute) {
+      if (mVerbose) {
+        std::cout << "No need to update cache according to " << metaFilename()
+                  << std::endl;
+      }
+      return true;
+    }
+    nlohmann::json config;
+    {
+      TraceScope trace("config write", mId);
+      config = makeJsonConfig();
+    }
+    bool ok;
+    {
+      TraceScope trace("execute", mId);
+      ok = runInWorker(config, configFilename());
+    }
+    if (!ok) {
+      return false;
+    }
+    writeMeta();
+    return applyJsonConfig(config);
+  }
+  if (mConfigFormat != CONFIG_JSON) {
+    if (!needsRecompute() && !forceRecompute) {
+      if (mVerbose) {
+        std::cout << "No need to update cache according to " << metaFilename()
+                  << std::endl;
+      }
+      return true;
+    }
+    auto config = makeJsonConfig();
+    if (!runWithBinaryConfig(config)) {
+      return false;
+    }
+    writeMeta();
+    return applyJsonConfig(config);
+  }
+#endif
+  std::string jsonFilename;
+  {
+    TraceScope trace("config write", mId);
+    jsonFilename = writeJsonConfig();
+  }
   if (jsonFilename.size() == 0) {
     return false;
   }
   bool ok = true;
   if (needsRecompute() || forceRecompute) {
-    std::string command =
-        mScriptCommand + " \"" + mScriptName + "\" \"" + jsonFilename + "\"";
-    ok = runCommand(command);
+    auto arguments = commandArguments();
+    arguments.push_back(mScriptName);
+    arguments.push_back(jsonFilename);
+    {
+      TraceScope trace("execute", mId);
+      ok = runCommand(arguments);
+    }
     if (ok) {
       writeMeta();
       readJsonConfig(jsonFilename);
@@ -96,7 +379,6 @@ bool ProcessorScript::process(bool forceRecompute) {
                 << std::endl;
     }
   }
-  callDoneCallbacks(ok);
   return ok;
 }
 
@@ -110,7 +392,216 @@ std::string ProcessorScript::sanitizeName(std::string output_name) {
 
 void ProcessorScript::useCache(bool use) { mUseCache = use; }
 
-std::string ProcessorScript::writeJsonConfig() {
+void ProcessorScript::usePersistentInterpreter(bool use) {
+  mUsePersistentInterpreter = use;
+  if (!use) {
+    std::unique_lock<std::mutex> lk(mWorkerPool->lock);
+    mWorkerPool->idleWorkers.clear();
+  }
+}
+
+std::string ProcessorScript::scriptPath() {
+  std::string path = mScriptName;
+  if (path.size() > 0 && path[0] != '/') {
+    path = mRunningDirectory + path;
+    if (path[0] != '/') {
+      path = al::File::currentPath() + path;
+    }
+  }
+  return path;
+}
+
+std::unique_ptr<ProcessorScript::ScriptWorker>
+ProcessorScript::acquireWorker() {
+  auto path = scriptPath();
+  auto scriptModified = modified(path.c_str());
+  {
+    std::unique_lock<std::mutex> lk(mWorkerPool->lock);
+    auto &idleWorkers = mWorkerPool->idleWorkers;
+    while (idleWorkers.size() > 0) {
+      auto worker = std::move(idleWorkers.back());
+      idleWorkers.pop_back();
+      // Workers that exited or run an outdated script are discarded
+      if (worker->process.running() && !worker->process.exited() &&
+          worker->command == mScriptCommand && worker->scriptPath == path &&
+          worker->scriptModified == scriptModified &&
+          worker->configFormat == mConfigFormat) {
+        return worker;
+      }
+    }
+  }
+  std::unique_ptr<ScriptWorker> worker(new ScriptWorker);
+  worker->command = mScriptCommand;
+  worker->scriptPath = path;
+  worker->scriptModified = scriptModified;
+  worker->configFormat = mConfigFormat;
+  auto arguments = commandArguments();
+  arguments.push_back("-c");
+  arguments.push_back(persistentInterpreterCode);
+  arguments.push_back(path);
+  arguments.push_back(configFormatName(mConfigFormat));
+  if (mVerbose) {
+    std::cout << "Starting interpreter for " << path << std::endl;
+  }
+  if (!worker->process.start(arguments, "", true)) {
+    return nullptr;
+  }
+  return worker;
+}
+
+bool ProcessorScript::runInWorker(nlohmann::json &config,
+                                  std::string configFilename) {
+  auto worker = acquireWorker();
+  if (!worker) {
+    return false;
+  }
+  // Terminating the interpreter stops the run. It is then discarded.
+  auto token = cancellationToken();
+  auto cancelHandle = token.registerCancelCallback(
+      [&worker]() { worker->process.terminate(); });
+  // The interpreter's working directory changes for every run
+  std::string workingDirectory = mRunningDirectory;
+  if (workingDirectory.size() == 0 || workingDirectory[0] != '/') {
+    workingDirectory = al::File::currentPath() + workingDirectory;
+  }
+  nlohmann::json request;
+  request["config"] = config;
+  request["config_file"] = configFilename;
+  request["working_directory"] = workingDirectory;
+  auto requestBytes = encodeConfig(request, mConfigFormat);
+  uint32_t size = requestBytes.size();
+  uint8_t header[4] = {uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16),
+                       uint8_t(size >> 24)};
+
+  std::vector<uint8_t> replyBytes;
+  std::string errorOutput;
+  bool received = worker->process.writeInput(header, 4) &&
+                  worker->process.writeInput(requestBytes.data(), size) &&
+                  worker->process.readOutput(header, 4, &errorOutput);
+  if (received) {
+    size = header[0] | (header[1] << 8) | (header[2] << 16) |
+           (uint32_t(header[3]) << 24);
+    replyBytes.resize(size);
+    received =
+        worker->process.readOutput(replyBytes.data(), size, &errorOutput);
+  }
+  token.removeCancelCallback(cancelHandle);
+  if (token.cancelled()) {
+    return false;
+  }
+  if (errorOutput.size() > 0) {
+    std::cerr << errorOutput << std::flush;
+  }
+  if (!received) {
+    std::cerr << __FUNCTION__ << ": ERROR interpreter for '" << getId()
+              << "' exited" << std::endl;
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mWorkerPool->lock);
+    mWorkerPool->idleWorkers.push_back(std::move(worker));
+  }
+
+  nlohmann::json reply;
+  if (!decodeConfig(replyBytes, mConfigFormat, reply)) {
+    return false;
+  }
+  if (mVerbose) {
+    std::cout << "Script result: " << reply["ok"] << std::endl;
+  }
+  if (!reply["ok"].is_boolean() || !reply["ok"].get<bool>()) {
+    return false;
+  }
+  config = reply["config"];
+  return true;
+}
+
+std::string ProcessorScript::jsonConfigFilename() {
+  return "_" + sanitizeName(mRunningDirectory) + std::to_string(long(this)) +
+         "_config.json";
+}
+
+std::string ProcessorScript::configFilename() {
+  auto filename = jsonConfigFilename();
+  if (mConfigFormat != CONFIG_JSON) {
+    filename = filename.substr(0, filename.size() - 4) +
+               configFormatName(mConfigFormat);
+  }
+  return filename;
+}
+
+std::vector<std::string> ProcessorScript::commandArguments() {
+  // The script command can include options, e.g. "python3 -u"
+  std::vector<std::string> arguments;
+  std::istringstream commandStream(mScriptCommand);
+  std::string argument;
+  while (commandStream >> argument) {
+    arguments.push_back(argument);
+  }
+  return arguments;
+}
+
+bool ProcessorScript::runWithBinaryConfig(nlohmann::json &config) {
+  TraceScope writeTrace("config write", mId);
+  auto bytes = encodeConfig(config, mConfigFormat);
+  auto arguments = commandArguments();
+  arguments.push_back(mScriptName);
+  bool ok = true;
+#ifdef AL_LINUX
+  // The child gets the memory file as descriptor 3
+  int fd = memfd_create("tinc_config", MFD_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << __FUNCTION__ << ": ERROR creating memory file: "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  for (size_t written = 0; ok && written < bytes.size();) {
+    auto count = write(fd, bytes.data() + written, bytes.size() - written);
+    ok = count > 0;
+    written += ok ? count : 0;
+  }
+  arguments.push_back("/dev/fd/3");
+  writeTrace.end();
+  {
+    TraceScope trace("execute", mId);
+    ok = ok && runCommand(arguments, {fd});
+  }
+  struct stat s;
+  if (ok && fstat(fd, &s) == 0) {
+    bytes.resize(s.st_size);
+    for (size_t done = 0; ok && done < bytes.size();) {
+      auto count = pread(fd, bytes.data() + done, bytes.size() - done, done);
+      ok = count > 0;
+      done += ok ? count : 0;
+    }
+  }
+  close(fd);
+#else
+  auto filename = configFilename();
+  {
+    std::ofstream f(mRunningDirectory + filename, std::ios::binary);
+    f.write((const char *)bytes.data(), bytes.size());
+    ok = f.good();
+  }
+  arguments.push_back(filename);
+  writeTrace.end();
+  {
+    TraceScope trace("execute", mId);
+    ok = ok && runCommand(arguments);
+  }
+  if (ok) {
+    std::ifstream f(mRunningDirectory + filename, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(f),
+                 std::istreambuf_iterator<char>());
+  }
+#endif
+  if (!ok) {
+    return false;
+  }
+  return decodeConfig(bytes, mConfigFormat, config);
+}
+
+nlohmann::json ProcessorScript::makeJsonConfig() {
   using json = nlohmann::json;
   json j;
 
@@ -136,15 +627,19 @@ std::string ProcessorScript::writeJsonConfig() {
       j[c.first] = c.second.valueDouble;
     }
   }
+  return j;
+}
 
-  std::string jsonFilename = "_" + sanitizeName(mRunningDirectory) +
-                             std::to_string(long(this)) + "_config.json";
+std::string ProcessorScript::writeJsonConfig() {
+  auto j = makeJsonConfig();
+  std::string jsonFilename = jsonConfigFilename();
   if (mVerbose) {
     std::cout << "Writing json config: " << jsonFilename << std::endl;
   }
   {
-    PushDirectory p(mRunningDirectory, mVerbose);
-    std::ofstream of(jsonFilename, std::ofstream::out);
+    // Paths are used instead of changing the working directory, so that
+    // concurrent runs don't block each other
+    std::ofstream of(mRunningDirectory + jsonFilename, std::ofstream::out);
     if (of.good()) {
       of << j.dump(4);
       of.close();
@@ -164,8 +659,7 @@ bool ProcessorScript::readJsonConfig(std::string filename) {
   using json = nlohmann::json;
   json j;
   {
-    PushDirectory p(mRunningDirectory, mVerbose);
-    std::ifstream f(filename);
+    std::ifstream f(mRunningDirectory + filename);
     if (!f.good()) {
       std::cerr << __FILE__
                 << "Error: can't open json config file: " << filename
@@ -175,6 +669,16 @@ bool ProcessorScript::readJsonConfig(std::string filename) {
 
     f >> j;
   }
+  if (!applyJsonConfig(j)) {
+    return false;
+  }
+  if (mVerbose) {
+    std::cout << "Read json config: " << filename << std::endl;
+  }
+  return true;
+}
+
+bool ProcessorScript::applyJsonConfig(nlohmann::json &j) {
   try {
     if (j["__tinc_metadata_version"].get<int>() ==
         DATASCRIPT_META_FORMAT_VERSION) {
@@ -193,13 +697,13 @@ bool ProcessorScript::readJsonConfig(std::string filename) {
               << std::endl;
     return false;
   }
-  if (mVerbose) {
-    std::cout << "Read json config: " << filename << std::endl;
-  }
   return true;
 }
 
 void ProcessorScript::parametersToConfig(nlohmann::json &j) {
+  if (mParameterValues.is_object()) {
+    j.update(mParameterValues);
+  }
 
   for (al::ParameterMeta *param : mParameters) {
     // TODO should we use full address or group + name?
@@ -241,15 +745,25 @@ std::string ProcessorScript::makeCommandLine() {
   return commandLine;
 }
 
-bool ProcessorScript::runCommand(const std::string &command) {
-  PushDirectory p(mRunningDirectory, mVerbose);
-
+bool ProcessorScript::runCommand(const std::vector<std::string> &arguments,
+                                 const std::vector<int> &inheritedFds) {
   if (mVerbose) {
-    std::cout << "ProcessorScript command: " << command << std::endl;
+    std::cout << "ProcessorScript command:";
+    for (auto &argument : arguments) {
+      std::cout << " " << argument;
+    }
+    std::cout << std::endl;
+  }
+#ifdef AL_WINDOWS
+  std::string command;
+  if (mRunningDirectory.size() > 0) {
+    command = "cd /d \"" + mRunningDirectory + "\" && ";
+  }
+  for (auto &argument : arguments) {
+    command += "\"" + argument + "\" ";
   }
   std::array<char, 128> buffer{0};
   std::string output;
-  // FIXME fork if running async
   FILE *pipe = popen(command.c_str(), "r");
   if (!pipe)
     throw std::runtime_error("popen() failed!");
@@ -263,13 +777,33 @@ bool ProcessorScript::runCommand(const std::string &command) {
   }
 
   int returnValue = 0;
-  // TODO: Put back return value checking. Currently crashing
-  //        int returnValue = -1;
   if (!ferror(pipe)) {
     returnValue = pclose(pipe);
   } else {
     returnValue = -1;
   }
+#else
+  // The script runs in its own working directory, without a shell and without
+  // changing the working directory of this process.
+  Subprocess process;
+  int returnValue = -1;
+  std::string output, errorOutput;
+  auto token = cancellationToken();
+  if (token.cancelled() ||
+      !process.start(arguments, mRunningDirectory, false, inheritedFds)) {
+    return false;
+  }
+  auto cancelHandle =
+      token.registerCancelCallback([&process]() { process.terminate(); });
+  bool waited = process.wait(returnValue, &output, &errorOutput);
+  token.removeCancelCallback(cancelHandle);
+  if (!waited || token.cancelled()) {
+    return false;
+  }
+  if (errorOutput.size() > 0) {
+    std::cerr << errorOutput << std::flush;
+  }
+#endif
 
   if (mVerbose) {
     std::cout << "Script result: " << returnValue << std::endl;
@@ -315,7 +849,8 @@ bool ProcessorScript::writeMeta() {
     std::cout << "Wrote cache in: " << metaFilename() << std::endl;
   }
   {
-    PushDirectory p(mRunningDirectory, mVerbose);
+    // Output directory is not relative to the running directory, and
+    // needsRecompute() reads the file from the same location.
     std::ofstream of(jsonFilename, std::ofstream::out);
     if (of.good()) {
       of << j.dump(4);
@@ -0,0 +1,436 @@
+#include "tinc/Subprocess.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// posix_spawn can set the child's working directory since glibc 2.29
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define TINC_SPAWN_CHDIR
+#endif
+#endif
+
+using namespace tinc;
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+// Pipes are not inherited by children, so that children started concurrently
+// don't keep each other's pipes open.
+static bool makePipe(int fds[2]) {
+#ifdef AL_LINUX
+  return pipe2(fds, O_CLOEXEC) == 0;
+#else
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
+}
+
+static void closeFds(int *fds, int count) {
+  for (int i = 0; i < count; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+}
+#endif
+
+Subprocess::~Subprocess() {
+  if (running()) {
+    terminate();
+    int exitCode;
+    wait(exitCode);
+  }
+  closePipes();
+}
+
+bool Subprocess::start(const std::vector<std::string> &arguments,
+                       std::string workingDirectory, bool pipeInput,
+                       const std::vector<int> &inheritedFds) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  if (running()) {
+    std::cerr << __FUNCTION__ << ": ERROR process already running"
+              << std::endl;
+    return false;
+  }
+  if (arguments.size() == 0) {
+    std::cerr << __FUNCTION__ << ": ERROR no program given" << std::endl;
+    return false;
+  }
+  closePipes();
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(const_cast<char *>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // Input uses a socket, so that writing to a child that has exited returns an
+  // error instead of raising SIGPIPE.
+  int inputPipe[2] = {-1, -1};
+  if (pipeInput) {
+#ifdef AL_LINUX
+    int result = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, inputPipe);
+#else
+    int result = socketpair(AF_UNIX, SOCK_STREAM, 0, inputPipe);
+    if (result == 0) {
+      fcntl(inputPipe[0], F_SETFD, FD_CLOEXEC);
+      fcntl(inputPipe[1], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+      int noSigPipe = 1;
+      setsockopt(inputPipe[1], SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe,
+                 sizeof(noSigPipe));
+#endif
+    }
+#endif
+    if (result != 0) {
+      std::cerr << __FUNCTION__ << ": ERROR creating socket: "
+                << strerror(errno) << std::endl;
+      return false;
+    }
+  }
+  int outputPipe[2], errorPipe[2];
+  if (!makePipe(outputPipe)) {
+    std::cerr << __FUNCTION__ << ": ERROR creating pipe: " << strerror(errno)
+              << std::endl;
+    closeFds(inputPipe, 2);
+    return false;
+  }
+  if (!makePipe(errorPipe)) {
+    std::cerr << __FUNCTION__ << ": ERROR creating pipe: " << strerror(errno)
+              << std::endl;
+    closeFds(inputPipe, 2);
+    closeFds(outputPipe, 2);
+    return false;
+  }
+  // Inherited descriptors are duplicated above the numbers they are moved to
+  // in the child, so that moving one can't overwrite another.
+  std::vector<int> inherited;
+  for (auto fd : inheritedFds) {
+    int duplicate = fcntl(fd, F_DUPFD_CLOEXEC, int(3 + inheritedFds.size()));
+    if (duplicate < 0) {
+      std::cerr << __FUNCTION__ << ": ERROR duplicating descriptor: "
+                << strerror(errno) << std::endl;
+      closeFds(inherited.data(), inherited.size());
+      closeFds(inputPipe, 2);
+      closeFds(outputPipe, 2);
+      closeFds(errorPipe, 2);
+      return false;
+    }
+    inherited.push_back(duplicate);
+  }
+
+  pid_t pid = -1;
+  int error = 0;
+#ifndef TINC_SPAWN_CHDIR
+  if (workingDirectory.size() > 0) {
+    // Only async-signal-safe calls are allowed in the child after vfork
+    int devNull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int inputFd = pipeInput ? inputPipe[0] : devNull;
+    bool useProcessGroup = mUseProcessGroup;
+    pid = vfork();
+    if (pid == 0) {
+      if ((useProcessGroup && setpgid(0, 0) != 0) ||
+          chdir(workingDirectory.c_str()) != 0 ||
+          inputFd < 0 || dup2(inputFd, 0) < 0 || dup2(outputPipe[1], 1) < 0 ||
+          dup2(errorPipe[1], 2) < 0) {
+        _exit(127);
+      }
+      for (size_t i = 0; i < inherited.size(); i++) {
+        if (dup2(inherited[i], 3 + i) < 0) {
+          _exit(127);
+        }
+      }
+      execvp(argv[0], argv.data());
+      _exit(127);
+    }
+    error = pid < 0 ? errno : 0;
+    if (devNull >= 0) {
+      close(devNull);
+    }
+  } else
+#endif
+  {
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    if (mUseProcessGroup) {
+      posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+      posix_spawnattr_setpgroup(&attributes, 0);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (pipeInput) {
+      posix_spawn_file_actions_adddup2(&actions, inputPipe[0], 0);
+    } else {
+      posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&actions, outputPipe[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, errorPipe[1], 2);
+    for (size_t i = 0; i < inherited.size(); i++) {
+      posix_spawn_file_actions_adddup2(&actions, inherited[i], 3 + i);
+    }
+#ifdef TINC_SPAWN_CHDIR
+    if (workingDirectory.size() > 0) {
+      posix_spawn_file_actions_addchdir_np(&actions, workingDirectory.c_str());
+    }
+#endif
+    error = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(),
+                         environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+  }
+  if (inputPipe[0] >= 0) {
+    close(inputPipe[0]);
+  }
+  close(outputPipe[1]);
+  close(errorPipe[1]);
+  closeFds(inherited.data(), inherited.size());
+  if (error != 0) {
+    std::cerr << __FUNCTION__ << ": ERROR starting " << arguments[0] << ": "
+              << strerror(error) << std::endl;
+    if (inputPipe[1] >= 0) {
+      close(inputPipe[1]);
+    }
+    close(outputPipe[0]);
+    close(errorPipe[0]);
+    return false;
+  }
+  mInputFd = inputPipe[1];
+  mOutputFd = outputPipe[0];
+  mErrorFd = errorPipe[0];
+  std::unique_lock<std::mutex> lk(mPidLock);
+  mPid = pid;
+  mTerminated = false;
+  return true;
+#else
+  std::cerr << __FUNCTION__ << ": ERROR Subprocess not supported on Windows"
+            << std::endl;
+  return false;
+#endif
+}
+
+bool Subprocess::writeInput(const void *data, size_t size) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  auto bytes = static_cast<const char *>(data);
+  while (size > 0 && mInputFd >= 0) {
+    ssize_t written = send(mInputFd, bytes, size, flags);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return size == 0;
+#else
+  return false;
+#endif
+}
+
+void Subprocess::closeInput() {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  if (mInputFd >= 0) {
+    close(mInputFd);
+  }
+#endif
+  mInputFd = -1;
+}
+
+bool Subprocess::readOutput(void *data, size_t size, std::string *errorOutput) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  auto bytes = static_cast<char *>(data);
+  char buffer[4096];
+  while (size > 0) {
+    if (mOutputFd < 0) {
+      return false;
+    }
+    struct pollfd fds[2];
+    fds[0].fd = mOutputFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = mErrorFd;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t count = read(mErrorFd, buffer, sizeof(buffer));
+      if (count > 0) {
+        if (errorOutput) {
+          errorOutput->append(buffer, count);
+        }
+      } else if (count == 0 || errno != EINTR) {
+        close(mErrorFd);
+        mErrorFd = -1;
+      }
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t count = read(mOutputFd, bytes, size);
+      if (count > 0) {
+        bytes += count;
+        size -= count;
+      } else if (count == 0 || errno != EINTR) {
+        return false;
+      }
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool Subprocess::wait(int &exitCode, std::string *output,
+                      std::string *errorOutput) {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  if (!running()) {
+    return false;
+  }
+  closeInput();
+  std::vector<char> buffer(1 << 16);
+  struct pollfd fds[2];
+  fds[0].fd = mOutputFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = mErrorFd;
+  fds[1].events = POLLIN;
+  std::string *destinations[2] = {output, errorOutput};
+  // Both pipes must be drained, otherwise the child can block writing to a
+  // full pipe. Processes started by a terminated child may keep the pipes
+  // open, so polling wakes up regularly to check if the child has exited.
+  while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+    int ready = poll(fds, 2, 100);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << __FUNCTION__ << ": ERROR polling: " << strerror(errno)
+                << std::endl;
+      break;
+    }
+    if (ready == 0) {
+      bool terminated;
+      {
+        std::unique_lock<std::mutex> lk(mPidLock);
+        terminated = mTerminated;
+      }
+      if (terminated && exited()) {
+        break;
+      }
+      continue;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        continue;
+      }
+      ssize_t bytes = read(fds[i].fd, buffer.data(), buffer.size());
+      if (bytes > 0) {
+        if (destinations[i]) {
+          destinations[i]->append(buffer.data(), bytes);
+        }
+      } else if (bytes == 0 || errno != EINTR) {
+        close(fds[i].fd);
+        fds[i].fd = -1; // Negative fds are ignored by poll
+      }
+    }
+  }
+  closeFds(&fds[0].fd, 1);
+  closeFds(&fds[1].fd, 1);
+  mOutputFd = mErrorFd = -1;
+
+  // Wait for the child to exit without reaping it, so that terminate() can't
+  // signal a reused pid and doesn't block while the child runs.
+  pid_t pid;
+  {
+    std::unique_lock<std::mutex> lk(mPidLock);
+    pid = mPid;
+  }
+  siginfo_t info;
+  while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0 && errno == EINTR) {
+  }
+  int status = 0;
+  pid_t result;
+  std::unique_lock<std::mutex> lk(mPidLock);
+  while ((result = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+  }
+  mPid = -1;
+  if (result < 0) {
+    std::cerr << __FUNCTION__ << ": ERROR waiting for process: "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Subprocess::terminate() {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  std::unique_lock<std::mutex> lk(mPidLock);
+  if (mPid > 0) {
+    // The child is not reaped before mPid is reset, so its pid and process
+    // group id can't have been reused
+    kill(mUseProcessGroup ? -mPid : mPid, SIGTERM);
+    mTerminated = true;
+  }
+#endif
+}
+
+bool Subprocess::running() {
+  std::unique_lock<std::mutex> lk(mPidLock);
+  return mPid > 0;
+}
+
+bool Subprocess::exited() {
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  std::unique_lock<std::mutex> lk(mPidLock);
+  if (mPid <= 0) {
+    return false;
+  }
+  siginfo_t info;
+  info.si_pid = 0;
+  if (waitid(P_PID, mPid, &info, WEXITED | WNOHANG | WNOWAIT) < 0) {
+    return false;
+  }
+  return info.si_pid != 0;
+#else
+  return false;
+#endif
+}
+
+void Subprocess::closePipes() {
+  closeInput();
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+  if (mOutputFd >= 0) {
+    close(mOutputFd);
+  }
+  if (mErrorFd >= 0) {
+    close(mErrorFd);
+  }
+#endif
+  mOutputFd = mErrorFd = -1;
+}
@@ -1,6 +1,8 @@
+#include "tinc/DiskBufferBinaryArray.hpp"
 #include "tinc/DiskBufferImage.hpp"
 #include "tinc/DiskBufferJson.hpp"
 #include "tinc/DiskBufferNetCDF.hpp"
+#include "tinc/Executor.hpp"
 #include "tinc/ProcessorAsyncWrapper.hpp"
 #include "tinc/ProcessorCpp.hpp"
 #include "tinc/ProcessorGraph.hpp"
@@ -877,6 +879,17 @@ bool processConfigureParameterMessage(ConfigureParameter &conf,
 }
 
 //// ------------------------------------------------------
+TincProtocol::~TincProtocol() {
+  mSliceStreamTimeouts.stop();
+  cancelSliceStreams();
+}
+
+void TincProtocol::setSliceStreamDefaults(size_t chunkSize, size_t window) {
+  std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+  mSliceStreamChunkSize = std::max<size_t>(chunkSize, 1);
+  mSliceStreamWindow = std::max(window, mSliceStreamChunkSize);
+}
+
 void TincProtocol::registerParameter(al::ParameterMeta &pmeta,
                                      al::Socket *src) {
   bool registered = false;
@@ -1559,12 +1572,18 @@ void TincProtocol::sendRegisterMessage(DiskBufferAbstract *db, al::Socket *dst,
 
   DiskBufferType type = DiskBufferType::BINARY;
 
-  if (strcmp(typeid(db).name(), typeid(DiskBufferNetCDFDouble).name()) == 0) {
+  if (dynamic_cast<DiskBufferNetCDFDouble *>(db) ||
+      dynamic_cast<DiskBufferNetCDFFloat *>(db) ||
+      dynamic_cast<DiskBufferNetCDFInt32 *>(db) ||
+      dynamic_cast<DiskBufferNetCDFInt64 *>(db) ||
+      dynamic_cast<DiskBufferNetCDFUInt8 *>(db)) {
     type = DiskBufferType::NETCDF;
-  } else if (strcmp(typeid(db).name(), typeid(ImageDiskBuffer).name()) == 0) {
+  } else if (dynamic_cast<ImageDiskBuffer *>(db)) {
     type = DiskBufferType::IMAGE;
-  } else if (strcmp(typeid(db).name(), typeid(DiskBufferJson).name()) == 0) {
+  } else if (dynamic_cast<DiskBufferJson *>(db)) {
     type = DiskBufferType::JSON;
+  } else if (dynamic_cast<DiskBufferBinaryArray *>(db)) {
+    type = DiskBufferType::BINARY_ARRAY;
   }
   details.set_type(type);
   details.set_basefilename(db->getBaseFileName());
@@ -2288,6 +2307,9 @@ bool TincProtocol::processCommandDataPool(void *any, al::Socket *src) {
 
     for (auto dp : mDataPools) {
       if (dp->getId() == datapoolId) {
+        if (commandSlice.stream()) {
+          return processCommandDataPoolStreamSlice(dp, &incomingCommand, src);
+        }
         auto sliceName = dp->createDataSlice(field, dims);
 
         if (mVerbose) {
@@ -2307,6 +2329,16 @@ bool TincProtocol::processCommandDataPool(void *any, al::Socket *src) {
         auto *commandDetails = command.details().New();
         DataPoolCommandSliceReply reply;
         reply.set_filename(sliceName);
+        BinaryArray::Datatype dataType;
+        std::vector<uint64_t> shape;
+        if (sliceName.size() > 0 &&
+            dp->getSliceInfo(sliceName, dataType, shape)) {
+          // Values of ArrayDataType match BinaryArray::Datatype
+          reply.set_datatype((ArrayDataType)dataType);
+          for (auto size : shape) {
+            reply.add_shape(size);
+          }
+        }
 
         commandDetails->PackFrom(reply);
         command.set_allocated_details(commandDetails);
@@ -2370,6 +2402,276 @@ bool TincProtocol::processCommandDataPool(void *any, al::Socket *src) {
   return false;
 }
 
+bool TincProtocol::processCommandDataPoolStreamSlice(DataPool *dp, void *any,
+                                                     al::Socket *src) {
+  Command &incomingCommand = *static_cast<Command *>(any);
+  DataPoolCommandSlice commandSlice;
+  incomingCommand.details().UnpackTo(&commandSlice);
+  uint64_t commandNumber = incomingCommand.message_id();
+
+  std::vector<std::string> dims;
+  for (size_t i = 0; i < (size_t)commandSlice.dimension_size(); i++) {
+    dims.push_back(commandSlice.dimension(i));
+  }
+  BinaryArray slice;
+  if (!dp->sliceToMemory(commandSlice.field(), dims, slice)) {
+    sendCommandErrorMessage(commandNumber, dp->getId(),
+                            "Unable to create slice", src);
+    return false;
+  }
+
+  TincMessage msg;
+  msg.set_messagetype(MessageType::COMMAND_REPLY);
+  msg.set_objecttype(ObjectType::DATA_POOL);
+  auto *msgDetails = msg.details().New();
+
+  Command command;
+  command.set_message_id(commandNumber);
+  auto commandId = command.id();
+  commandId.set_id(dp->getId());
+
+  auto *commandDetails = command.details().New();
+  DataPoolCommandSliceReply reply;
+  reply.set_datatype((ArrayDataType)slice.getDataType());
+  for (auto size : slice.getShape()) {
+    reply.add_shape(size);
+  }
+  reply.set_bytesize(slice.byteSize());
+  uint64_t streamId;
+  {
+    std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+    streamId = mNextSliceStreamId++;
+  }
+  reply.set_streamid(streamId);
+
+  commandDetails->PackFrom(reply);
+  command.set_allocated_details(commandDetails);
+
+  msgDetails->PackFrom(command);
+  msg.set_allocated_details(msgDetails);
+
+  // Chunks must only be sent after the reply
+  if (!sendProtobufMessage(&msg, src)) {
+    return false;
+  }
+  startSliceStream(streamId, std::move(slice), src, commandSlice.chunksize(),
+                   commandSlice.window());
+  return true;
+}
+
+void TincProtocol::startSliceStream(uint64_t streamId, BinaryArray &&slice,
+                                    al::Socket *dst, size_t chunkSize,
+                                    size_t window) {
+  {
+    std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+    // Remove streams that have completed
+    auto it = mSliceStreams.begin();
+    while (it != mSliceStreams.end()) {
+      if (it->second->finished) {
+        it = mSliceStreams.erase(it);
+      } else {
+        it++;
+      }
+    }
+    auto stream = std::make_unique<SliceStream>();
+    stream->id = streamId;
+    stream->dst = dst;
+    stream->slice = std::move(slice);
+    stream->chunkSize = chunkSize > 0 ? chunkSize : mSliceStreamChunkSize;
+    stream->window = std::max(window > 0 ? window : mSliceStreamWindow,
+                              stream->chunkSize);
+    stream->lastAcknowledged = std::chrono::steady_clock::now();
+    auto &streamRef = *stream;
+    mSliceStreams[streamId] = std::move(stream);
+    scheduleSliceStream(streamRef);
+  }
+  if (!mSliceStreamTimeouts.running()) {
+    mSliceStreamTimeouts.setWaitTime(std::chrono::seconds(1));
+    mSliceStreamTimeouts.start([this]() { return checkSliceStreamTimeouts(); });
+  }
+}
+
+bool TincProtocol::processSliceStreamAck(void *any, al::Socket *src) {
+  google::protobuf::Any *details = static_cast<google::protobuf::Any *>(any);
+  if (!details->Is<DataPoolSliceStreamAck>()) {
+    std::cerr << __FUNCTION__ << ": Stream ack message has invalid payload"
+              << std::endl;
+    return false;
+  }
+  DataPoolSliceStreamAck ack;
+  details->UnpackTo(&ack);
+  std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+  auto it = mSliceStreams.find(ack.streamid());
+  if (it == mSliceStreams.end() || it->second->dst != src) {
+    // Stream might have completed already
+    return true;
+  }
+  auto &stream = *it->second;
+  stream.acknowledgedBytes =
+      std::max<size_t>(stream.acknowledgedBytes, ack.receivedbytes());
+  stream.lastAcknowledged = std::chrono::steady_clock::now();
+  if (ack.cancel()) {
+    stream.cancelled = true;
+  }
+  scheduleSliceStream(stream);
+  return true;
+}
+
+void TincProtocol::cancelSliceStreams(al::Socket *dst) {
+  std::vector<std::unique_ptr<SliceStream>> streams;
+  {
+    std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+    auto it = mSliceStreams.begin();
+    while (it != mSliceStreams.end()) {
+      if (!dst || it->second->dst == dst) {
+        it->second->cancelled = true;
+        streams.push_back(std::move(it->second));
+        it = mSliceStreams.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+  // Streams are no longer in mSliceStreams, so no new tasks are queued for
+  // them. Wait for the last one.
+  for (auto &stream : streams) {
+    if (stream->task.valid()) {
+      Executor::global().wait(stream->task);
+    }
+  }
+}
+
+void TincProtocol::scheduleSliceStream(SliceStream &stream) {
+  if (stream.sending || stream.finished) {
+    return;
+  }
+  if (stream.cancelled || stream.error.size() > 0 ||
+      stream.sentBytes < stream.acknowledgedBytes + stream.window) {
+    stream.sending = true;
+    auto *streamPtr = &stream;
+    stream.task = Executor::global().submit(
+        [this, streamPtr]() { sliceStreamFunction(streamPtr); });
+  }
+}
+
+bool TincProtocol::checkSliceStreamTimeouts() {
+  // Clients that stop acknowledging data are dropped after this time
+  const auto ackTimeout = std::chrono::seconds(30);
+  auto now = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+  for (auto &entry : mSliceStreams) {
+    auto &stream = *entry.second;
+    if (!stream.sending && !stream.finished &&
+        now - stream.lastAcknowledged > ackTimeout) {
+      stream.error = "Timed out waiting for acknowledgement";
+      scheduleSliceStream(stream);
+    }
+  }
+  return true;
+}
+
+void TincProtocol::sliceStreamFunction(SliceStream *stream) {
+  // Only sentBytes and the flags change after the stream is created, and they
+  // are protected by mSliceStreamsLock
+  size_t byteSize = stream->slice.byteSize();
+  bool failed = false;
+  std::unique_lock<std::mutex> lk(mSliceStreamsLock);
+  while (!stream->cancelled && stream->error.size() == 0 &&
+         stream->sentBytes < byteSize &&
+         stream->sentBytes < stream->acknowledgedBytes + stream->window) {
+    size_t offset = stream->sentBytes;
+    size_t size = std::min(stream->chunkSize, byteSize - offset);
+    lk.unlock();
+    failed = !sendSliceStreamChunk(*stream, offset, size);
+    lk.lock();
+    if (failed) {
+      break;
+    }
+    stream->sentBytes += size;
+  }
+  if (stream->error.size() > 0 && !stream->cancelled && !failed) {
+    auto error = stream->error;
+    auto offset = stream->sentBytes;
+    lk.unlock();
+    std::cerr << __FUNCTION__ << ": Slice stream " << stream->id << ": "
+              << error << std::endl;
+    sendSliceStreamChunk(*stream, offset, 0, error);
+    lk.lock();
+  }
+  stream->sending = false;
+  if (failed || stream->cancelled || stream->error.size() > 0 ||
+      stream->sentBytes >= byteSize) {
+    stream->finished = true;
+  }
+}
+
+static void appendVarint(std::string &buffer, uint64_t value) {
+  while (value >= 0x80) {
+    buffer.push_back((char)((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back((char)value);
+}
+
+// Append tag and length of a length delimited protobuf field
+static void appendFieldHeader(std::string &buffer, uint32_t field,
+                              uint64_t length) {
+  appendVarint(buffer, (field << 3) | 2);
+  appendVarint(buffer, length);
+}
+
+bool TincProtocol::sendSliceStreamChunk(SliceStream &stream, size_t offset,
+                                        size_t size, std::string error) {
+  // The message is encoded by hand, so that the data can be sent directly
+  // from the slice buffer. Embedded messages are length delimited fields, so
+  // the headers of all enclosing messages are serialized first and the data
+  // is appended as the last field of the innermost message.
+  DataPoolSliceStreamChunk chunk;
+  chunk.set_streamid(stream.id);
+  chunk.set_offset(offset);
+  chunk.set_error(error);
+  std::string chunkHeader = chunk.SerializeAsString();
+  if (size > 0) {
+    appendFieldHeader(chunkHeader, DataPoolSliceStreamChunk::kDataFieldNumber,
+                      size);
+  }
+  size_t chunkSize = chunkHeader.size() + size;
+
+  google::protobuf::Any details;
+  details.PackFrom(chunk);
+  details.clear_value();
+  std::string detailsHeader = details.SerializeAsString();
+  appendFieldHeader(detailsHeader, google::protobuf::Any::kValueFieldNumber,
+                    chunkSize);
+  size_t detailsSize = detailsHeader.size() + chunkSize;
+
+  TincMessage msg;
+  msg.set_messagetype(MessageType::STREAM_DATA);
+  msg.set_objecttype(ObjectType::DATA_POOL);
+  std::string header = msg.SerializeAsString();
+  appendFieldHeader(header, TincMessage::kDetailsFieldNumber, detailsSize);
+  header += detailsHeader;
+  header += chunkHeader;
+
+  size_t messageSize = header.size() + size;
+  header.insert(0, (const char *)&messageSize, sizeof(size_t));
+
+  auto data = static_cast<const char *>(stream.slice.data()) + offset;
+  std::unique_lock<std::mutex> lk(mSendLock);
+  if (sendBytes(stream.dst, header.data(), header.size()) != header.size() ||
+      (size > 0 && sendBytes(stream.dst, data, size) != size)) {
+    std::cerr << __FUNCTION__ << ": Error sending slice stream " << stream.id
+              << " (" << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+size_t TincProtocol::sendBytes(al::Socket *dst, const char *data,
+                               size_t size) {
+  return dst->send(data, size);
+}
+
 bool TincProtocol::sendProtobufMessage(void *message, al::Socket *dst) {
   google::protobuf::Message &msg =
       *static_cast<google::protobuf::Message *>(message);
@@ -2384,7 +2686,8 @@ bool TincProtocol::sendProtobufMessage(void *message, al::Socket *dst) {
   if (mVerbose) {
     std::cout << __FUNCTION__ << ": Sending bytes " << size << std::endl;
   }
-  auto bytes = dst->send(buffer, size + sizeof(size_t));
+  std::unique_lock<std::mutex> lk(mSendLock);
+  auto bytes = sendBytes(dst, buffer, size + sizeof(size_t));
   if (bytes != size + sizeof(size_t)) {
     buffer[size + 1] = '\0';
     std::cerr << __FUNCTION__ << ": Error sending: " << buffer << " ("
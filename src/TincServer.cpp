@@ -87,6 +87,12 @@ bool TincServer::processIncomingMessage(al::Message &message, al::Socket *src) {
                     << std::endl;
         }
         break;
+      case MessageType::STREAM_ACK:
+        if (!processSliceStreamAck((void *)&details, src)) {
+          std::cerr << __FUNCTION__ << ": Error processing Stream ack message"
+                    << std::endl;
+        }
+        break;
       case MessageType::PING:
         std::cerr << __FUNCTION__
                   << ": Ping message received, but not implemented"
@@ -297,6 +303,7 @@ std::pair<std::string, uint16_t> TincServer::serverAddress() {
 }
 
 void TincServer::disconnectAllClients() {
+  cancelSliceStreams();
   std::unique_lock<std::mutex> lk(mConnectionsLock);
   for (auto conn : mServerConnections) {
     conn->close();
@@ -318,6 +325,7 @@ void TincServer::processBarrierAckLock(al::Socket *src,
 }
 
 void TincServer::disconnectClient(al::Socket *src) {
+  cancelSliceStreams(src);
   std::unique_lock<std::mutex> lk(mConnectionsLock);
   for (auto connIt = mServerConnections.begin();
        connIt != mServerConnections.end(); connIt++) {
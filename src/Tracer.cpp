@@ -0,0 +1,155 @@
+#include "tinc/Tracer.hpp"
+#include "tinc/IdObject.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+using namespace tinc;
+
+namespace {
+uint64_t steadyNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+thread_local int64_t threadSample = -1;
+} // namespace
+
+Tracer::Tracer(size_t capacity)
+    : mEpoch(steadyNanoseconds()), mCapacity(std::max(capacity, size_t(1))) {}
+
+Tracer &Tracer::global() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::setCapacity(size_t capacity) {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  mCapacity = std::max(capacity, size_t(1));
+  mSpans.clear();
+  mSpans.shrink_to_fit();
+  mNext = 0;
+  mRecorded = 0;
+}
+
+size_t Tracer::capacity() {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  return mCapacity;
+}
+
+uint64_t Tracer::now() const { return steadyNanoseconds() - mEpoch; }
+
+void Tracer::record(Span span) {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  // The buffer grows up to capacity, then the oldest span is overwritten
+  if (mSpans.size() < mCapacity) {
+    mSpans.push_back(std::move(span));
+  } else {
+    mSpans[mNext] = std::move(span);
+  }
+  mNext = (mNext + 1) % mCapacity;
+  mRecorded++;
+}
+
+std::vector<Tracer::Span> Tracer::spans() {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  if (mSpans.size() < mCapacity) {
+    return mSpans;
+  }
+  std::vector<Span> spans;
+  spans.reserve(mSpans.size());
+  spans.insert(spans.end(), mSpans.begin() + mNext, mSpans.end());
+  spans.insert(spans.end(), mSpans.begin(), mSpans.begin() + mNext);
+  return spans;
+}
+
+uint64_t Tracer::droppedSpans() {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  return mRecorded - mSpans.size();
+}
+
+void Tracer::clear() {
+  std::unique_lock<std::mutex> lk(mSpansLock);
+  mSpans.clear();
+  mNext = 0;
+  mRecorded = 0;
+}
+
+std::string Tracer::toChromeTrace() {
+  nlohmann::json events = nlohmann::json::array();
+  for (auto &span : spans()) {
+    // Complete events, with times in microseconds
+    nlohmann::json event{{"name", span.name},
+                         {"cat", span.category},
+                         {"ph", "X"},
+                         {"ts", span.start / 1000.0},
+                         {"dur", span.duration / 1000.0},
+                         {"pid", 0},
+                         {"tid", span.threadId}};
+    if (span.sample >= 0) {
+      event["args"]["sample"] = span.sample;
+    }
+    events.push_back(event);
+  }
+  nlohmann::json trace{{"traceEvents", events}, {"displayTimeUnit", "ns"}};
+  return trace.dump();
+}
+
+bool Tracer::writeChromeTrace(std::string filename) {
+  std::ofstream f(filename);
+  if (!f.is_open()) {
+    std::cerr << __FUNCTION__ << ": ERROR opening " << filename << std::endl;
+    return false;
+  }
+  f << toChromeTrace();
+  return f.good();
+}
+
+void Tracer::setCurrentSample(int64_t sample) { threadSample = sample; }
+
+int64_t Tracer::currentSample() { return threadSample; }
+
+uint64_t Tracer::currentThreadId() {
+  static std::atomic<uint64_t> nextId{1};
+  thread_local uint64_t id = nextId++;
+  return id;
+}
+
+TraceScope::TraceScope(const char *name, const std::string &category,
+                       Tracer &tracer)
+    : mTracer(tracer), mName(name), mActive(tracer.enabled()) {
+  if (mActive) {
+    mCategory = category;
+    mStart = mTracer.now();
+  }
+}
+
+TraceScope::TraceScope(const char *name, IdObject &object, Tracer &tracer)
+    : mTracer(tracer), mName(name), mActive(tracer.enabled()) {
+  if (mActive) {
+    mCategory = object.getId();
+    mStart = mTracer.now();
+  }
+}
+
+TraceScope::~TraceScope() { end(); }
+
+void TraceScope::end() {
+  if (!mActive) {
+    return;
+  }
+  mActive = false;
+  Tracer::Span span;
+  span.name = mName;
+  span.category = std::move(mCategory);
+  span.start = mStart;
+  span.duration = mTracer.now() - mStart;
+  span.threadId = Tracer::currentThreadId();
+  span.sample = Tracer::currentSample();
+  mTracer.record(std::move(span));
+}
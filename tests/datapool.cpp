@@ -0,0 +1,290 @@
+#include "gtest/gtest.h"
+
+#include "tinc/DataPool.hpp"
+#include "tinc/DiskBufferBinaryArray.hpp"
+#include "tinc/FieldReader.hpp"
+
+#include "al/io/al_File.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef TINC_HAS_NETCDF
+#include <netcdf.h>
+#endif
+
+using namespace tinc;
+
+// Creates directories "datapool_test/A" and "datapool_test/B", each containing
+// a "results.json" file with a field "values" that spans dimension "inner" and
+// a vector field "position" with three components per sample.
+static void createDataPoolFiles(ParameterSpace &ps) {
+  auto outer = ps.newDimension("outer", ParameterSpaceDimension::ID);
+  float outerValues[] = {0.0, 1.0};
+  outer->setSpaceValues(outerValues, 2);
+  outer->setSpaceIds({"A", "B"});
+
+  auto inner = ps.newDimension("inner");
+  inner->setSpaceValues(std::vector<float>({0.1f, 0.2f, 0.3f}));
+
+  ps.setRootPath("datapool_test");
+  ps.setCurrentPathTemplate("%%outer%%");
+  ps.createDataDirectories();
+
+  for (size_t i = 0; i < 2; i++) {
+    std::ofstream f(al::File::conformDirectory(ps.getRootPath()) +
+                    outer->idAt(i) + "/results.json");
+    f << "{\"values\": [" << i * 10 << "," << i * 10 + 1 << ","
+      << i * 10 + 2 << "], \"position\": [[" << i << ",0,0],[" << i
+      << ",1,0],[" << i << ",2,0]]}";
+  }
+}
+
+TEST(DataPool, SliceToMemory) {
+  ParameterSpace ps;
+  createDataPoolFiles(ps);
+
+  DataPool dp("datapool", ps, "datapool_slices");
+  dp.registerDataFile("results.json", "inner");
+
+  BinaryArray slice;
+  EXPECT_TRUE(dp.sliceToMemory(
+      "position", std::vector<std::string>{"outer", "inner"}, slice));
+  EXPECT_EQ(slice.getShape(), std::vector<uint64_t>({2, 3, 3}));
+  std::vector<float> values;
+  slice.appendValues(values);
+  // position [1, 2, 0] is at outer = 1, inner = 2
+  EXPECT_EQ(values[(1 * 3 + 2) * 3], 1);
+  EXPECT_EQ(values[(1 * 3 + 2) * 3 + 1], 2);
+
+  EXPECT_FALSE(dp.sliceToMemory("position", "unknown", slice));
+
+  al::Dir::removeRecursively("datapool_test");
+  al::Dir::removeRecursively("datapool_slices");
+}
+
+TEST(DataPool, TypedSlice) {
+  ParameterSpace ps;
+  createDataPoolFiles(ps);
+  for (int i = 0; i < 2; i++) {
+    std::vector<int32_t> counts{i * 10, i * 10 + 1, i * 10 + 2};
+    DiskBufferBinaryArray buffer{"counts", "counts.tincarr",
+                                 "datapool_test/" + std::string(1, 'A' + i)};
+    buffer.writeArray(counts.data(), {3});
+    buffer.waitForPendingWrites();
+  }
+
+  DataPool dp("datapool", ps, "datapool_slices");
+  dp.registerDataFile("counts.tincarr", "inner");
+
+  BinaryArray slice;
+  EXPECT_TRUE(dp.sliceToMemory(
+      "counts", std::vector<std::string>{"outer", "inner"}, slice));
+  EXPECT_EQ(slice.getDataType(), BinaryArray::INT32);
+  EXPECT_EQ(slice.getShape(), std::vector<uint64_t>({2, 3}));
+  EXPECT_EQ(slice.dataAs<int32_t>()[4], 11);
+
+  // Conversion only happens on request
+  std::vector<double> values(slice.elementCount());
+  slice.convertTo(BinaryArray::FLOAT64, values.data());
+  EXPECT_EQ(values[5], 12.0);
+
+  std::vector<float> floatValues(6);
+  EXPECT_EQ(dp.readDataSlice("counts", "inner", floatValues.data(), 6), 3u);
+  EXPECT_EQ(floatValues[2], 2.0f);
+
+  // JSON numbers are read as double
+  DataPool jsonPool("jsonpool", ps, "datapool_slices");
+  jsonPool.registerDataFile("results.json", "inner");
+  EXPECT_TRUE(jsonPool.sliceToMemory("values", "inner", slice));
+  EXPECT_EQ(slice.getDataType(), BinaryArray::FLOAT64);
+
+  // Files of unknown type are read as JSON
+  for (int i = 0; i < 2; i++) {
+    std::ofstream f("datapool_test/" + std::string(1, 'A' + i) +
+                    "/results.txt");
+    f << "{\"values\": [" << i * 10 << "," << i * 10 + 1 << "," << i * 10 + 2
+      << "]}";
+  }
+  DataPool textPool("textpool", ps, "datapool_slices");
+  textPool.registerDataFile("results.txt", "inner");
+  EXPECT_TRUE(textPool.sliceToMemory("values", "inner", slice));
+  EXPECT_EQ(slice.getShape(), std::vector<uint64_t>({3}));
+
+  al::Dir::removeRecursively("datapool_test");
+  al::Dir::removeRecursively("datapool_slices");
+}
+
+TEST(DataPool, ConcurrentSlice) {
+  // Directories are read concurrently, but the slice must not depend on the
+  // order in which reads complete
+  ParameterSpace ps;
+  auto outer = ps.newDimension("outer", ParameterSpaceDimension::ID);
+  std::vector<float> outerValues;
+  std::vector<std::string> outerIds;
+  for (size_t i = 0; i < 8; i++) {
+    outerValues.push_back(i);
+    outerIds.push_back("dir" + std::to_string(i));
+  }
+  outer->setSpaceValues(outerValues);
+  outer->setSpaceIds(outerIds);
+  auto inner = ps.newDimension("inner");
+  inner->setSpaceValues(std::vector<float>({0.1f, 0.2f, 0.3f}));
+
+  ps.setRootPath("datapool_concurrent");
+  ps.setCurrentPathTemplate("%%outer%%");
+  ps.createDataDirectories();
+  for (size_t i = 0; i < outerIds.size(); i++) {
+    std::ofstream f(al::File::conformDirectory(ps.getRootPath()) +
+                    outerIds[i] + "/results.json");
+    f << "{\"values\": [" << i * 10 << "," << i * 10 + 1 << ","
+      << i * 10 + 2 << "]}";
+  }
+
+  DataPool dp("datapool", ps, "datapool_slices");
+  dp.registerDataFile("results.json", "inner");
+  std::vector<std::string> dimensions{"outer", "inner"};
+
+  dp.setReadConcurrency(1);
+  BinaryArray serialSlice;
+  ASSERT_TRUE(dp.sliceToMemory("values", dimensions, serialSlice));
+  EXPECT_EQ(serialSlice.getShape(), std::vector<uint64_t>({8, 3}));
+  auto serialValues = serialSlice.dataAs<double>();
+  for (size_t i = 0; i < 8; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      EXPECT_EQ(serialValues[i * 3 + j], i * 10 + j);
+    }
+  }
+
+  dp.setReadConcurrency(4);
+  for (int repeat = 0; repeat < 10; repeat++) {
+    BinaryArray concurrentSlice;
+    ASSERT_TRUE(dp.sliceToMemory("values", dimensions, concurrentSlice));
+    EXPECT_EQ(concurrentSlice.getDataType(), serialSlice.getDataType());
+    EXPECT_EQ(concurrentSlice.getShape(), serialSlice.getShape());
+    ASSERT_EQ(concurrentSlice.byteSize(), serialSlice.byteSize());
+    EXPECT_EQ(memcmp(concurrentSlice.data(), serialSlice.data(),
+                     serialSlice.byteSize()),
+              0);
+  }
+
+  al::Dir::removeRecursively("datapool_concurrent");
+  al::Dir::removeRecursively("datapool_slices");
+}
+
+#ifdef TINC_HAS_NETCDF
+TEST(DataPool, MultidimensionalSlice) {
+  ParameterSpace ps;
+  createDataPoolFiles(ps);
+
+  DataPool dp("datapool", ps, "datapool_slices");
+  dp.registerDataFile("results.json", "inner");
+  dp.setReadConcurrency(2);
+
+  auto sliceName = dp.createDataSlice(
+      "values", std::vector<std::string>{"outer", "inner"});
+  ASSERT_GT(sliceName.size(), 0);
+
+  int ncid, varid, ndims;
+  int dimids[NC_MAX_VAR_DIMS];
+  ASSERT_EQ(nc_open((dp.getCacheDirectory() + sliceName).c_str(), NC_NOWRITE,
+                    &ncid),
+            NC_NOERR);
+  EXPECT_EQ(nc_inq_varid(ncid, "data", &varid), NC_NOERR);
+  EXPECT_EQ(nc_inq_var(ncid, varid, nullptr, nullptr, &ndims, dimids, nullptr),
+            NC_NOERR);
+  EXPECT_EQ(ndims, 2);
+  float values[6];
+  EXPECT_EQ(nc_get_var_float(ncid, varid, values), NC_NOERR);
+  float expected[] = {0, 1, 2, 10, 11, 12};
+  for (size_t i = 0; i < 6; i++) {
+    EXPECT_EQ(values[i], expected[i]);
+  }
+
+  // Coordinate variables
+  int coordVarid;
+  float innerCoordinates[3];
+  EXPECT_EQ(nc_inq_varid(ncid, "inner", &coordVarid), NC_NOERR);
+  EXPECT_EQ(nc_get_var_float(ncid, coordVarid, innerCoordinates), NC_NOERR);
+  EXPECT_FLOAT_EQ(innerCoordinates[2], 0.3f);
+  nc_close(ncid);
+
+  // Identical requests reuse the existing slice file. Mark the file to check
+  // it is not rewritten.
+  auto sliceFile = dp.getCacheDirectory() + sliceName;
+  ASSERT_EQ(nc_open(sliceFile.c_str(), NC_WRITE, &ncid), NC_NOERR);
+  EXPECT_EQ(nc_redef(ncid), NC_NOERR);
+  EXPECT_EQ(nc_put_att_text(ncid, NC_GLOBAL, "marker", 1, "x"), NC_NOERR);
+  nc_close(ncid);
+  EXPECT_EQ(sliceName, dp.createDataSlice("values", std::vector<std::string>{
+                                                        "outer", "inner"}));
+  size_t markerLen;
+  ASSERT_EQ(nc_open(sliceFile.c_str(), NC_NOWRITE, &ncid), NC_NOERR);
+  EXPECT_EQ(nc_inq_attlen(ncid, NC_GLOBAL, "marker", &markerLen), NC_NOERR);
+  nc_close(ncid);
+
+  // Vector fields add a "components" dimension
+  sliceName = dp.createDataSlice("position", "inner");
+  ASSERT_GT(sliceName.size(), 0);
+  ASSERT_EQ(nc_open((dp.getCacheDirectory() + sliceName).c_str(), NC_NOWRITE,
+                    &ncid),
+            NC_NOERR);
+  EXPECT_EQ(nc_inq_varid(ncid, "data", &varid), NC_NOERR);
+  EXPECT_EQ(nc_inq_var(ncid, varid, nullptr, nullptr, &ndims, dimids, nullptr),
+            NC_NOERR);
+  EXPECT_EQ(ndims, 2);
+  size_t len;
+  EXPECT_EQ(nc_inq_dimlen(ncid, dimids[1], &len), NC_NOERR);
+  EXPECT_EQ(len, 3);
+  nc_close(ncid);
+
+  // Modified files must not be served from the field cache
+  float innerValues[3];
+  EXPECT_EQ(dp.readDataSlice("values", "inner", innerValues, 3), 3);
+  EXPECT_EQ(innerValues[1], 1);
+  {
+    std::ofstream f("datapool_test/A/results.json");
+    f << "{\"values\": [100, 101, 102]}";
+  }
+  EXPECT_EQ(dp.readDataSlice("values", "inner", innerValues, 3), 3);
+  EXPECT_EQ(innerValues[1], 101);
+
+  al::Dir::removeRecursively("datapool_test");
+  al::Dir::removeRecursively("datapool_slices");
+}
+#endif
+
+TEST(DataPool, FieldReaders) {
+  {
+    std::ofstream f("fields.csv");
+    f << "time, label, value\n0.0, a, 1.5\n1.0, b, 2.5\n2.0, c, 3.5\n";
+  }
+  CsvFieldReader csvReader;
+  BinaryArray column;
+  EXPECT_TRUE(csvReader.readField("fields.csv", "value", column));
+  EXPECT_EQ(column.getDataType(), BinaryArray::FLOAT64);
+  EXPECT_EQ(column.getShape(), std::vector<uint64_t>({3}));
+  EXPECT_EQ(column.dataAs<double>()[2], 3.5);
+  // Columns that are not numeric can't be read
+  EXPECT_FALSE(csvReader.readField("fields.csv", "label", column));
+
+  DiskBufferBinaryArray arrayBuffer{"array", "fields.tincarr"};
+  std::vector<int32_t> values{1, 2, 3, 4, 5, 6, 7, 8};
+  arrayBuffer.writeArray(values.data(), {4, 2});
+  arrayBuffer.waitForPendingWrites();
+
+  BinaryArrayFieldReader arrayReader;
+  BinaryArray elements;
+  EXPECT_TRUE(arrayReader.readFieldElements("fields.tincarr", "", 1, 2,
+                                            elements));
+  EXPECT_EQ(elements.getShape(), std::vector<uint64_t>({2, 2}));
+  std::vector<float> elementValues;
+  elements.appendValues(elementValues);
+  EXPECT_EQ(elementValues, std::vector<float>({3, 4, 5, 6}));
+  EXPECT_FALSE(arrayReader.readFieldElements("fields.tincarr", "", 3, 2,
+                                             elements));
+
+  std::remove("fields.csv");
+  std::remove("fields.tincarr");
+}
@@ -0,0 +1,235 @@
+#include "gtest/gtest.h"
+
+#include "tinc/DiskBufferBinaryArray.hpp"
+#include "tinc/DiskBufferJson.hpp"
+#include "tinc/DiskBufferNetCDF.hpp"
+#include "tinc/DiskBufferWatcher.hpp"
+
+#include "al/system/al_Time.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+
+using namespace tinc;
+
+#if defined(AL_LINUX)
+TEST(DiskBuffer, Watcher) {
+  DiskBufferJson jsonBuffer{"json", "watched.json"};
+  std::atomic<int> updates{0};
+  jsonBuffer.registerUpdateCallback([&](bool ok) {
+    if (ok) {
+      updates++;
+    }
+  });
+
+  DiskBufferWatcher watcher(std::chrono::milliseconds(10));
+  watcher << jsonBuffer;
+  EXPECT_TRUE(watcher.start());
+  al::al_sleep(0.1); // Give time for thread to set up watches
+
+  {
+    std::ofstream f("watched.json");
+    f << "{\"value\": 3}";
+  }
+
+  int counter = 0;
+  while (updates == 0 && counter++ < TINC_TESTS_TIMEOUT_MS) {
+    al::al_sleep(0.001);
+  }
+  EXPECT_EQ(updates, 1);
+  EXPECT_EQ((*jsonBuffer.get())["value"].get<int>(), 3);
+
+  watcher.stop();
+  EXPECT_FALSE(watcher.running());
+}
+
+TEST(DiskBuffer, WatcherIgnoresOwnWrites) {
+  DiskBufferJson jsonBuffer{"json", "watched_own.json"};
+  std::atomic<int> updates{0};
+  jsonBuffer.registerUpdateCallback([&](bool) { updates++; });
+  DiskBufferWatcher watcher(std::chrono::milliseconds(10));
+  watcher << jsonBuffer;
+  EXPECT_TRUE(watcher.start());
+  al::al_sleep(0.1);
+
+  // Published directly, the file written is not reloaded
+  EXPECT_TRUE(jsonBuffer.writeJson(nlohmann::json{{"value", 1}}));
+  EXPECT_TRUE(jsonBuffer.waitForPendingWrites());
+  al::al_sleep(0.1);
+  EXPECT_EQ(updates, 1);
+
+  {
+    std::ofstream f("watched_own.json");
+    f << "{\"value\": 2}";
+  }
+  int counter = 0;
+  while (updates == 1 && counter++ < TINC_TESTS_TIMEOUT_MS) {
+    al::al_sleep(0.001);
+  }
+  EXPECT_EQ(updates, 2);
+  EXPECT_EQ((*jsonBuffer.get())["value"].get<int>(), 2);
+  watcher.stop();
+}
+
+TEST(DiskBuffer, WatcherUnregisterFromCallback) {
+  DiskBufferJson jsonBuffer{"json", "watched_unregister.json"};
+  DiskBufferWatcher watcher(std::chrono::milliseconds(10));
+  std::atomic<int> updates{0};
+  // Callbacks run without the watcher lock, so this must not deadlock
+  jsonBuffer.registerUpdateCallback([&](bool) {
+    watcher.unregisterDiskBuffer(jsonBuffer);
+    updates++;
+  });
+  watcher << jsonBuffer;
+  EXPECT_TRUE(watcher.start());
+  al::al_sleep(0.1);
+
+  {
+    std::ofstream f("watched_unregister.json");
+    f << "{\"value\": 1}";
+  }
+  int counter = 0;
+  while (updates == 0 && counter++ < TINC_TESTS_TIMEOUT_MS) {
+    al::al_sleep(0.001);
+  }
+  EXPECT_EQ(updates, 1);
+
+  // No longer watched
+  {
+    std::ofstream f("watched_unregister.json");
+    f << "{\"value\": 2}";
+  }
+  al::al_sleep(0.1);
+  EXPECT_EQ(updates, 1);
+  watcher.stop();
+}
+#endif
+
+TEST(DiskBuffer, JsonWrite) {
+  DiskBufferJson jsonBuffer{"json", "written.json"};
+  bool updated = false;
+  jsonBuffer.registerUpdateCallback([&](bool ok) { updated = ok; });
+
+  nlohmann::json data;
+  data["values"] = {1.5, 2.5, 3.5};
+  EXPECT_TRUE(jsonBuffer.writeJson(data));
+
+  // Data is published before it is written to disk
+  EXPECT_TRUE(updated);
+  EXPECT_EQ(*jsonBuffer.get(), data);
+
+  EXPECT_TRUE(jsonBuffer.waitForPendingWrites());
+  std::ifstream f("written.json");
+  EXPECT_EQ(nlohmann::json::parse(f), data);
+
+  // A failed write is reported by the next write
+  DiskBufferJson missingBuffer{"missing", "written.json", "missing_directory"};
+  EXPECT_TRUE(missingBuffer.writeJson(data));
+  EXPECT_FALSE(missingBuffer.writeJson(data));
+  EXPECT_FALSE(missingBuffer.waitForPendingWrites());
+}
+
+TEST(DiskBuffer, BinaryArray) {
+  DiskBufferBinaryArray writer{"writer", "array.tincarr"};
+  std::vector<float> values{0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f};
+  EXPECT_TRUE(writer.writeArray(values.data(), {2, 3}));
+  EXPECT_TRUE(writer.waitForPendingWrites());
+
+  DiskBufferBinaryArray reader{"reader", "array.tincarr"};
+  EXPECT_TRUE(reader.updateData(""));
+  auto array = reader.get();
+  EXPECT_EQ(array->getDataType(), BinaryArray::FLOAT32);
+  EXPECT_EQ(array->getShape(), std::vector<uint64_t>({2, 3}));
+  EXPECT_EQ(array->getStrides(), std::vector<int64_t>({12, 4}));
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_EQ(array->dataAs<float>()[i], values[i]);
+  }
+}
+
+TEST(DiskBuffer, BinaryArrayOverflow) {
+  BinaryArray array;
+  array.allocate(BinaryArray::FLOAT32, {2, 3});
+  auto encoded = array.encode();
+  std::vector<uint8_t> valid(encoded.begin(), encoded.end());
+
+  auto setValue = [](std::vector<uint8_t> &bytes, size_t offset,
+                     uint64_t value) {
+    for (size_t i = 0; i < 8; i++) {
+      bytes[offset + i] = uint8_t(value >> (8 * i));
+    }
+  };
+  // Shape and strides start after the 16 byte fixed header
+  // (2^63 + 1 - 1) * 2 wraps the span to 0
+  auto wrappedSpan = valid;
+  setValue(wrappedSpan, 16, (1ull << 63) + 1);
+  setValue(wrappedSpan, 32, 2);
+  EXPECT_FALSE(array.decode(std::move(wrappedSpan)));
+
+  // Element count wraps to 0 with zero strides
+  auto wrappedCount = valid;
+  setValue(wrappedCount, 16, 1ull << 32);
+  setValue(wrappedCount, 24, 1ull << 32);
+  setValue(wrappedCount, 32, 0);
+  setValue(wrappedCount, 40, 0);
+  EXPECT_FALSE(array.decode(std::move(wrappedCount)));
+
+  EXPECT_FALSE(array.decodeElements(valid.data(), valid.size(), SIZE_MAX, 2));
+  EXPECT_TRUE(array.decodeElements(valid.data(), valid.size(), 1, 1));
+  EXPECT_EQ(array.getShape(), std::vector<uint64_t>({1, 3}));
+}
+
+#ifdef TINC_HAS_NETCDF
+TEST(DiskBuffer, NetCDFHyperslab) {
+  // "data" has shape {2, 3, 4} and holds its own flat index
+  int ncid, dimids[3], dataVarid, otherVarid;
+  ASSERT_EQ(nc_create("hyperslab.nc", NC_CLOBBER | NC_NETCDF4, &ncid),
+            NC_NOERR);
+  EXPECT_EQ(nc_def_dim(ncid, "time", 2, &dimids[0]), NC_NOERR);
+  EXPECT_EQ(nc_def_dim(ncid, "lat", 3, &dimids[1]), NC_NOERR);
+  EXPECT_EQ(nc_def_dim(ncid, "lon", 4, &dimids[2]), NC_NOERR);
+  EXPECT_EQ(nc_def_var(ncid, "data", NC_INT, 3, dimids, &dataVarid), NC_NOERR);
+  EXPECT_EQ(nc_def_var(ncid, "other", NC_FLOAT, 1, &dimids[2], &otherVarid),
+            NC_NOERR);
+  EXPECT_EQ(nc_enddef(ncid), NC_NOERR);
+  std::vector<int32_t> values(24);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = (int32_t)i;
+  }
+  std::vector<float> other{0.5f, 1.5f, 2.5f, 3.5f};
+  EXPECT_EQ(nc_put_var_int(ncid, dataVarid, values.data()), NC_NOERR);
+  EXPECT_EQ(nc_put_var_float(ncid, otherVarid, other.data()), NC_NOERR);
+  EXPECT_EQ(nc_close(ncid), NC_NOERR);
+
+  // Whole variable in its native type
+  DiskBufferNetCDFInt32 intBuffer{"int", "hyperslab.nc"};
+  EXPECT_TRUE(intBuffer.updateData());
+  EXPECT_EQ(intBuffer.getShape(), std::vector<size_t>({2, 3, 4}));
+  EXPECT_EQ(*intBuffer.get(), values);
+
+  // Element (1, j, 1 + 2k) for j in [0, 3) and k in [0, 2)
+  intBuffer.setHyperslab({1, 0, 1}, {1, 0, 2}, {1, 1, 2});
+  EXPECT_TRUE(intBuffer.updateData());
+  EXPECT_EQ(intBuffer.getShape(), std::vector<size_t>({1, 3, 2}));
+  EXPECT_EQ(*intBuffer.get(), std::vector<int32_t>({13, 15, 17, 19, 21, 23}));
+
+  // Out of bounds hyperslabs fail and keep the previous data
+  intBuffer.setHyperslab({0, 0, 3}, {1, 1, 2});
+  EXPECT_FALSE(intBuffer.updateData());
+  EXPECT_EQ(intBuffer.getShape(), std::vector<size_t>({1, 3, 2}));
+
+  // Values are converted when the types differ
+  DiskBufferNetCDFDouble doubleBuffer{"double", "hyperslab.nc"};
+  doubleBuffer.setHyperslab({0, 2}, {1, 1});
+  EXPECT_TRUE(doubleBuffer.updateData());
+  EXPECT_EQ(*doubleBuffer.get(), std::vector<double>({8, 9, 10, 11}));
+
+  DiskBufferNetCDFFloat floatBuffer{"float", "hyperslab.nc"};
+  floatBuffer.setVariableName("other");
+  EXPECT_TRUE(floatBuffer.updateData());
+  EXPECT_EQ(floatBuffer.getShape(), std::vector<size_t>({4}));
+  EXPECT_EQ(*floatBuffer.get(), other);
+
+  std::remove("hyperslab.nc");
+}
+#endif
@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+
+#include "tinc/DeferredComputation.hpp"
+#include "tinc/Executor.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace tinc;
+
+TEST(Executor, Submit) {
+  Executor executor(2);
+  std::atomic<int> count{0};
+  std::vector<std::future<int>> results;
+  // Tasks that wait for other tasks don't block the workers
+  for (int i = 0; i < 8; i++) {
+    results.push_back(executor.submit([&executor, &count, i]() {
+      std::vector<std::future<void>> inner;
+      for (int j = 0; j < 10; j++) {
+        inner.push_back(executor.submit([&count]() { count++; }));
+      }
+      for (auto &result : inner) {
+        executor.wait(result);
+      }
+      return i;
+    }));
+  }
+  int sum = 0;
+  for (auto &result : results) {
+    sum += executor.wait(result);
+  }
+  EXPECT_EQ(sum, 28);
+  EXPECT_EQ(count, 80);
+
+  executor.setConcurrency(1);
+  EXPECT_EQ(executor.getConcurrency(), 1);
+  auto result = executor.submit([]() { return 3; });
+  EXPECT_EQ(result.get(), 3);
+}
+
+TEST(Executor, ParallelFor) {
+  Executor executor(4);
+  std::vector<size_t> values(1000, 0);
+  EXPECT_TRUE(executor.parallelFor(values.size(), [&](size_t i) {
+    values[i] = i;
+    return true;
+  }));
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_EQ(values[i], i);
+  }
+
+  // Stops early
+  std::atomic<int> count{0};
+  EXPECT_FALSE(executor.parallelFor(
+      1000,
+      [&](size_t i) {
+        count++;
+        return i != 10;
+      },
+      2));
+  EXPECT_LT(count, 1000);
+
+  // Nested in tasks
+  auto result = executor.submit([&]() {
+    return executor.parallelFor(100, [&](size_t) {
+      return executor.parallelFor(10, [](size_t) { return true; });
+    });
+  });
+  EXPECT_TRUE(executor.wait(result));
+}
+
+TEST(Executor, EnsureConcurrency) {
+  Executor executor(2);
+  executor.ensureConcurrency(16);
+  EXPECT_EQ(executor.getConcurrency(), 16);
+  executor.ensureConcurrency(4);
+  EXPECT_EQ(executor.getConcurrency(), 16);
+
+  // All iterations must run at the same time to get past the barrier
+  std::atomic<int> arrived{0};
+  EXPECT_TRUE(executor.parallelFor(
+      17,
+      [&](size_t) {
+        arrived++;
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(TINC_TESTS_TIMEOUT_MS);
+        while (arrived < 17 && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::yield();
+        }
+        return arrived == 17;
+      },
+      17));
+
+  // parallelFor adds the workers it needs
+  EXPECT_TRUE(executor.parallelFor(4, [](size_t) { return true; }, 21));
+  EXPECT_EQ(executor.getConcurrency(), 20);
+}
+
+TEST(Executor, DeferredComputation) {
+  DeferredComputation<int> computation(3);
+  computation.setMaxWorkers(2);
+  computation.setMaxQueuedRequests(2);
+  std::atomic<int> done{0};
+  computation.registerDoneCallback([&](bool ok) {
+    if (ok) {
+      done++;
+    }
+  });
+  auto compute = [](std::shared_ptr<int> buffer, int value) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    *buffer = value;
+    return true;
+  };
+  // Two requests are computed, two wait and the rest supersede each other
+  for (int i = 1; i <= 10; i++) {
+    computation.processAsync(compute, i);
+  }
+  computation.waitForCompletion();
+  EXPECT_FALSE(computation.processing());
+  EXPECT_EQ(computation.droppedRequests() + done, 10);
+  EXPECT_GE(computation.droppedRequests(), 6);
+  EXPECT_TRUE(computation.newDataAvailable());
+  EXPECT_EQ(*computation.get(), 10);
+}
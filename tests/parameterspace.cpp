@@ -270,6 +270,32 @@ TEST(ParameterSpace, Sweep) {
   }
 }
 
+TEST(ParameterSpace, SweepAsyncStop) {
+  ParameterSpace ps;
+  auto dim1 = ps.newDimension("dim1");
+  std::vector<float> dim1Values(100);
+  for (size_t i = 0; i < dim1Values.size(); i++) {
+    dim1Values[i] = i * 0.1f;
+  }
+  dim1->setSpaceValues(dim1Values.data(), dim1Values.size());
+
+  std::atomic<int> runs{0};
+  ProcessorCpp proc("proc");
+  proc.processingFunction = [&]() {
+    runs++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return true;
+  };
+
+  // Stopping must work even if the sweep has not started running yet
+  for (int i = 0; i < 5; i++) {
+    runs = 0;
+    ps.sweepAsync(proc);
+    ps.stopSweep();
+    EXPECT_LT(runs, 100);
+  }
+}
+
 TEST(ParameterSpace, DataDirectories) {
   ParameterSpace ps;
   auto dim1 = ps.newDimension("dim1");
@@ -331,3 +357,122 @@ TEST(ParameterSpace, DataDirectories) {
     EXPECT_TRUE(!al::File::isDirectory(path));
   }
 }
+
+TEST(ParameterSpace, DataDirectoriesNested) {
+  ParameterSpace ps;
+  auto dim1 = ps.newDimension("dim1");
+  auto dim2 = ps.newDimension("dim2", ParameterSpaceDimension::INDEX);
+
+  float dim1Values[4] = {0.1, 0.2, 0.3, 0.4};
+  dim1->setSpaceValues(dim1Values, 4);
+  float dim2Values[5] = {0.1, 0.2, 0.3, 0.4, 0.5};
+  dim2->setSpaceValues(dim2Values, 5, "xx");
+
+  ps.setRootPath("ps_nested_test");
+  ps.setCurrentPathTemplate("a_%%dim1%%/b_%%dim2%%");
+  ps.setFilesystemConcurrency(4);
+  al::Dir::removeRecursively("ps_nested_test/");
+  al::Dir::make("ps_nested_test/");
+
+  // Every parent directory must be created exactly once
+  std::set<std::string> directories;
+  for (auto path : ps.runningPaths()) {
+    for (size_t i = 1; i < path.size(); i++) {
+      if (path[i] == '/' || path[i] == '\\') {
+        directories.insert(path.substr(0, i));
+      }
+    }
+  }
+  std::vector<double> progress;
+  ps.onDataDirectoriesProgress = [&](double value) {
+    progress.push_back(value);
+  };
+
+  EXPECT_TRUE(ps.createDataDirectories());
+  EXPECT_EQ(progress.size(), directories.size());
+  for (size_t i = 1; i < progress.size(); i++) {
+    EXPECT_LT(progress[i - 1], progress[i]);
+  }
+  ASSERT_FALSE(progress.empty());
+  EXPECT_DOUBLE_EQ(progress.back(), 1.0);
+  for (auto path : ps.runningPaths()) {
+    EXPECT_TRUE(al::File::isDirectory(path));
+  }
+
+  progress.clear();
+  EXPECT_TRUE(ps.removeDataDirectories());
+  EXPECT_EQ(progress.size(), ps.runningPaths().size());
+  for (size_t i = 1; i < progress.size(); i++) {
+    EXPECT_LT(progress[i - 1], progress[i]);
+  }
+  ASSERT_FALSE(progress.empty());
+  EXPECT_DOUBLE_EQ(progress.back(), 1.0);
+  for (auto path : ps.runningPaths()) {
+    EXPECT_FALSE(al::File::isDirectory(path));
+  }
+  EXPECT_TRUE(al::File::isDirectory("ps_nested_test/"));
+}
+
+TEST(ParameterSpace, DataDirectoriesKeepRoot) {
+  ParameterSpace ps;
+  auto dim1 = ps.newDimension("dim1");
+  float dim1Values[4] = {0.1, 0.2, 0.3, 0.4};
+  dim1->setSpaceValues(dim1Values, 4);
+
+  // Without filesystem dimensions all running paths resolve to the root
+  ps.setRootPath("ps_root_test");
+  {
+    std::ofstream f("ps_root_test/marker.txt");
+    f << "a";
+  }
+  for (auto path : ps.runningPaths()) {
+    EXPECT_EQ(al::File::conformDirectory(path),
+              al::File::conformDirectory("ps_root_test"));
+  }
+
+  EXPECT_TRUE(ps.removeDataDirectories());
+  EXPECT_TRUE(al::File::exists("ps_root_test/marker.txt"));
+  EXPECT_TRUE(ps.cleanDataDirectories());
+  EXPECT_TRUE(al::File::exists("ps_root_test/marker.txt"));
+}
+
+TEST(ParameterSpace, SweepBatch) {
+  ParameterSpace ps;
+  auto dim1 = ps.newDimension("dim1");
+  auto dim2 = ps.newDimension("dim2");
+  auto dim3 = ps.newDimension("dim3");
+
+  float dim1Values[3] = {1, 2, 3};
+  dim1->setSpaceValues(dim1Values, 3);
+  float dim2Values[5] = {10, 20, 30, 40, 50};
+  dim2->setSpaceValues(dim2Values, 5);
+  float dim3Values[2] = {100, 200};
+  dim3->setSpaceValues(dim3Values, 2);
+  dim3->setCurrentIndex(1);
+
+  ProcessorCpp proc("proc");
+  size_t calls = 0;
+  proc.batchProcessingFunction = [&](ProcessorCpp::SampleBlock &block) {
+    auto x = block.inputs["dim1"];
+    auto y = block.inputs["dim2"];
+    auto z = proc.configuration["dim3"].valueDouble;
+    auto out = block.outputs["sum"];
+    for (size_t i = 0; i < block.size; i++) {
+      out[i] = x[i] + y[i] + z;
+    }
+    calls++;
+    return true;
+  };
+
+  std::map<std::string, std::vector<double>> outputs{{"sum", {}}};
+  EXPECT_TRUE(ps.sweepBatch(proc, outputs, {"dim1", "dim2"}, {}, 4));
+  EXPECT_EQ(calls, 4);
+  auto &sum = outputs["sum"];
+  ASSERT_EQ(sum.size(), 15);
+  // dim1 changes fastest
+  for (size_t j = 0; j < 5; j++) {
+    for (size_t i = 0; i < 3; i++) {
+      EXPECT_EQ(sum[j * 3 + i], dim1Values[i] + dim2Values[j] + 200);
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include "tinc/PeriodicTask.hpp"
+
+#include <atomic>
+#include <thread>
+
+using namespace tinc;
+
+TEST(PeriodicTask, FixedRate) {
+  PeriodicTask task;
+  task.setWaitTime(20ms);
+  std::atomic<int> count{0};
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(task.start([&]() {
+    // Time spent in the function does not delay the next call
+    std::this_thread::sleep_for(10ms);
+    return ++count < 10;
+  }));
+  EXPECT_FALSE(task.start([]() { return true; }));
+  while (task.running()) {
+    std::this_thread::sleep_for(1ms);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(count, 10);
+  EXPECT_GE(elapsed, 180ms);
+  // Loaded machines can delay calls, so the upper bound only catches gross
+  // drift.
+  EXPECT_LT(elapsed, 180ms + std::chrono::milliseconds(TINC_TESTS_TIMEOUT_MS));
+}
+
+TEST(PeriodicTask, SharedThread) {
+  PeriodicTask task1, task2;
+  task1.setWaitTime(1ms);
+  task2.setWaitTime(1ms);
+  task2.setMode(PeriodicTask::FIXED_DELAY);
+  std::atomic<int> count{0};
+  std::thread::id thread1, thread2;
+  task1.start([&]() {
+    thread1 = std::this_thread::get_id();
+    count++;
+    return false;
+  });
+  task2.start([&]() {
+    thread2 = std::this_thread::get_id();
+    count++;
+    return false;
+  });
+  while (count < 2) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_EQ(thread1, thread2);
+  EXPECT_NE(thread1, std::this_thread::get_id());
+}
+
+TEST(PeriodicTask, Stop) {
+  PeriodicTask task;
+  task.setWaitTime(10s);
+  std::atomic<int> count{0};
+  task.start([&]() {
+    count++;
+    return true;
+  });
+  while (count == 0) {
+    std::this_thread::sleep_for(1ms);
+  }
+  // Stopping does not wait for the next deadline
+  auto start = std::chrono::steady_clock::now();
+  task.stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 100ms);
+  EXPECT_FALSE(task.running());
+  EXPECT_EQ(count, 1);
+}
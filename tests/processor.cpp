@@ -3,10 +3,20 @@
 #include "tinc/ProcessorScript.hpp"
 #include "tinc/ProcessorCpp.hpp"
 #include "tinc/ProcessorGraph.hpp"
+#include "tinc/Subprocess.hpp"
 
 #include "al/math/al_Random.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <thread>
+
+#ifndef AL_WINDOWS
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+#endif
 
 using namespace tinc;
 
@@ -55,3 +65,542 @@ TEST(Processor, ConnectOutputFiles) {
 
   EXPECT_FLOAT_EQ(value, 2.0);
 }
+
+TEST(ProcessorGraph, Dependencies) {
+  ProcessorCpp a("a"), b("b"), c("c"), d("d");
+  ProcessorGraph graph(ProcessorGraph::PROCESS_GRAPH, "graph");
+  graph << d << c << b << a;
+  graph.setMaxConcurrency(4);
+
+  auto writeFile = [](std::string name) {
+    std::ofstream f(name);
+    f << name;
+    return f.good();
+  };
+  std::atomic<int> runs{0};
+  std::atomic<bool> aDone{false}, bDone{false}, cDone{false};
+  std::atomic<bool> orderOk{true};
+  // b and c wait for each other, so they only both finish waiting if they
+  // run at the same time
+  std::atomic<int> started{0};
+  std::atomic<int> overlapped{0};
+  auto waitForOther = [&]() {
+    started++;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (started < 2 && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (started >= 2) {
+      overlapped++;
+    }
+  };
+  a.setOutputFileNames({"graph_a.txt"});
+  a.processingFunction = [&]() {
+    runs++;
+    bool ok = writeFile("graph_a.txt");
+    aDone = true;
+    return ok;
+  };
+  b.setInputFileNames({"graph_a.txt"});
+  b.setOutputFileNames({"graph_b.txt"});
+  b.processingFunction = [&]() {
+    runs++;
+    if (!aDone) {
+      orderOk = false;
+    }
+    waitForOther();
+    bool ok = writeFile("graph_b.txt");
+    bDone = true;
+    return ok;
+  };
+  c.setInputFileNames({"graph_a.txt"});
+  c.setOutputFileNames({"graph_c.txt"});
+  c.processingFunction = [&]() {
+    runs++;
+    if (!aDone) {
+      orderOk = false;
+    }
+    waitForOther();
+    bool ok = writeFile("graph_c.txt");
+    cDone = true;
+    return ok;
+  };
+  d.setInputFileNames({"graph_b.txt", "graph_c.txt"});
+  d.processingFunction = [&]() {
+    runs++;
+    // Inputs have been written before this runs
+    if (!bDone || !cDone) {
+      orderOk = false;
+    }
+    return al::File::exists("graph_b.txt") && al::File::exists("graph_c.txt");
+  };
+  EXPECT_EQ(graph.getDependencies().size(), 4);
+
+  EXPECT_TRUE(graph.process(true));
+  EXPECT_EQ(runs, 4);
+  // b and c run concurrently after a, d runs after both
+  EXPECT_TRUE(orderOk);
+  EXPECT_EQ(overlapped, 2);
+
+  // Processors with unchanged inputs and existing outputs are skipped. d has
+  // no output files so it is not skipped.
+  EXPECT_TRUE(graph.process());
+  EXPECT_TRUE(graph.getTimings()["b"].skipped);
+  EXPECT_FALSE(graph.getTimings()["d"].skipped);
+
+  // Dependents of failed processors don't run
+  runs = 0;
+  a.processingFunction = [&]() { return false; };
+  EXPECT_FALSE(graph.process(true));
+  EXPECT_FALSE(graph.getResults()["d"]);
+  EXPECT_EQ(runs, 0);
+
+  // Cycles are rejected
+  graph.addDependency(d, a);
+  EXPECT_FALSE(graph.process(true));
+
+  for (auto name : {"graph_a.txt", "graph_b.txt", "graph_c.txt"}) {
+    std::remove(name);
+  }
+}
+
+TEST(ProcessorGraph, Async) {
+  ProcessorCpp first("first"), second("second");
+  ProcessorGraph graph(ProcessorGraph::PROCESS_ASYNC, "graph");
+  graph << first << second;
+  auto sleep = []() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return true;
+  };
+  first.processingFunction = sleep;
+  second.processingFunction = sleep;
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(graph.process(true));
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(550));
+}
+
+TEST(ProcessorCpp, Cancel) {
+  ProcessorCpp proc("cancel");
+  std::atomic<int> steps{0};
+  proc.processingFunction = [&]() {
+    while (!proc.cancelled()) {
+      steps++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  };
+  ProcessorGraph graph("graph");
+  graph << proc;
+
+  CancellationToken token;
+  std::thread canceller([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    token.cancel();
+  });
+  // Token is passed from the graph to its processors
+  EXPECT_FALSE(graph.processCancellable(true, token));
+  canceller.join();
+  EXPECT_GT(steps, 0);
+  EXPECT_FALSE(graph.getResults()["cancel"]);
+}
+
+TEST(ProcessorCpp, CancelOverlappingRuns) {
+  ProcessorCpp proc("overlapping");
+  std::atomic<int> started{0};
+  std::atomic<bool> timedOut{false};
+  proc.processingFunction = [&]() {
+    started++;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!proc.cancelled()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        timedOut = true;
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  };
+  // Each run sees only its own token, even after the other run finishes
+  CancellationToken firstToken, secondToken;
+  std::atomic<bool> firstDone{false}, secondDone{false};
+  std::thread first([&]() {
+    proc.processCancellable(true, firstToken);
+    firstDone = true;
+  });
+  std::thread second([&]() {
+    proc.processCancellable(true, secondToken);
+    secondDone = true;
+  });
+  while (started < 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  firstToken.cancel();
+  first.join();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(secondDone);
+  secondToken.cancel();
+  second.join();
+  EXPECT_FALSE(timedOut);
+}
+
+TEST(ProcessorGraph, Incremental) {
+  ProcessorCpp first("first"), second("second");
+  ProcessorGraph graph("graph");
+  graph << first << second;
+  graph.setConfigurationKeys(first, {"x"});
+  graph.setConfigurationKeys(second, {"y"});
+  graph.configuration["x"] = 1.0;
+  graph.configuration["y"] = 1.0;
+
+  std::string content = "a";
+  int firstRuns = 0, secondRuns = 0;
+  first.setOutputFileNames({"incremental_first.txt"});
+  first.processingFunction = [&]() {
+    firstRuns++;
+    std::ofstream f("incremental_first.txt");
+    f << content;
+    return true;
+  };
+  second.setInputFileNames({"incremental_first.txt"});
+  second.setOutputFileNames({"incremental_second.txt"});
+  second.processingFunction = [&]() {
+    secondRuns++;
+    std::ofstream f("incremental_second.txt");
+    f << "b";
+    return true;
+  };
+  EXPECT_TRUE(graph.process(true));
+  EXPECT_EQ(firstRuns, 1);
+  EXPECT_EQ(secondRuns, 1);
+
+  // Nothing changed
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 1);
+  EXPECT_EQ(secondRuns, 1);
+
+  // Only the processor using y runs
+  graph.configuration["y"] = 2.0;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 1);
+  EXPECT_EQ(secondRuns, 2);
+
+  // first rewrites identical contents, so second doesn't run
+  graph.configuration["x"] = 2.0;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 2);
+  EXPECT_EQ(secondRuns, 2);
+
+  content = "c";
+  graph.configuration["x"] = 3.0;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 3);
+  EXPECT_EQ(secondRuns, 3);
+
+  std::remove("incremental_first.txt");
+  std::remove("incremental_second.txt");
+}
+
+TEST(ProcessorGraph, IncrementalDependency) {
+  ProcessorCpp first("first"), second("second");
+  ProcessorGraph graph(ProcessorGraph::PROCESS_GRAPH, "graph");
+  // second is only connected through addDependency(), not through files
+  graph.addProcessor(first);
+  graph.addProcessor(second);
+  graph.addDependency(first, second);
+  graph.setConfigurationKeys(first, {"x"});
+  graph.setConfigurationKeys(second, {});
+  graph.configuration["x"] = 1.0;
+
+  std::string content = "a";
+  int firstRuns = 0, secondRuns = 0;
+  first.setOutputFileNames({"dependency_first.txt"});
+  first.processingFunction = [&]() {
+    firstRuns++;
+    std::ofstream f("dependency_first.txt");
+    f << content;
+    return true;
+  };
+  second.setOutputFileNames({"dependency_second.txt"});
+  second.processingFunction = [&]() {
+    secondRuns++;
+    std::ofstream f("dependency_second.txt");
+    f << "b";
+    return true;
+  };
+  // ProcessorCpp only computes when forced. Runs that didn't compute are not
+  // recorded as up to date.
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 0);
+  EXPECT_EQ(secondRuns, 0);
+  EXPECT_TRUE(graph.process(true));
+  EXPECT_EQ(firstRuns, 1);
+  EXPECT_EQ(secondRuns, 1);
+
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 1);
+  EXPECT_EQ(secondRuns, 1);
+
+  // first rewrites identical contents, so second doesn't run
+  graph.configuration["x"] = 2.0;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 2);
+  EXPECT_EQ(secondRuns, 1);
+
+  // first's outputs changed, so second runs
+  content = "c";
+  graph.configuration["x"] = 3.0;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(firstRuns, 3);
+  EXPECT_EQ(secondRuns, 2);
+
+  std::remove("dependency_first.txt");
+  std::remove("dependency_second.txt");
+}
+
+#ifndef AL_WINDOWS
+TEST(ProcessorScript, ProcessAsync) {
+  {
+    std::ofstream f("async_script.sh");
+    f << "sleep 0.2\necho done > \"$1.out\"\n";
+  }
+  ProcessorScript proc("async");
+  proc.setCommand("/bin/sh");
+  proc.setScriptName(al::File::currentPath() + "async_script.sh");
+
+  std::atomic<int> running{0}, maxRunning{0}, doneCount{0};
+  proc.registerStartCallback([&]() {
+    int now = ++running;
+    int previous = maxRunning;
+    while (now > previous && !maxRunning.compare_exchange_weak(previous, now)) {
+    }
+  });
+  auto runAll = [&]() {
+    std::vector<std::future<bool>> results;
+    for (int i = 0; i < 4; i++) {
+      auto directory = "async_run_" + std::to_string(i);
+      al::Dir::make(directory);
+      proc.setRunningDirectory(directory);
+      results.push_back(proc.processAsync(true, [&](bool ok) {
+        running--;
+        doneCount += ok ? 1 : 0;
+      }));
+    }
+    for (auto &result : results) {
+      EXPECT_TRUE(result.get());
+    }
+    proc.waitForAsyncProcesses();
+  };
+
+  // Runs happen concurrently
+  proc.setMaxAsyncProcesses(4);
+  runAll();
+  EXPECT_EQ(doneCount, 4);
+  EXPECT_GT(maxRunning, 1);
+  for (int i = 0; i < 4; i++) {
+    auto directory = "async_run_" + std::to_string(i);
+    EXPECT_EQ(al::itemListInDir(directory).count(), 2); // config and output
+    al::Dir::removeRecursively(directory);
+  }
+
+  // No more than the maximum run at the same time
+  maxRunning = 0;
+  proc.setMaxAsyncProcesses(2);
+  runAll();
+  EXPECT_EQ(doneCount, 8);
+  EXPECT_LE(maxRunning, 2);
+  for (int i = 0; i < 4; i++) {
+    al::Dir::removeRecursively("async_run_" + std::to_string(i));
+  }
+  std::remove("async_script.sh");
+}
+
+TEST(ProcessorGraph, ScriptCache) {
+  {
+    std::ofstream f("cache_script.sh");
+    f << "echo run >> cache_script_runs.txt\necho out > cache_script.out\n";
+  }
+  ProcessorScript proc("cached");
+  proc.setCommand("/bin/sh");
+  proc.setScriptName("cache_script.sh");
+  proc.setOutputFileNames({"cache_script.out"});
+  proc.useCache();
+  auto countRuns = []() {
+    std::ifstream f("cache_script_runs.txt");
+    std::string line;
+    int count = 0;
+    while (std::getline(f, line)) {
+      count++;
+    }
+    return count;
+  };
+  {
+    ProcessorGraph graph("graph");
+    graph << proc;
+    EXPECT_TRUE(graph.process());
+    EXPECT_EQ(countRuns(), 1);
+  }
+  // A new graph has no fingerprints, so the processor's cache decides
+  ProcessorGraph graph("graph");
+  graph << proc;
+  EXPECT_TRUE(graph.process());
+  EXPECT_EQ(countRuns(), 1);
+  EXPECT_TRUE(graph.process(true));
+  EXPECT_EQ(countRuns(), 2);
+
+  for (auto name : {"cache_script.sh", "cache_script_runs.txt",
+                    "cache_script.out", "cache_script.out.meta"}) {
+    std::remove(name);
+  }
+}
+
+TEST(ProcessorScript, PersistentInterpreter) {
+  auto writeScript = [](std::string prefix) {
+    std::ofstream f("persistent_script.py");
+    f << "import json, os, sys\n"
+         "with open(sys.argv[1]) as f:\n"
+         "    config = json.load(f)\n"
+         "config['__output_names'] = ['"
+      << prefix
+      << "' + str(os.getpid())]\n"
+         "with open(sys.argv[1], 'w') as f:\n"
+         "    json.dump(config, f)\n";
+  };
+  writeScript("first");
+  ProcessorScript proc("persistent");
+  proc.setCommand("python3");
+  proc.setScriptName("persistent_script.py");
+  proc.usePersistentInterpreter();
+
+  EXPECT_TRUE(proc.process(true));
+  auto firstOutput = proc.getOutputFileNames().at(0);
+  EXPECT_EQ(firstOutput.substr(0, 5), "first");
+  // Second run uses the same interpreter
+  EXPECT_TRUE(proc.process(true));
+  EXPECT_EQ(proc.getOutputFileNames().at(0), firstOutput);
+
+  // Interpreter is restarted when the script changes
+  writeScript("second");
+  struct stat s;
+  stat("persistent_script.py", &s);
+  struct utimbuf times {
+    s.st_atime, s.st_mtime + 10
+  };
+  utime("persistent_script.py", &times);
+  EXPECT_TRUE(proc.process(true));
+  auto secondOutput = proc.getOutputFileNames().at(0);
+  EXPECT_EQ(secondOutput.substr(0, 6), "second");
+  EXPECT_NE(secondOutput.substr(6), firstOutput.substr(5));
+  std::remove("persistent_script.py");
+}
+
+TEST(ProcessorScript, BinaryConfig) {
+  {
+    std::ofstream f("binary_script.sh");
+    f << "cat \"$1\" > received.bin\ncat reply.bin > \"$1\"\n";
+  }
+  ProcessorScript proc("binary");
+  proc.setCommand("/bin/sh");
+  proc.setScriptName(al::File::currentPath() + "binary_script.sh");
+  proc.setRunningDirectory("binary_run/");
+  proc.setOutputFileNames({"first.txt"});
+  proc.setConfigFormat(ProcessorScript::CONFIG_MSGPACK);
+
+  // The script replaces the configuration with this one
+  nlohmann::json reply;
+  reply["__tinc_metadata_version"] = 0;
+  reply["__output_dir"] = proc.getOutputDirectory();
+  reply["__output_names"] = {"second.txt"};
+  reply["__input_dir"] = proc.getInputDirectory();
+  reply["__input_names"] = std::vector<std::string>();
+  {
+    auto bytes = nlohmann::json::to_msgpack(reply);
+    std::ofstream f("binary_run/reply.bin", std::ios::binary);
+    f.write((const char *)bytes.data(), bytes.size());
+  }
+  EXPECT_TRUE(proc.process(true));
+  ASSERT_EQ(proc.getOutputFileNames().size(), 1);
+  EXPECT_EQ(proc.getOutputFileNames()[0], "second.txt");
+
+  std::ifstream f("binary_run/received.bin", std::ios::binary);
+  std::vector<uint8_t> received((std::istreambuf_iterator<char>(f)),
+                                std::istreambuf_iterator<char>());
+  auto config = nlohmann::json::from_msgpack(received);
+  EXPECT_EQ(config["__output_names"][0], "first.txt");
+  std::remove("binary_script.sh");
+  al::Dir::removeRecursively("binary_run");
+}
+
+TEST(ProcessorScript, Cancel) {
+  {
+    std::ofstream f("cancel_script.sh");
+    // The script's own children don't keep the run from returning
+    f << "sleep 10\n";
+  }
+  ProcessorScript proc("cancel");
+  proc.setCommand("/bin/sh");
+  proc.setScriptName(al::File::currentPath() + "cancel_script.sh");
+  proc.setRunningDirectory("cancel_run");
+
+  CancellationToken token;
+  auto start = std::chrono::steady_clock::now();
+  std::thread canceller([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    token.cancel();
+  });
+  EXPECT_FALSE(proc.processCancellable(true, token));
+  canceller.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+  // Cancelling a previous run doesn't affect the next one
+  {
+    std::ofstream f("cancel_script.sh");
+    f << "exit 0\n";
+  }
+  proc.cancel();
+  EXPECT_TRUE(proc.process(true));
+  std::remove("cancel_script.sh");
+  al::Dir::removeRecursively("cancel_run");
+}
+
+TEST(Subprocess, Output) {
+  al::Dir::make("subprocess_dir");
+  Subprocess process;
+  int exitCode;
+  std::string output, errorOutput;
+  EXPECT_TRUE(process.start(
+      {"/bin/sh", "-c", "pwd; echo message >&2; exit 3"}, "subprocess_dir"));
+  EXPECT_TRUE(process.wait(exitCode, &output, &errorOutput));
+  EXPECT_EQ(exitCode, 3);
+  // Child ran in its own working directory
+  EXPECT_NE(output.find("subprocess_dir"), std::string::npos);
+  EXPECT_EQ(errorOutput, "message\n");
+  EXPECT_FALSE(process.running());
+  al::Dir::removeRecursively("subprocess_dir");
+}
+
+#ifdef AL_LINUX
+TEST(Subprocess, ProcessGroup) {
+  // Prints the shell's pid and process group
+  std::vector<std::string> arguments{
+      "/bin/sh", "-c", "echo $$ $(cut -d' ' -f5 /proc/$$/stat)"};
+  int exitCode;
+  std::string output;
+  Subprocess process;
+  EXPECT_TRUE(process.start(arguments));
+  EXPECT_TRUE(process.wait(exitCode, &output));
+  int pid = 0, group = 0;
+  sscanf(output.c_str(), "%d %d", &pid, &group);
+  // Children stay in this process group, so the terminal's signals reach them
+  EXPECT_EQ(group, getpgrp());
+
+  output.clear();
+  Subprocess groupProcess;
+  groupProcess.useProcessGroup();
+  EXPECT_TRUE(groupProcess.start(arguments));
+  EXPECT_TRUE(groupProcess.wait(exitCode, &output));
+  sscanf(output.c_str(), "%d %d", &pid, &group);
+  EXPECT_EQ(group, pid);
+}
+#endif
+#endif
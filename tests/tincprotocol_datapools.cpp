@@ -7,8 +7,117 @@
 
 #include "al/ui/al_Parameter.hpp"
 
+#include "../src/tinc_protocol.pb.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
 using namespace tinc;
 
+// Keeps the bytes the protocol sends to each socket instead of sending them
+class CaptureProtocol : public TincProtocol {
+public:
+  using TincProtocol::cancelSliceStreams;
+  using TincProtocol::processCommandDataPoolStreamSlice;
+  using TincProtocol::processSliceStreamAck;
+
+  bool barrier(uint32_t group, float timeoutsec) override { return true; }
+
+  size_t sendBytes(al::Socket *dst, const char *data, size_t size) override {
+    std::unique_lock<std::mutex> lk(mCaptureLock);
+    mSent[dst].append(data, size);
+    mSentEvent.notify_all();
+    return size;
+  }
+
+  // Wait until count messages have been sent to dst, and return all messages
+  // sent to dst
+  std::vector<TincMessage> waitForMessages(al::Socket *dst, size_t count) {
+    std::unique_lock<std::mutex> lk(mCaptureLock);
+    std::vector<TincMessage> messages;
+    mSentEvent.wait_for(lk, std::chrono::seconds(5), [&]() {
+      messages = parseMessages(mSent[dst]);
+      return messages.size() >= count;
+    });
+    return messages;
+  }
+
+private:
+  // Split size prefixed frames
+  static std::vector<TincMessage> parseMessages(const std::string &bytes) {
+    std::vector<TincMessage> messages;
+    size_t pos = 0;
+    while (pos + sizeof(size_t) <= bytes.size()) {
+      size_t size;
+      memcpy(&size, bytes.data() + pos, sizeof(size_t));
+      pos += sizeof(size_t);
+      if (pos + size > bytes.size()) {
+        break;
+      }
+      TincMessage msg;
+      EXPECT_TRUE(msg.ParseFromArray(bytes.data() + pos, (int)size));
+      messages.push_back(msg);
+      pos += size;
+    }
+    return messages;
+  }
+
+  std::mutex mCaptureLock;
+  std::condition_variable mSentEvent;
+  std::map<al::Socket *, std::string> mSent;
+};
+
+static Command streamSliceCommand(std::string dataPoolId, std::string field,
+                                  std::vector<std::string> dimensions,
+                                  size_t chunkSize, size_t window) {
+  DataPoolCommandSlice commandSlice;
+  commandSlice.set_field(field);
+  for (auto &dimension : dimensions) {
+    commandSlice.add_dimension(dimension);
+  }
+  commandSlice.set_stream(true);
+  commandSlice.set_chunksize(chunkSize);
+  commandSlice.set_window(window);
+  Command command;
+  command.set_message_id(1);
+  command.mutable_id()->set_id(dataPoolId);
+  command.mutable_details()->PackFrom(commandSlice);
+  return command;
+}
+
+static bool sendStreamAck(CaptureProtocol &protocol, al::Socket *src,
+                          uint64_t streamId, uint64_t receivedBytes) {
+  DataPoolSliceStreamAck ack;
+  ack.set_streamid(streamId);
+  ack.set_receivedbytes(receivedBytes);
+  google::protobuf::Any details;
+  details.PackFrom(ack);
+  return protocol.processSliceStreamAck(&details, src);
+}
+
+// Creates a data pool over directories "datapool_stream/A" and
+// "datapool_stream/B" with a vector field "position" spanning "inner"
+static void createStreamFiles(ParameterSpace &ps) {
+  auto outer = ps.newDimension("outer", ParameterSpaceDimension::ID);
+  float outerValues[] = {0.0, 1.0};
+  outer->setSpaceValues(outerValues, 2);
+  outer->setSpaceIds({"A", "B"});
+  auto inner = ps.newDimension("inner");
+  inner->setSpaceValues(std::vector<float>({0.1f, 0.2f, 0.3f}));
+
+  ps.setRootPath("datapool_stream");
+  ps.setCurrentPathTemplate("%%outer%%");
+  ps.createDataDirectories();
+  for (size_t i = 0; i < 2; i++) {
+    std::ofstream f(al::File::conformDirectory(ps.getRootPath()) +
+                    outer->idAt(i) + "/results.json");
+    f << "{\"position\": [[" << i << ",0,0],[" << i << ",1,0],[" << i
+      << ",2,0]]}";
+  }
+}
+
 TEST(DataPool, Connection) {
   TincServer tserver;
   EXPECT_TRUE(tserver.start());
@@ -29,3 +138,86 @@ TEST(DataPool, Connection) {
   tclient.stop();
   tserver.stop();
 }
+
+TEST(DataPool, StreamSlice) {
+  ParameterSpace ps;
+  createStreamFiles(ps);
+  DataPool dp("datapool", ps, "datapool_stream_slices");
+  dp.registerDataFile("results.json", "inner");
+  std::vector<std::string> dimensions{"outer", "inner"};
+  BinaryArray expected;
+  ASSERT_TRUE(dp.sliceToMemory("position", dimensions, expected));
+  ASSERT_EQ(expected.byteSize(), 144u); // 2 x 3 x 3 doubles
+
+  CaptureProtocol protocol;
+  al::Socket client;
+  const size_t chunkSize = 16, window = 48;
+  auto command =
+      streamSliceCommand("datapool", "position", dimensions, chunkSize, window);
+  ASSERT_TRUE(
+      protocol.processCommandDataPoolStreamSlice(&dp, &command, &client));
+
+  // The reply comes first, then chunks up to the window
+  auto messages = protocol.waitForMessages(&client, 1 + window / chunkSize);
+  ASSERT_GE(messages.size(), 1u);
+  EXPECT_EQ(messages[0].messagetype(), MessageType::COMMAND_REPLY);
+  Command replyCommand;
+  messages[0].details().UnpackTo(&replyCommand);
+  DataPoolCommandSliceReply reply;
+  ASSERT_TRUE(replyCommand.details().UnpackTo(&reply));
+  EXPECT_EQ(reply.bytesize(), expected.byteSize());
+  EXPECT_EQ(reply.datatype(), (ArrayDataType)expected.getDataType());
+  ASSERT_EQ((size_t)reply.shape_size(), expected.getShape().size());
+  for (int i = 0; i < reply.shape_size(); i++) {
+    EXPECT_EQ(reply.shape(i), expected.getShape()[i]);
+  }
+  uint64_t streamId = reply.streamid();
+  EXPECT_NE(streamId, 0u);
+
+  // Reassemble the data, acknowledging it as it arrives
+  std::string data;
+  size_t received = 1;
+  while (data.size() < reply.bytesize()) {
+    size_t windowEnd = std::min<size_t>(data.size() + window, reply.bytesize());
+    size_t chunks = (windowEnd - data.size() + chunkSize - 1) / chunkSize;
+    messages = protocol.waitForMessages(&client, received + chunks);
+    ASSERT_EQ(messages.size(), received + chunks);
+    for (; received < messages.size(); received++) {
+      auto &message = messages[received];
+      EXPECT_EQ(message.messagetype(), MessageType::STREAM_DATA);
+      DataPoolSliceStreamChunk chunk;
+      ASSERT_TRUE(message.details().UnpackTo(&chunk));
+      EXPECT_EQ(chunk.streamid(), streamId);
+      EXPECT_EQ(chunk.error(), "");
+      EXPECT_EQ(chunk.offset(), data.size());
+      EXPECT_LE(chunk.data().size(), chunkSize);
+      data += chunk.data();
+    }
+    // Nothing is sent beyond the window until it is acknowledged
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    messages = protocol.waitForMessages(&client, 0);
+    EXPECT_EQ(messages.size(), received);
+    EXPECT_EQ(data.size(), windowEnd);
+    EXPECT_TRUE(sendStreamAck(protocol, &client, streamId, data.size()));
+  }
+  ASSERT_EQ(data.size(), expected.byteSize());
+  EXPECT_EQ(memcmp(data.data(), expected.data(), data.size()), 0);
+
+  // A stream stops when its client disconnects
+  al::Socket disconnected;
+  auto smallWindow =
+      streamSliceCommand("datapool", "position", dimensions, 16, 16);
+  ASSERT_TRUE(protocol.processCommandDataPoolStreamSlice(&dp, &smallWindow,
+                                                         &disconnected));
+  messages = protocol.waitForMessages(&disconnected, 2);
+  ASSERT_EQ(messages.size(), 2u);
+  messages[0].details().UnpackTo(&replyCommand);
+  replyCommand.details().UnpackTo(&reply);
+  protocol.cancelSliceStreams(&disconnected);
+  EXPECT_TRUE(sendStreamAck(protocol, &disconnected, reply.streamid(), 16));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(protocol.waitForMessages(&disconnected, 0).size(), 2u);
+
+  al::Dir::removeRecursively("datapool_stream");
+  al::Dir::removeRecursively("datapool_stream_slices");
+}
@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+
+#include "tinc/Executor.hpp"
+#include "tinc/ProcessorCpp.hpp"
+#include "tinc/Tracer.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <thread>
+
+using namespace tinc;
+
+TEST(Tracer, RingBuffer) {
+  Tracer tracer(4);
+  for (int i = 0; i < 6; i++) {
+    Tracer::Span span;
+    span.name = "span" + std::to_string(i);
+    tracer.record(span);
+  }
+  auto spans = tracer.spans();
+  ASSERT_EQ(spans.size(), 4);
+  EXPECT_EQ(spans.front().name, "span2");
+  EXPECT_EQ(spans.back().name, "span5");
+  EXPECT_EQ(tracer.droppedSpans(), 2);
+
+  tracer.clear();
+  EXPECT_EQ(tracer.spans().size(), 0);
+  EXPECT_EQ(tracer.droppedSpans(), 0);
+}
+
+TEST(Tracer, Scope) {
+  Tracer tracer;
+  {
+    TraceScope scope("disabled", "test", tracer);
+  }
+  EXPECT_EQ(tracer.spans().size(), 0);
+
+  tracer.enable();
+  Tracer::setCurrentSample(3);
+  {
+    TraceScope scope("enabled", "test", tracer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  Tracer::setCurrentSample(-1);
+  auto spans = tracer.spans();
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_EQ(spans[0].name, "enabled");
+  EXPECT_EQ(spans[0].category, "test");
+  EXPECT_EQ(spans[0].sample, 3);
+  EXPECT_GE(spans[0].duration, 5000000);
+  EXPECT_EQ(spans[0].threadId, Tracer::currentThreadId());
+
+  auto trace = nlohmann::json::parse(tracer.toChromeTrace());
+  ASSERT_EQ(trace["traceEvents"].size(), 1);
+  auto &event = trace["traceEvents"][0];
+  EXPECT_EQ(event["name"], "enabled");
+  EXPECT_EQ(event["ph"], "X");
+  EXPECT_GE(event["dur"].get<double>(), 5000.0);
+  EXPECT_EQ(event["args"]["sample"], 3);
+}
+
+TEST(Tracer, ExecutorTasks) {
+  // Tasks run with the sample of the thread that queued them
+  Executor executor(1);
+  Tracer::setCurrentSample(7);
+  auto sample = executor.submit([]() { return Tracer::currentSample(); });
+  Tracer::setCurrentSample(-1);
+  EXPECT_EQ(executor.wait(sample), 7);
+
+  // A task run while waiting doesn't change the sample of the waiting task
+  Tracer::setCurrentSample(1);
+  auto samples = executor.submit([&executor]() {
+    Tracer::setCurrentSample(2);
+    auto inner = executor.submit([]() { return Tracer::currentSample(); });
+    Tracer::setCurrentSample(1);
+    // Only one worker, so inner runs within wait()
+    auto innerSample = executor.wait(inner);
+    return std::make_pair(innerSample, Tracer::currentSample());
+  });
+  Tracer::setCurrentSample(-1);
+  auto result = executor.wait(samples);
+  EXPECT_EQ(result.first, 2);
+  EXPECT_EQ(result.second, 1);
+}
+
+TEST(Tracer, Processor) {
+  Tracer::global().clear();
+  Tracer::global().enable();
+  ProcessorCpp proc("traced");
+  proc.prepareFunction = []() { return true; };
+  proc.processingFunction = []() { return true; };
+  EXPECT_TRUE(proc.process(true));
+  Tracer::global().enable(false);
+
+  auto spans = Tracer::global().spans();
+  ASSERT_EQ(spans.size(), 2);
+  EXPECT_EQ(spans[0].name, "prepare");
+  EXPECT_EQ(spans[1].name, "execute");
+  EXPECT_EQ(spans[1].category, "traced");
+  EXPECT_LE(spans[0].start + spans[0].duration, spans[1].start);
+  Tracer::global().clear();
+}